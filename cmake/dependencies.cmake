@@ -5,6 +5,7 @@ find_package(fmt REQUIRED)
 
 find_package(prometheus-cpp REQUIRED)
 find_package(RdKafka REQUIRED)
+find_package(re2 REQUIRED)
 
 # Nova
 find_package(spdlog REQUIRED)
@@ -96,9 +96,9 @@ auto produce(const po::variables_map& args) {
 
     const auto message = dsp::message{
         .key = { },
-        .subject = topic,
+        .subject = dsp::subject_ref{ topic },
         .properties = { { "ts", "1234" } },
-        .payload = nova::data_view(data).to_vec()
+        .payload = dsp::payload_buffer::borrow(nova::data_view(data))
     };
 
     auto stat = dsp::statistics{ };
@@ -159,9 +159,11 @@ auto consume([[maybe_unused]] const po::variables_map& args) {
     nova::topic_log::info("kfc", "Subscribed to: {}", topic);
 
     bool eof = false;
+    auto batch = dsp::kf::batch{ batch_size };
 
     while (g_sigint == 0 && stat.n_messages() < max_messages) {
-        for (const auto& message : consumer.consume(batch_size)) {
+        consumer.consume_into(batch);
+        for (const auto& message : batch) {
             if (eof) {
                 stat.reset_uptime();
                 eof = false;
@@ -0,0 +1,265 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Thread placement
+ *
+ * CPU sets of the threads owned by DSP, by role, read from `dsp.threads`.
+ * A thread calls `place_thread()` with its role when it starts; threads
+ * without a CPU set get back the CPUs and memory policy the process started
+ * with, even if their parent thread was placed.
+ */
+
+#pragma once
+
+#include <libnova/error.hpp>
+#include <libnova/log.hpp>
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * @brief   Roles of the threads owned by DSP, they are the keys of `dsp.threads`.
+ */
+namespace thread_role {
+
+inline constexpr auto Listener       = "listener";        ///< Southbound listener: TCP loop, first Kafka consumer
+inline constexpr auto Daemon         = "daemon";          ///< Thread calling `service::start()`
+inline constexpr auto KafkaConsumer  = "kafkaConsumer";   ///< Other Kafka consumers
+inline constexpr auto KafkaWorker    = "kafkaWorker";     ///< Kafka partition workers
+inline constexpr auto KafkaPoller    = "kafkaPoller";     ///< Kafka producer poller
+inline constexpr auto AsyncDrain     = "asyncDrain";      ///< Asynchronous northbound senders
+inline constexpr auto SpillReplay    = "spillReplay";     ///< Spill queue replay
+inline constexpr auto RdkafkaMain    = "rdkafkaMain";     ///< librdkafka main and background threads
+inline constexpr auto RdkafkaBroker  = "rdkafkaBroker";   ///< librdkafka broker threads
+
+inline constexpr auto All = std::array{
+    Listener, Daemon, KafkaConsumer, KafkaWorker, KafkaPoller, AsyncDrain, SpillReplay, RdkafkaMain, RdkafkaBroker
+};
+
+} // namespace thread_role
+
+/**
+ * @brief   Set of CPUs, written as a Linux CPU list, e.g. `0-3,8`.
+ */
+class cpu_set {
+public:
+    /**
+     * @throws  nova::exception if the list is invalid.
+     */
+    [[nodiscard]] static auto parse(std::string_view list) -> cpu_set {
+        auto ret = cpu_set{ };
+        ret.m_list = list;
+
+        const auto invalid = [&]() { return nova::exception("Invalid CPU list: '{}'", list); };
+        const auto number = [&](std::string_view x) -> unsigned {
+            unsigned value = 0;
+            const auto [end, ec] = std::from_chars(x.data(), x.data() + x.size(), value);
+            if (ec != std::errc{ } or end != x.data() + x.size() or value >= CPU_SETSIZE) {
+                throw invalid();
+            }
+            return value;
+        };
+
+        while (not list.empty()) {
+            const auto comma = list.find(',');
+            const auto item = list.substr(0, comma);
+            list = comma == std::string_view::npos ? std::string_view{ } : list.substr(comma + 1);
+
+            const auto dash = item.find('-');
+            const auto first = number(item.substr(0, dash));
+            const auto last = dash == std::string_view::npos ? first : number(item.substr(dash + 1));
+            if (last < first) {
+                throw invalid();
+            }
+            for (auto cpu = first; cpu <= last; ++cpu) {
+                ret.m_cpus.push_back(cpu);
+            }
+        }
+
+        if (ret.m_cpus.empty()) {
+            throw invalid();
+        }
+
+        std::ranges::sort(ret.m_cpus);
+        const auto [first, last] = std::ranges::unique(ret.m_cpus);
+        ret.m_cpus.erase(first, last);
+        return ret;
+    }
+
+    [[nodiscard]] auto cpus() const -> const std::vector<unsigned>& { return m_cpus; }
+    [[nodiscard]] auto str()  const -> const std::string&           { return m_list; }
+
+    /**
+     * @brief   Restrict the calling thread to the set.
+     *
+     * @returns 0 or the error number.
+     */
+    [[nodiscard]] auto apply() const -> int {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const auto cpu : m_cpus) {
+            CPU_SET(cpu, &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+private:
+    std::vector<unsigned> m_cpus;
+    std::string m_list;
+
+};
+
+/**
+ * @brief   Placement of a thread role.
+ *
+ * With `numa_local`, the memory of the thread is allocated on the NUMA node
+ * of the CPU it runs on (`MPOL_LOCAL`), whatever policy the process was
+ * started with. Combined with a CPU set within one node, its buffers stay on
+ * that node.
+ */
+struct thread_cfg {
+    cpu_set cpus;
+    bool numa_local { true };
+};
+
+/**
+ * @brief   Placement of the threads owned by DSP, configured before they start.
+ *
+ * The CPU mask and the memory policy of the thread creating the placement
+ * are the initial ones, restored for the roles without a CPU set. The global
+ * placement is created at startup (`service`), before any thread is placed.
+ */
+class thread_placement {
+    /**
+     * @brief   Highest number of NUMA nodes of a memory policy.
+     */
+    static constexpr std::size_t MaxNodes = 1024;
+
+    struct mempolicy_t {
+        int mode { MPOL_DEFAULT };
+        std::array<unsigned long, MaxNodes / (8 * sizeof(unsigned long))> nodes { };
+    };
+
+public:
+    thread_placement()
+        : m_initial_cpus(current_cpus())
+        , m_initial_policy(current_policy())
+    {}
+
+    [[nodiscard]] static auto global() -> thread_placement& {
+        static auto instance = thread_placement{ };
+        return instance;
+    }
+
+    void assign(const std::string& role, thread_cfg cfg) {
+        auto lock = std::lock_guard{ m_mutex };
+        m_roles.insert_or_assign(role, std::move(cfg));
+    }
+
+    [[nodiscard]] auto find(const std::string& role) const -> std::optional<thread_cfg> {
+        auto lock = std::lock_guard{ m_mutex };
+        const auto it = m_roles.find(role);
+        if (it == std::end(m_roles)) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    /**
+     * @brief   Place the calling thread, failures are logged only.
+     *
+     * A role without a CPU set gets the initial CPU mask and memory policy,
+     * not the ones inherited from the thread that started it.
+     */
+    void apply(const std::string& role) const {
+        const auto cfg = find(role);
+        if (not cfg.has_value()) {
+            if (const auto err = pthread_setaffinity_np(pthread_self(), sizeof(m_initial_cpus), &m_initial_cpus); err != 0) {
+                nova::topic_log::warn("dsp", "Failed to restore CPUs of {} thread: {}", role, std::strerror(err));
+            }
+            set_policy(role, m_initial_policy);
+            return;
+        }
+
+        if (const auto err = cfg->cpus.apply(); err != 0) {
+            nova::topic_log::warn("dsp", "Failed to pin {} thread to CPUs {}: {}", role, cfg->cpus.str(), std::strerror(err));
+            return;
+        }
+
+        set_policy(role, cfg->numa_local ? mempolicy_t{ .mode = MPOL_LOCAL } : m_initial_policy);
+        nova::topic_log::debug("dsp", "Thread {} pinned to CPUs {}", role, cfg->cpus.str());
+    }
+
+    /**
+     * @brief   CPU mask of the thread that created the placement.
+     */
+    [[nodiscard]] auto initial_cpus() const -> const cpu_set_t& {
+        return m_initial_cpus;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, thread_cfg> m_roles;
+    cpu_set_t m_initial_cpus;
+    mempolicy_t m_initial_policy;
+
+    [[nodiscard]] static auto current_cpus() -> cpu_set_t {
+        cpu_set_t ret;
+        CPU_ZERO(&ret);
+        if (const auto err = pthread_getaffinity_np(pthread_self(), sizeof(ret), &ret); err != 0) {
+            throw nova::exception("Cannot get CPU affinity: {}", std::strerror(err));
+        }
+        return ret;
+    }
+
+    /**
+     * @brief   Memory policy of the calling thread, the default one if it cannot be read.
+     *
+     * The system calls are not wrapped by glibc, libnuma is not needed for them.
+     */
+    [[nodiscard]] static auto current_policy() -> mempolicy_t {
+        auto ret = mempolicy_t{ };
+        if (syscall(SYS_get_mempolicy, &ret.mode, ret.nodes.data(), MaxNodes, nullptr, 0) != 0) {
+            nova::topic_log::debug("dsp", "Failed to get memory policy: {}", std::strerror(errno));
+            return mempolicy_t{ };
+        }
+        return ret;
+    }
+
+    static void set_policy(const std::string& role, const mempolicy_t& policy) {
+        const auto with_nodes = policy.mode != MPOL_DEFAULT and policy.mode != MPOL_LOCAL;
+        const auto* nodes = with_nodes ? policy.nodes.data() : nullptr;
+
+        if (syscall(SYS_set_mempolicy, policy.mode, nodes, with_nodes ? MaxNodes : 0) != 0) {
+            nova::topic_log::debug("dsp", "Failed to set memory policy of {} thread: {}", role, std::strerror(errno));
+        }
+    }
+
+};
+
+/**
+ * @brief   Place the calling thread according to its role, see `thread_role`.
+ */
+inline void place_thread(const std::string& role) {
+    thread_placement::global().apply(role);
+}
+
+} // namespace dsp
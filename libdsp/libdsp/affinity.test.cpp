@@ -0,0 +1,62 @@
+#include <libdsp/affinity.hpp>
+
+#include <gmock/gmock.h>
+
+#include <sched.h>
+
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace testing;
+
+TEST(Dsp, CpuSet_Parse) {
+    EXPECT_THAT(dsp::cpu_set::parse("3").cpus(), ElementsAre(3));
+    EXPECT_THAT(dsp::cpu_set::parse("0-3,8,10-11").cpus(), ElementsAre(0, 1, 2, 3, 8, 10, 11));
+    EXPECT_THAT(dsp::cpu_set::parse("4,0-2,1").cpus(), ElementsAre(0, 1, 2, 4));
+    EXPECT_EQ(dsp::cpu_set::parse("0-3,8").str(), "0-3,8");
+
+    EXPECT_THROW((void)dsp::cpu_set::parse(""), nova::exception);
+    EXPECT_THROW((void)dsp::cpu_set::parse("3-1"), nova::exception);
+    EXPECT_THROW((void)dsp::cpu_set::parse("0,,1"), nova::exception);
+    EXPECT_THROW((void)dsp::cpu_set::parse("0-"), nova::exception);
+    EXPECT_THROW((void)dsp::cpu_set::parse("a"), nova::exception);
+    EXPECT_THROW((void)dsp::cpu_set::parse("100000"), nova::exception);
+}
+
+TEST(Dsp, ThreadPlacement_Apply) {
+    cpu_set_t initial;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(initial), &initial), 0);
+
+    // The first CPU the test may run on.
+    std::size_t cpu = 0;
+    while (not CPU_ISSET(cpu, &initial)) {
+        ++cpu;
+    }
+
+    auto placement = dsp::thread_placement{ };
+    placement.assign("test", { .cpus = dsp::cpu_set::parse(std::to_string(cpu)) });
+
+    auto pinned = std::vector<int>{ };
+    auto restored = false;
+    std::jthread{ [&]() {
+        placement.apply("test");
+        cpu_set_t set;
+        ASSERT_EQ(sched_getaffinity(0, sizeof(set), &set), 0);
+        pinned.push_back(CPU_COUNT(&set));
+        pinned.push_back(CPU_ISSET(cpu, &set));
+
+        // Started by a pinned thread, a role without a CPU set gets the initial CPUs back.
+        std::jthread{ [&]() {
+            placement.apply("other");
+            cpu_set_t other;
+            ASSERT_EQ(sched_getaffinity(0, sizeof(other), &other), 0);
+            restored = CPU_EQUAL(&other, &initial);
+        } }.join();
+    } }.join();
+
+    EXPECT_THAT(pinned, ElementsAre(1, 1));
+    EXPECT_TRUE(restored);
+    EXPECT_FALSE(placement.find("other").has_value());
+}
@@ -0,0 +1,162 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Arena
+ *
+ * Scratch memory for objects living as long as one unit of southbound work
+ * (a consumer batch, a TCP read): allocation is a pointer bump, memory is
+ * reclaimed all at once when the unit is done.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * @brief   Monotonic bump allocator, a polymorphic memory resource.
+ *
+ * Memory is allocated in chunks, deallocation is a no-op. Unlike
+ * `std::pmr::monotonic_buffer_resource`, rewinding keeps all chunks, so once
+ * the arena grew to the size of the largest batch, it does not allocate
+ * anymore.
+ *
+ * It is not thread-safe, each thread uses its own via `local()`.
+ */
+class arena : public std::pmr::memory_resource {
+public:
+    static constexpr auto DefaultChunkSize = std::size_t{ 64 * 1024 };
+
+    /**
+     * @brief   Position of the arena, see `rewind()`.
+     */
+    struct checkpoint {
+        std::size_t chunk;
+        std::size_t offset;
+    };
+
+    /**
+     * @brief   Rewind the arena to the current position when going out of scope.
+     *
+     * Scopes can be nested; everything allocated within is released.
+     */
+    class scope {
+    public:
+        explicit scope(arena& a)
+            : m_arena(a)
+            , m_checkpoint(a.mark())
+        {}
+
+        ~scope() {
+            m_arena.rewind(m_checkpoint);
+        }
+
+        scope(const scope&)             = delete;
+        scope& operator=(const scope&)  = delete;
+
+    private:
+        arena& m_arena;
+        checkpoint m_checkpoint;
+
+    };
+
+    explicit arena(std::size_t chunk_size = DefaultChunkSize)
+        : m_chunk_size(chunk_size)
+    {}
+
+    arena(const arena&)             = delete;
+    arena& operator=(const arena&)  = delete;
+
+    ~arena() override = default;
+
+    /**
+     * @brief   Arena of the calling thread.
+     */
+    [[nodiscard]] static auto local() -> arena& {
+        static thread_local auto instance = arena{ };
+        return instance;
+    }
+
+    [[nodiscard]] auto mark() const -> checkpoint {
+        return { m_current, m_offset };
+    }
+
+    /**
+     * @brief   Release everything allocated after the checkpoint.
+     */
+    void rewind(checkpoint cp) {
+        m_current = cp.chunk;
+        m_offset = cp.offset;
+    }
+
+    /**
+     * @brief   Release everything, keeping the chunks.
+     */
+    void reset() {
+        rewind({ 0, 0 });
+    }
+
+    /**
+     * @brief   Total size of the chunks.
+     */
+    [[nodiscard]] auto capacity() const -> std::size_t {
+        std::size_t n = 0;
+        for (const auto& c : m_chunks) {
+            n += c.size;
+        }
+        return n;
+    }
+
+private:
+    struct chunk {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size;
+    };
+
+    std::size_t m_chunk_size;
+    std::vector<chunk> m_chunks;
+    std::size_t m_current { 0 };
+    std::size_t m_offset { 0 };
+
+    auto do_allocate(std::size_t bytes, std::size_t alignment) -> void* override {
+        while (true) {
+            if (m_current < m_chunks.size()) {
+                auto& c = m_chunks[m_current];
+                void* ptr = c.data.get() + m_offset;
+                auto space = c.size - m_offset;
+                if (std::align(alignment, bytes, ptr, space) != nullptr) {
+                    m_offset = c.size - space + bytes;
+                    return ptr;
+                }
+
+                if (m_current + 1 < m_chunks.size()) {
+                    ++m_current;
+                    m_offset = 0;
+                    continue;
+                }
+            }
+
+            // Over-aligned requests get extra room for alignment.
+            const auto size = std::max({ m_chunk_size, bytes + alignment, m_chunks.empty() ? 0 : 2 * m_chunks.back().size });
+            m_chunks.push_back({ std::make_unique_for_overwrite<std::byte[]>(size), size });
+            m_current = m_chunks.size() - 1;
+            m_offset = 0;
+        }
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {
+        /* NO-OP, released by rewind() */
+    }
+
+    [[nodiscard]] auto do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override {
+        return this == &other;
+    }
+
+};
+
+} // namespace dsp
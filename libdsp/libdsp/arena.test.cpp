@@ -0,0 +1,55 @@
+#include <libdsp/arena.hpp>
+
+#include <gmock/gmock.h>
+
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+using namespace testing;
+
+TEST(Dsp, Arena_Alignment) {
+    auto arena = dsp::arena{ 256 };
+
+    static_cast<void>(arena.allocate(1, 1));
+    auto* p = arena.allocate(8, 64);
+
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p) % 64, 0);
+}
+
+TEST(Dsp, Arena_RewindKeepsChunks) {
+    auto arena = dsp::arena{ 256 };
+
+    for (int round = 0; round < 3; ++round) {
+        const dsp::arena::scope scope{ arena };
+
+        auto xs = std::pmr::vector<int>{ &arena };
+        for (int i = 0; i < 1000; ++i) {
+            xs.push_back(i);
+        }
+
+        EXPECT_EQ(xs.back(), 999);
+    }
+
+    // The chunks allocated in the first round are reused.
+    const auto capacity = arena.capacity();
+    {
+        const dsp::arena::scope scope{ arena };
+        auto xs = std::pmr::vector<int>{ &arena };
+        xs.resize(1000);
+    }
+    EXPECT_EQ(arena.capacity(), capacity);
+}
+
+TEST(Dsp, Arena_NestedScope) {
+    auto arena = dsp::arena{ 256 };
+
+    auto* outer = arena.allocate(16, 8);
+    {
+        const dsp::arena::scope scope{ arena };
+        static_cast<void>(arena.allocate(16, 8));
+    }
+
+    auto* next = arena.allocate(16, 8);
+    EXPECT_EQ(static_cast<std::byte*>(next), static_cast<std::byte*>(outer) + 16);
+}
@@ -6,15 +6,24 @@
 
 #pragma once
 
+#include <libdsp/arena.hpp>
+#include <libdsp/delivery.hpp>
+#include <libdsp/message.hpp>
 #include <libdsp/profiler.hpp>
 
 #include <libnova/data.hpp>
 #include <libnova/error.hpp>
 
+#include <algorithm>
 #include <any>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace dsp {
 
@@ -25,44 +34,144 @@ struct context {
     std::shared_ptr<metrics_registry> stats;
     std::shared_ptr<class cache> cache;
     std::any app;
-};
 
-// tag::message[]
-struct message {
-    nova::bytes key;
-    std::string subject;
-    std::unordered_map<std::string, std::string> properties;
-    nova::bytes payload;
+    /**
+     * @brief   Scratch arena of the calling thread.
+     *
+     * It is rewound after each consumer batch and TCP read, memory allocated
+     * from it must not outlive the processing of the current data.
+     */
+    [[nodiscard]] auto arena() const -> class arena& {
+        return dsp::arena::local();
+    }
 };
-// end::message[]
 
 class northbound_interface {
 public:
+    /**
+     * @brief   Send a message, returns false if it was dropped.
+     *
+     * Must be thread-safe: with Kafka partition workers or several consumers
+     * (`partitionWorkers`, `consumers`), handlers send from several threads
+     * at the same time.
+     */
     virtual bool send(const message&) = 0;
     virtual void stop() = 0;
     virtual void update(metrics_registry&) { /* optional */ }
+
+    /**
+     * @brief   Fraction of the interface's buffering capacity in use, 0 (idle) to 1 (full).
+     *
+     * Used for backpressure. Must be cheap, it is called on the hot path.
+     */
+    virtual auto saturation() const -> double { return 0.0; }
+
+    /**
+     * @brief   The interface itself, or the decorated one for wrappers, see `cache::get_northbound()`.
+     */
+    virtual auto unwrap() -> northbound_interface& { return *this; }
+
     virtual ~northbound_interface() = default;
 };
 
 /**
- * @brief   A virtual cache, a proxy, that broadcasts messages to all attached
+ * @brief   A virtual cache, a proxy, that dispatches messages to the attached
  *          northbound interfaces.
+ *
+ * Interfaces are attached by name during configuration. Senders resolve the
+ * name once to a `destination` (a dense index) and send to that interface
+ * only; broadcasting to all interfaces is explicit.
+ *
+ * Interfaces must not be attached after the southbound interface started.
  */
 class cache {
-    using interfaces_a = std::unordered_map<std::string, std::unique_ptr<northbound_interface>>;
+    using interfaces_a = std::vector<std::pair<std::string, std::unique_ptr<northbound_interface>>>;
 
 public:
 
+    /**
+     * @brief   Resolved northbound interface, see `resolve()`.
+     */
+    struct destination {
+        std::uint32_t index;
+
+        friend auto operator==(destination, destination) -> bool = default;
+    };
+
+    /**
+     * @brief   All attached interfaces.
+     */
+    static constexpr auto Broadcast = destination{ std::numeric_limits<std::uint32_t>::max() };
+
+    /**
+     * @throws  if an interface with the same name is already attached.
+     */
     void attach_northbound(const std::string& name, std::unique_ptr<northbound_interface> interface) {
-        m_interfaces.insert({ name, std::move(interface) });
+        if (m_index.contains(name)) {
+            throw nova::exception("Northbound interface is already attached: {}", name);
+        }
+
+        m_index.emplace(name, static_cast<std::uint32_t>(m_interfaces.size()));
+        m_interfaces.emplace_back(name, std::move(interface));
     }
 
     /**
-     * @brief   Send a message.
+     * @brief   Look up an attached interface by name.
+     */
+    [[nodiscard]] auto find(const std::string& name) const -> std::optional<destination> {
+        const auto it = m_index.find(name);
+        if (it == std::end(m_index)) {
+            return std::nullopt;
+        }
+        return destination{ it->second };
+    }
+
+    /**
+     * @brief   Resolve an attached interface by name.
+     *
+     * @throws  in case the interface is unknown.
+     */
+    [[nodiscard]] auto resolve(const std::string& name) const -> destination {
+        const auto ret = find(name);
+        if (not ret.has_value()) {
+            throw nova::exception("Unknown interface with name: {}", name);
+        }
+        return *ret;
+    }
+
+    /**
+     * @brief   Send a message to one interface, or to all of them (`Broadcast`).
+     *
+     * If the interface failed, the delivery token of the current thread (if
+     * any) is failed too.
+     *
+     * @returns with false if the interface failed to process the message.
+     */
+    auto send(destination dest, const message& msg) -> bool {
+        if (dest == Broadcast) {
+            return broadcast(msg);
+        }
+
+        DSP_PROFILING_ZONE("cache");
+        nova_assert(dest.index < m_interfaces.size());
+
+        if (not m_interfaces[dest.index].second->send(msg)) {
+            delivery_scope::fail();
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief   Send a message to all interfaces.
+     *
+     * If any interface failed, the delivery token of the current thread (if
+     * any) is failed too.
      *
      * @returns with false if any interface failed to process the message.
      */
-    auto send(const message& msg) -> bool {
+    auto broadcast(const message& msg) -> bool {
         DSP_PROFILING_ZONE("cache");
         auto success = true;
 
@@ -72,9 +181,24 @@ public:
             }
         }
 
+        if (not success) {
+            delivery_scope::fail();
+        }
+
         return success;
     }
 
+    /**
+     * @brief   Return the highest saturation of the attached interfaces.
+     */
+    [[nodiscard]] auto saturation() const -> double {
+        auto ret = 0.0;
+        for (const auto& [_, x] : m_interfaces) {
+            ret = std::max(ret, x->saturation());
+        }
+        return ret;
+    }
+
     /**
      * @brief   Gracefully stop all interfaces.
      *
@@ -94,12 +218,7 @@ public:
      */
     template <typename Interface>
     [[nodiscard]] auto get_northbound(const std::string& name) -> Interface* {
-        auto it = m_interfaces.find(name);
-        if (it == std::end(m_interfaces)) {
-            throw nova::exception("Unknown interface with name: {}", name);
-        }
-
-        auto* ptr = dynamic_cast<Interface*>(it->second.get());
+        auto* ptr = dynamic_cast<Interface*>(&m_interfaces[resolve(name).index].second->unwrap());
         if (ptr == nullptr) {
             throw nova::exception("Cast failed: interface type mismatch");
         }
@@ -113,6 +232,7 @@ public:
 
 private:
     interfaces_a m_interfaces;
+    std::unordered_map<std::string, std::uint32_t> m_index;
 
 };
 
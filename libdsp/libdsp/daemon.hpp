@@ -76,10 +76,14 @@ private:
  * SIGINT or SIGTERM signals to stop.
  *
  * A function can be attached to do periodical background activities.
+ *
+ * SIGUSR1 requests a reload, it is served on the daemon thread by the
+ * attached reload function at the next period.
  */
 class daemon {
 public:
     using watch_dog = std::function<bool()>;
+    using reload_hook = std::function<void()>;
 
     /**
      * @brief   Attach a function that is called periodically.
@@ -88,6 +92,13 @@ public:
         m_function = std::move(func);
     }
 
+    /**
+     * @brief   Attach a function that is called when SIGUSR1 is received.
+     */
+    void attach_reload(reload_hook func) {
+        m_reload = std::move(func);
+    }
+
     void start(std::chrono::seconds interval) {
         nova::topic_log::info("dsp", "Starting daemon");
 
@@ -96,6 +107,15 @@ public:
                 stop();
             }
 
+            if (g_sigusr1.exchange(0) > 0 and m_reload) {
+                nova::topic_log::debug("dsp", "SIGUSR1 received");
+                try {
+                    std::invoke(m_reload);
+                } catch (const std::exception& ex) {
+                    nova::topic_log::error("dsp", "Reload failed: {}", ex.what());
+                }
+            }
+
             if (m_function) {
                 try {
                     if (not std::invoke(m_function)) {
@@ -118,6 +138,7 @@ private:
     signal_handler m_signal_handler;
 
     watch_dog m_function;
+    reload_hook m_reload;
 
     void stop() {
         nova::topic_log::info("dsp", "Shutting down...");
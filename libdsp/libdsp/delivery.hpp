@@ -0,0 +1,110 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Delivery tracking
+ *
+ * Ties the messages produced northbound to the southbound message they were
+ * derived from, so the source can be acknowledged once all of them are
+ * delivered.
+ */
+
+#pragma once
+
+#include <atomic>
+
+namespace dsp {
+
+/**
+ * @brief   Reference counted completion of a consumed message.
+ *
+ * The owner holds one reference while the message is processed. Northbound
+ * interfaces acquire a reference for each asynchronous send and release it
+ * when the delivery is confirmed (or failed).
+ *
+ * `on_complete()` is called exactly once, by the thread releasing the last
+ * reference. The token can be destroyed there, it is not touched afterwards.
+ */
+class delivery_token {
+public:
+    void acquire() {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            on_complete();
+        }
+    }
+
+    /**
+     * @brief   Mark that (at least) one derived message was not delivered.
+     */
+    void fail() {
+        m_failed.store(true, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto failed() const -> bool {
+        return m_failed.load(std::memory_order_relaxed);
+    }
+
+    delivery_token() = default;
+    delivery_token(const delivery_token&)               = delete;
+    delivery_token(delivery_token&&)                    = delete;
+    delivery_token& operator=(const delivery_token&)    = delete;
+    delivery_token& operator=(delivery_token&&)         = delete;
+
+protected:
+    virtual void on_complete() = 0;
+    ~delivery_token() = default;
+
+private:
+    std::atomic_uint32_t m_pending { 1 };
+    std::atomic_bool m_failed { false };
+
+};
+
+/**
+ * @brief   Set the token of the message processed on the current thread.
+ *
+ * Northbound interfaces pick it up via `current()` without changing the
+ * handler API. Scopes can be nested.
+ */
+class delivery_scope {
+public:
+    explicit delivery_scope(delivery_token* token)
+        : m_previous(s_current)
+    {
+        s_current = token;
+    }
+
+    ~delivery_scope() {
+        s_current = m_previous;
+    }
+
+    delivery_scope(const delivery_scope&)               = delete;
+    delivery_scope& operator=(const delivery_scope&)    = delete;
+
+    /**
+     * @brief   Return the token of the current thread, nullptr if there is none.
+     */
+    [[nodiscard]] static auto current() -> delivery_token* {
+        return s_current;
+    }
+
+    /**
+     * @brief   Fail the token of the current thread (if any), e.g. load shedding.
+     */
+    static void fail() {
+        if (s_current != nullptr) {
+            s_current->fail();
+        }
+    }
+
+private:
+    static inline thread_local delivery_token* s_current = nullptr;
+
+    delivery_token* m_previous;
+
+};
+
+} // namespace dsp
@@ -4,12 +4,14 @@
 
 #pragma once
 
+#include <libdsp/affinity.hpp>
 #include <libdsp/cache.hpp>
 #include <libdsp/daemon.hpp>
 #include <libdsp/handler.hpp>
 #include <libdsp/interfaces.hpp>
 #include <libdsp/kafka.hpp>
 #include <libdsp/metrics.hpp>
+#include <libdsp/spill.hpp>
 #include <libdsp/tcp.hpp>
 
 #include <libnova/log.hpp>
@@ -20,7 +22,9 @@
 
 #include <any>
 #include <chrono>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <thread>
 #include <type_traits>
 #include <vector>
@@ -48,6 +52,8 @@ private:
     std::string m_name;
     service* m_service_handle;
     std::any m_cfg;
+    std::optional<spill::config> m_spill;
+    std::optional<async_northbound_cfg> m_async;
 
     template <typename T>
     [[nodiscard]]
@@ -97,6 +103,15 @@ public:
 
     void kafka_handler(std::unique_ptr<kf::handler> handler);
 
+    /**
+     * @brief   Create a Kafka handler factory and attach it to the service.
+     *
+     * Required for partition workers (a handler for each worker).
+     */
+    template <typename Factory, typename ...Args>
+        requires requires { std::is_base_of_v<kf::handler_factory, Factory>; }
+    void kafka_handler(Args&& ...args);
+
 private:
     service* m_service_handle;
     std::any m_cfg;
@@ -105,6 +120,7 @@ private:
     type m_type { type::empty };
 
     std::unique_ptr<kf::handler> m_kafka_handler { nullptr };
+    std::shared_ptr<kf::handler_factory> m_kafka_factory { nullptr };
     std::shared_ptr<tcp_handler_factory> m_tcp_factory { nullptr };
 
     template <typename T>
@@ -133,12 +149,16 @@ public:
     service(const nova::yaml& config)
         : m_config(config)
     {
+        init_threads();
         init_metrics();
     }
 
     void start() {
         if (m_southbound != nullptr) {
-            m_worker_threads.emplace_back(m_southbound->listener());
+            m_worker_threads.emplace_back([listener = m_southbound->listener()]() {
+                place_thread(thread_role::Listener);
+                listener();
+            });
         }
 
         start_daemon();
@@ -170,6 +190,27 @@ public:
         return m_metrics;
     }
 
+    /**
+     * @brief   Access the cache, e.g. to resolve destinations after all northbound interfaces are attached.
+     */
+    [[nodiscard]] auto get_cache() -> std::shared_ptr<cache> {
+        return m_cache;
+    }
+
+    /**
+     * @brief   Call `func` on the daemon thread when a reload is requested (SIGUSR1).
+     */
+    void on_reload(daemon::reload_hook func) {
+        m_daemon_thread.attach_reload(std::move(func));
+    }
+
+    /**
+     * @brief   Call `func` with the metrics on every daemon tick, e.g. to export application metrics.
+     */
+    void on_update(std::function<void(metrics_registry&)> func) {
+        m_updates.push_back(std::move(func));
+    }
+
     /**
      * @brief   Attach a northbound interface.
      */
@@ -177,6 +218,13 @@ public:
         m_cache->attach_northbound(name, std::move(interface));
     }
 
+    /**
+     * @brief   Attach a northbound interface served by its own thread, see `async_northbound`.
+     */
+    void northbound(const std::string& name, std::unique_ptr<northbound_interface> interface, const async_northbound_cfg& cfg) {
+        m_cache->attach_northbound(name, std::make_unique<async_northbound>(name, std::move(interface), cfg));
+    }
+
     /**
      * @brief   Access a northbound interface.
      */
@@ -220,6 +268,30 @@ public:
             // TODO(refact): Parse chrono from YAML.
             cfg->poll_timeout = std::chrono::milliseconds{ lookup<long>("interfaces.southbound.pollTimeoutMs") };
 
+            // FIXME: yaml.lookup with non-existent key
+            try {
+                cfg->consumers = lookup<std::size_t>("interfaces.southbound.consumers");
+            } catch (...) {}
+
+            // FIXME: yaml.lookup with non-existent key
+            try {
+                cfg->partition_workers = lookup<std::size_t>("interfaces.southbound.partitionWorkers");
+            } catch (...) {}
+
+            // FIXME: yaml.lookup with non-existent key
+            try {
+                if (lookup<bool>("interfaces.southbound.cooperativeRebalance")) {
+                    cfg->props.cooperative_rebalance();
+                }
+            } catch (...) {}
+
+            cfg->backpressure = cfg_backpressure();
+            cfg->replay = cfg_replay();
+            cfg->commit = cfg_commit();
+            if (cfg->commit.has_value()) {
+                cfg->props.manual_offsets();
+            }
+
             builder.m_cfg = std::make_any<std::shared_ptr<kafka_cfg>>(cfg);
         } else if (sbi_type == "custom") {
             /* NO-OP */
@@ -252,6 +324,8 @@ public:
             // TODO(cfg): generic librdkafka config
 
             builder.m_cfg = std::make_any<std::shared_ptr<kf::properties>>(kafka_cfg);
+            builder.m_spill = cfg_spill();
+            builder.m_async = cfg_async();
             return builder;
         } else {
             throw nova::exception("Unsupported northbound configuration: {}", nbi_type);
@@ -268,6 +342,36 @@ private:
     std::unique_ptr<southbound_interface> m_southbound = nullptr;
     std::unique_ptr<pm_exposer> m_exposer = nullptr;
     std::shared_ptr<metrics_registry> m_metrics = nullptr;
+    std::vector<std::function<void(metrics_registry&)>> m_updates;
+
+    /**
+     * @brief   Read the CPU sets of the DSP threads, see `thread_role`.
+     *
+     * It must happen before interfaces are created, some start threads.
+     */
+    void init_threads() {
+        // Created first, on the main thread: it captures the initial CPU mask and memory policy.
+        auto& placement = thread_placement::global();
+        auto numa_local = true;
+
+        // FIXME: yaml.lookup with non-existent key
+        try {
+            numa_local = lookup<bool>("threads.numaLocal");
+        } catch (...) {}
+
+        for (const auto* role : thread_role::All) {
+            auto cpus = std::optional<std::string>{ };
+
+            // FIXME: yaml.lookup with non-existent key
+            try {
+                cpus = lookup<std::string>(fmt::format("threads.{}", role));
+            } catch (...) {}
+
+            if (cpus.has_value()) {
+                placement.assign(role, { .cpus = cpu_set::parse(*cpus), .numa_local = numa_local });
+            }
+        }
+    }
 
     /**
      * @brief   Create metrics registry and Prometheus Exposer.
@@ -295,11 +399,16 @@ private:
      * Daemon can be stopped via sending SIGINT or SIGTERM to the process.
      */
     void start_daemon() {
+        place_thread(thread_role::Daemon);
+
         m_daemon_thread.attach([this]() -> bool {
             m_southbound->update(*m_metrics);
             for (const auto& interface : m_cache->interfaces()) {
                 interface.second->update(*m_metrics);
             }
+            for (const auto& update : m_updates) {
+                update(*m_metrics);
+            }
 
             return true;
         });
@@ -309,6 +418,151 @@ private:
         stop();
     }
 
+    /**
+     * @brief   Read the optional asynchronous send queue configuration of the northbound interface.
+     */
+    [[nodiscard]] auto cfg_async() -> std::optional<async_northbound_cfg> {
+        auto enabled = false;
+
+        // FIXME: yaml.lookup with non-existent key
+        try {
+            enabled = lookup<bool>("interfaces.northbound.async.enabled");
+        } catch (...) {}
+
+        if (not enabled) {
+            return std::nullopt;
+        }
+
+        auto cfg = async_northbound_cfg{
+            .capacity = lookup<std::size_t>("interfaces.northbound.async.capacity"),
+        };
+
+        if (const auto overflow = lookup<std::string>("interfaces.northbound.async.overflow"); overflow == "block") {
+            cfg.overflow = overflow_policy::block;
+        } else if (overflow == "dropNewest") {
+            cfg.overflow = overflow_policy::drop_newest;
+        } else if (overflow == "dropOldest") {
+            cfg.overflow = overflow_policy::drop_oldest;
+        } else {
+            throw nova::exception("Unsupported overflow policy: {}", overflow);
+        }
+
+        return cfg;
+    }
+
+    /**
+     * @brief   Read the optional spill queue configuration of the northbound interface.
+     */
+    [[nodiscard]] auto cfg_spill() -> std::optional<spill::config> {
+        static constexpr std::size_t MByte = 1024 * 1024;
+
+        auto enabled = false;
+
+        // FIXME: yaml.lookup with non-existent key
+        try {
+            enabled = lookup<bool>("interfaces.northbound.spill.enabled");
+        } catch (...) {}
+
+        if (not enabled) {
+            return std::nullopt;
+        }
+
+        auto cfg = spill::config{
+            .directory = lookup<std::string>("interfaces.northbound.spill.path"),
+            .segment_size = lookup<std::size_t>("interfaces.northbound.spill.segmentSizeMb") * MByte,
+            .max_segments = lookup<std::size_t>("interfaces.northbound.spill.maxSegments"),
+            .replay_queue_size = lookup<std::size_t>("interfaces.northbound.spill.replayQueueSize"),
+        };
+
+        // FIXME: yaml.lookup with non-existent key
+        try {
+            cfg.sync = lookup<bool>("interfaces.northbound.spill.sync");
+        } catch (...) {}
+
+        return cfg;
+    }
+
+    /**
+     * @brief   Read the optional replay configuration of the Kafka listener.
+     */
+    [[nodiscard]] auto cfg_replay() -> std::optional<kafka_replay_cfg> {
+        auto enabled = false;
+
+        // FIXME: yaml.lookup with non-existent key
+        try {
+            enabled = lookup<bool>("interfaces.southbound.replay.enabled");
+        } catch (...) {}
+
+        if (not enabled) {
+            return std::nullopt;
+        }
+
+        auto cfg = kafka_replay_cfg{
+            .from = std::chrono::system_clock::time_point{
+                std::chrono::milliseconds{ lookup<long>("interfaces.southbound.replay.fromEpochMs") }
+            },
+        };
+
+        // FIXME: yaml.lookup with non-existent key
+        try {
+            cfg.max_messages = lookup<double>("interfaces.southbound.replay.maxMessagesPerSecond");
+        } catch (...) {}
+
+        try {
+            cfg.max_bytes = lookup<double>("interfaces.southbound.replay.maxBytesPerSecond");
+        } catch (...) {}
+
+        return cfg;
+    }
+
+    /**
+     * @brief   Read the optional backpressure configuration of the Kafka listener.
+     */
+    [[nodiscard]] auto cfg_backpressure() -> std::optional<kafka_backpressure_cfg> {
+        auto enabled = false;
+
+        // FIXME: yaml.lookup with non-existent key
+        try {
+            enabled = lookup<bool>("interfaces.southbound.backpressure.enabled");
+        } catch (...) {}
+
+        if (not enabled) {
+            return std::nullopt;
+        }
+
+        auto cfg = kafka_backpressure_cfg{
+            .high = lookup<double>("interfaces.southbound.backpressure.high"),
+            .low = lookup<double>("interfaces.southbound.backpressure.low"),
+        };
+
+        if (cfg.low > cfg.high) {
+            throw nova::exception("Backpressure low watermark ({}) is above the high one ({})", cfg.low, cfg.high);
+        }
+
+        return cfg;
+    }
+
+    /**
+     * @brief   Read the optional manual offset commit configuration of the Kafka listener.
+     */
+    [[nodiscard]] auto cfg_commit() -> std::optional<kafka_commit_cfg> {
+        auto enabled = false;
+
+        // FIXME: yaml.lookup with non-existent key
+        try {
+            enabled = lookup<bool>("interfaces.southbound.commit.enabled");
+        } catch (...) {}
+
+        if (not enabled) {
+            return std::nullopt;
+        }
+
+        return kafka_commit_cfg{
+            .interval = std::chrono::milliseconds{ lookup<long>("interfaces.southbound.commit.intervalMs") },
+            .max_offsets = lookup<std::uint64_t>("interfaces.southbound.commit.maxOffsets"),
+        };
+    }
+
     template <typename T>
     [[nodiscard]] auto lookup(const std::string& path) -> T {
         auto result = m_config.lookup<T>(fmt::format("dsp.{}", path));
@@ -319,12 +573,21 @@ private:
 };
 
 inline void northbound_builder::build() {
-    m_service_handle->m_cache->attach_northbound(
-        m_name,
-        std::make_unique<kafka_producer>(
-            std::move(cast<std::shared_ptr<dsp::kf::properties>>(m_cfg).operator*())
-        )
-    );
+    auto props = std::move(cast<std::shared_ptr<dsp::kf::properties>>(m_cfg).operator*());
+
+    auto interface = std::unique_ptr<northbound_interface>{ };
+    if (m_spill.has_value()) {
+        interface = std::make_unique<kafka_spill_producer>(std::move(props), *m_spill);
+    } else {
+        interface = std::make_unique<kafka_producer>(std::move(props));
+    }
+
+    if (m_async.has_value()) {
+        m_service_handle->northbound(m_name, std::move(interface), *m_async);
+        return;
+    }
+
+    m_service_handle->northbound(m_name, std::move(interface));
 }
 
 inline auto northbound_builder::kafka_props() -> kf::properties& {
@@ -346,15 +609,18 @@ inline void southbound_builder::build() {
 inline void southbound_builder::build_kafka() {
     auto& sb = m_service_handle->m_southbound;
 
-    sb = std::make_unique<kafka_listener>(
-        context{
-            .stats = m_service_handle->m_metrics,
-            .cache = m_service_handle->m_cache,
-            .app = std::move(m_appctx)
-        },
-        std::move(cast<std::shared_ptr<kafka_cfg>>(m_cfg).operator*()),
-        std::move(m_kafka_handler)
-    );
+    auto ctx = context{
+        .stats = m_service_handle->m_metrics,
+        .cache = m_service_handle->m_cache,
+        .app = std::move(m_appctx)
+    };
+    auto cfg = std::move(cast<std::shared_ptr<kafka_cfg>>(m_cfg).operator*());
+
+    if (m_kafka_factory != nullptr) {
+        sb = std::make_unique<kafka_listener>(std::move(ctx), std::move(cfg), m_kafka_factory);
+    } else {
+        sb = std::make_unique<kafka_listener>(std::move(ctx), std::move(cfg), std::move(m_kafka_handler));
+    }
 }
 
 inline void southbound_builder::build_tcp() {
@@ -389,6 +655,13 @@ inline void southbound_builder::kafka_handler(std::unique_ptr<kf::handler> handl
     m_type = type::kafka;
 }
 
+template <typename Factory, typename ...Args>
+    requires requires { std::is_base_of_v<kf::handler_factory, Factory>; }
+void southbound_builder::kafka_handler(Args&& ...args) {
+    m_kafka_factory = std::make_shared<Factory>(std::forward<Args>(args)...);
+    m_type = type::kafka;
+}
+
 inline auto southbound_builder::kafka_props() -> kf::properties& {
     return cast<std::shared_ptr<kafka_cfg>>(m_cfg)->props;
 }
@@ -0,0 +1,292 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Boolean expressions over message fields
+ */
+
+#pragma once
+
+#include <libdsp/matcher.hpp>
+#include <libdsp/message.hpp>
+#include <libdsp/payload.hpp>
+
+#include <libnova/error.hpp>
+
+#include <re2/re2.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * @brief   A condition as configured: a field compared with a matcher, or a
+ *          boolean combination of conditions.
+ *
+ * The field is a property, or a payload field (see `payload_field`).
+ *
+ * - match: the field `field` matches (`value`, or `min`/`max` for ranges),
+ * - all: every operand is true (AND),
+ * - any: at least one operand is true (OR),
+ * - none: no operand is true (NOT).
+ */
+struct condition_cfg {
+    enum class op_type : std::uint8_t {
+        match,
+        all,
+        any,
+        none,
+    };
+
+    op_type op { op_type::match };
+    std::string field;
+    std::string value;
+    match_type matcher { match_type::exact };
+    double min { -std::numeric_limits<double>::infinity() };
+    double max { std::numeric_limits<double>::infinity() };
+    std::vector<condition_cfg> operands;
+
+    [[nodiscard]] auto is_match() const -> bool { return op == op_type::match; }
+};
+
+/**
+ * @brief   A field compared with a matcher, patterns are compiled once.
+ */
+class predicate {
+public:
+    /**
+     * @throws  nova::exception if the pattern is invalid.
+     */
+    predicate(const condition_cfg& cfg, field_ref field)
+        : m_field(std::move(field))
+        , m_value(cfg.value)
+        , m_matcher(cfg.matcher)
+        , m_range{ cfg.min, cfg.max }
+    {
+        const auto pattern = [&]() -> std::optional<std::string> {
+            switch (m_matcher) {
+                case match_type::prefix:    return prefix_to_regex(m_value);
+                case match_type::glob:      return glob_to_regex(m_value);
+                case match_type::regex:     return m_value;
+                default:                    return std::nullopt;
+            }
+        }();
+
+        if (pattern.has_value()) {
+            auto options = RE2::Options{ };
+            options.set_log_errors(false);
+            m_regex = std::make_unique<RE2>(*pattern, options);
+            if (not m_regex->ok()) {
+                throw nova::exception("Invalid regular expression '{}': {}", *pattern, m_regex->error());
+            }
+        }
+    }
+
+    /**
+     * @returns false if the message has no such field.
+     */
+    [[nodiscard]] auto operator()(field_values& fields) const -> bool {
+        const auto value = fields(m_field);
+        if (not value.has_value()) {
+            return false;
+        }
+
+        switch (m_matcher) {
+            case match_type::exact: return *value == m_value;
+            case match_type::range: return m_range(range_matcher::parse(*value));
+            default:                return RE2::PartialMatch(*value, *m_regex);
+        }
+    }
+
+private:
+    field_ref m_field;
+    std::string m_value;
+    match_type m_matcher;
+    range_matcher m_range;
+    std::unique_ptr<RE2> m_regex;
+
+};
+
+/**
+ * @brief   Boolean expressions compiled into a flat DAG.
+ *
+ * Expressions are added one by one, each gets the id of its root node.
+ * Identical sub-expressions (and predicates) are stored once, whichever
+ * expression they come from: nodes are keyed by their structure.
+ *
+ * Evaluation short-circuits, and within one `evaluator` the result of every
+ * node is computed at most once, so sub-expressions shared by several rules
+ * are evaluated once per message.
+ */
+class expression_set {
+public:
+    using node_id = std::uint32_t;
+
+    /**
+     * @brief   Evaluation of expressions for one message.
+     *
+     * Results are memoized in memory of the calling thread, an evaluator
+     * must not outlive the field values nor be used by another thread.
+     */
+    class evaluator {
+    public:
+        evaluator(const expression_set& set, field_values& fields)
+            : m_set(set)
+            , m_fields(fields)
+            , m_memo(memo_t::local())
+        {
+            if (++m_memo.generation == 0) {
+                std::ranges::fill(m_memo.stamps, 0);
+                m_memo.generation = 1;
+            }
+            if (m_memo.stamps.size() < m_set.m_nodes.size()) {
+                m_memo.stamps.resize(m_set.m_nodes.size(), 0);
+                m_memo.values.resize(m_set.m_nodes.size(), false);
+            }
+        }
+
+        evaluator(const evaluator&)             = delete;
+        evaluator& operator=(const evaluator&)  = delete;
+
+        [[nodiscard]] auto operator()(node_id id) -> bool {
+            if (m_memo.stamps[id] == m_memo.generation) {
+                return m_memo.values[id];
+            }
+
+            const auto& n = m_set.m_nodes[id];
+            const auto operands = std::span{ m_set.m_operands }.subspan(n.first, n.count);
+
+            bool ret = false;
+            switch (n.op) {
+                case op_type::match:
+                    ret = m_set.m_predicates[n.first](m_fields);
+                    break;
+                case op_type::all:
+                    ret = std::ranges::all_of(operands, std::ref(*this));
+                    break;
+                case op_type::any:
+                    ret = std::ranges::any_of(operands, std::ref(*this));
+                    break;
+                case op_type::none:
+                    ret = std::ranges::none_of(operands, std::ref(*this));
+                    break;
+            }
+
+            m_memo.stamps[id] = m_memo.generation;
+            m_memo.values[id] = ret;
+            return ret;
+        }
+
+    private:
+        struct memo_t {
+            std::vector<std::uint32_t> stamps;
+            std::vector<bool> values;
+            std::uint32_t generation { 0 };
+
+            [[nodiscard]] static auto local() -> memo_t& {
+                static thread_local auto instance = memo_t{ };
+                return instance;
+            }
+        };
+
+        const expression_set& m_set;
+        field_values& m_fields;
+        memo_t& m_memo;
+
+    };
+
+    /**
+     * @param   fields Payload fields referred to by the predicates are added to it.
+     * @returns id of the root node of the expression.
+     * @throws  nova::exception if a pattern or a payload field is invalid.
+     */
+    auto add(const condition_cfg& cfg, payload_fields& fields) -> node_id {
+        if (cfg.is_match()) {
+            auto key = std::string{ "m" };
+            key += static_cast<char>(cfg.matcher);
+            key += cfg.field;
+            key += '\0';
+            key += cfg.value;
+            key += '\0';
+            append_bits(key, cfg.min);
+            append_bits(key, cfg.max);
+
+            return intern(std::move(key), [&]() {
+                m_predicates.emplace_back(cfg, fields.add(cfg.field));
+                return node{ op_type::match, static_cast<std::uint32_t>(m_predicates.size() - 1), 0 };
+            });
+        }
+
+        auto operands = std::vector<node_id>{ };
+        auto key = std::string{ static_cast<char>('0' + static_cast<int>(cfg.op)) };
+        for (const auto& operand : cfg.operands) {
+            operands.push_back(add(operand, fields));
+            key += ',';
+            key += std::to_string(operands.back());
+        }
+
+        return intern(std::move(key), [&]() {
+            const auto first = static_cast<std::uint32_t>(m_operands.size());
+            m_operands.insert(m_operands.end(), operands.begin(), operands.end());
+            return node{ cfg.op, first, static_cast<std::uint32_t>(operands.size()) };
+        });
+    }
+
+    /**
+     * @brief   Number of distinct nodes.
+     */
+    [[nodiscard]] auto size() const -> std::size_t { return m_nodes.size(); }
+
+private:
+    using op_type = condition_cfg::op_type;
+
+    /**
+     * @brief   A predicate (`first` is its index) or an operator over `count`
+     *          operands stored from `first` in `m_operands`.
+     */
+    struct node {
+        op_type op;
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+
+    std::vector<node> m_nodes;
+    std::vector<node_id> m_operands;
+    std::vector<predicate> m_predicates;
+    std::unordered_map<std::string, node_id> m_ids;
+
+    auto intern(std::string key, const auto& make) -> node_id {
+        if (const auto it = m_ids.find(key); it != m_ids.end()) {
+            return it->second;
+        }
+
+        m_nodes.push_back(make());
+        const auto id = static_cast<node_id>(m_nodes.size() - 1);
+        m_ids.emplace(std::move(key), id);
+        return id;
+    }
+
+    /**
+     * @brief   Append the exact bits of a bound to an interning key.
+     */
+    static void append_bits(std::string& key, double x) {
+        const auto bits = std::bit_cast<std::uint64_t>(x);
+        for (std::size_t i = 0; i < sizeof(bits); ++i) {
+            key += static_cast<char>((bits >> (i * 8)) & 0xff);
+        }
+    }
+
+};
+
+} // namespace dsp
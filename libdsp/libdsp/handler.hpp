@@ -19,6 +19,7 @@
 #include <boost/asio/error.hpp>
 
 #include <cstddef>
+#include <memory>
 #include <string>
 
 namespace dsp {
@@ -90,6 +91,15 @@ private:
 
 namespace kf {
 
+/**
+ * @brief   Processes consumed messages, on the thread serving their partitions.
+ *
+ * Handlers are not notified of rebalances: a consumer's partition workers may
+ * still process messages of revoked partitions while the consumer thread
+ * handles the rebalance. Per-partition state must be flushed by a
+ * `rebalance_handler` (`properties::rebalance_callback()`), synchronized with
+ * the handlers.
+ */
 class handler  {
 public:
     virtual void process(kf::message_view_owned& message) = 0;
@@ -98,6 +108,17 @@ public:
     virtual ~handler() = default;
 };
 
+/**
+ * @brief   Kafka handler factory, one handler is created for each partition worker.
+ *
+ * DSP context is bound to each handler by the listener.
+ */
+class handler_factory {
+public:
+    virtual auto create() -> std::unique_ptr<handler> = 0;
+    virtual ~handler_factory() = default;
+};
+
 template <typename Derived>
 class handler_frame : public kf::handler  {
 public:
@@ -9,10 +9,15 @@
 
 #pragma once
 
+#include <libdsp/affinity.hpp>
+#include <libdsp/arena.hpp>
 #include <libdsp/cache.hpp>
 #include <libdsp/handler.hpp>
 #include <libdsp/kafka.hpp>
 #include <libdsp/metrics.hpp>
+#include <libdsp/rate_limiter.hpp>
+#include <libdsp/ring.hpp>
+#include <libdsp/spill.hpp>
 #include <libdsp/tcp.hpp>
 
 #include <libnova/log.hpp>
@@ -21,10 +26,18 @@
 #include <prometheus/exposer.h>
 #include <prometheus/registry.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stop_token>
 #include <string>
+#include <thread>
 #include <utility>
 #include <memory>
+#include <vector>
 
 namespace dsp {
 
@@ -89,9 +102,386 @@ public:
         metrics.set("kafka_queue_size", m_kafka_client.queue_size());
     }
 
+    auto saturation() const -> double override {
+        return static_cast<double>(m_kafka_client.queue_size()) / static_cast<double>(m_kafka_client.queue_capacity());
+    }
+
+private:
+    kf::producer m_kafka_client;
+
+};
+
+/**
+ * @brief   Kafka producer that spills to disk instead of dropping messages.
+ *
+ * If the producer queue is full, messages are appended to a segment log on
+ * local disk. A background thread replays them in order once the producer
+ * queue size falls below the configured threshold. While the log is not
+ * empty, new messages are appended to it too, keeping the original ordering.
+ *
+ * Messages are dropped (load shedding) only if the disk quota is exhausted
+ * or they are larger than a segment.
+ */
+class kafka_spill_producer : public northbound_interface {
+    static constexpr auto ReplayIdleInterval = std::chrono::milliseconds{ 10 };
+
+public:
+    kafka_spill_producer(kf::properties props, spill::config cfg)
+        : m_kafka_client(std::move(props))
+        , m_replay_queue_size(cfg.replay_queue_size)
+        , m_log(std::move(cfg))
+        , m_replay_thread([this](std::stop_token token) { replay(token); })
+    {}
+
+    void stop() override {
+        m_replay_thread.request_stop();
+        m_kafka_client.stop();
+    }
+
+    auto send(const message& msg) -> bool override {
+        if (m_log.empty() && m_kafka_client.try_send(msg)) {
+            return true;
+        }
+
+        if (m_log.append(msg)) {
+            m_spilled.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Quota exhausted, or larger than a segment.
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void update(metrics_registry& metrics) override {
+        metrics.set("kafka_queue_size", m_kafka_client.queue_size());
+        metrics.set("spill_depth_messages", m_log.size());
+        metrics.set("spill_depth_bytes", m_log.bytes());
+
+        report_delta(metrics, "spill_messages_total", m_spilled, m_spilled_prev);
+        report_delta(metrics, "spill_replay_messages_total", m_replayed, m_replayed_prev);
+        report_delta(metrics, "spill_drop_messages_total", m_dropped, m_dropped_prev);
+    }
+
+    /**
+     * @brief   Saturation of the spill log, the producer queue overflows into it.
+     */
+    auto saturation() const -> double override {
+        return static_cast<double>(m_log.bytes()) / static_cast<double>(m_log.capacity());
+    }
+
 private:
     kf::producer m_kafka_client;
+    std::size_t m_replay_queue_size;
+    spill::segment_log m_log;
+
+    std::atomic_uint64_t m_spilled { 0 };
+    std::atomic_uint64_t m_replayed { 0 };
+    std::atomic_uint64_t m_dropped { 0 };
+    std::uint64_t m_spilled_prev { 0 };
+    std::uint64_t m_replayed_prev { 0 };
+    std::uint64_t m_dropped_prev { 0 };
+
+    std::jthread m_replay_thread;
 
+    static void report_delta(metrics_registry& metrics, const std::string& name, const std::atomic_uint64_t& value, std::uint64_t& prev) {
+        const auto current = value.load(std::memory_order_relaxed);
+        metrics.increment(name, current - prev);
+        prev = current;
+    }
+
+    /**
+     * @brief   Move spilled messages back into the producer queue.
+     *
+     * Messages that cannot be produced at all (e.g. too large) are dropped.
+     */
+    void replay(const std::stop_token& token) {
+        place_thread(thread_role::SpillReplay);
+
+        while (not token.stop_requested()) {
+            if (m_log.empty() || m_kafka_client.queue_size() >= m_replay_queue_size) {
+                std::this_thread::sleep_for(ReplayIdleInterval);
+                continue;
+            }
+
+            auto msg = m_log.front();
+            if (not msg.has_value()) {
+                continue;
+            }
+
+            try {
+                if (not m_kafka_client.try_send(*msg)) {
+                    std::this_thread::sleep_for(ReplayIdleInterval);
+                    continue;
+                }
+                m_replayed.fetch_add(1, std::memory_order_relaxed);
+            } catch (const nova::exception& ex) {
+                nova::topic_log::error("dsp", "Dropping spilled message: {}", ex.what());
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            m_log.pop();
+        }
+    }
+
+};
+
+/**
+ * @brief   What an asynchronous northbound interface does with a message when its queue is full.
+ *
+ * - block: wait for free space, slowing down the sender,
+ * - drop_newest: drop the message being sent (load shedding),
+ * - drop_oldest: drop the oldest queued message to make room.
+ */
+enum class overflow_policy {
+    block,
+    drop_newest,
+    drop_oldest,
+};
+
+struct async_northbound_cfg {
+    std::size_t capacity { 65536 };
+    overflow_policy overflow { overflow_policy::drop_newest };
+};
+
+/**
+ * @brief   Decorator sending messages to a northbound interface from a dedicated thread.
+ *
+ * `send()` only enqueues the message into a bounded lock-free queue, a drain
+ * thread forwards it to the decorated interface. A slow interface then stalls
+ * only its own queue, not the southbound threads (and the other interfaces).
+ * The drain thread takes messages by batches and sleeps when the queue is
+ * empty until a message is sent (see `event_count`).
+ *
+ * Queued messages own their payload (see `message::owned()`). The delivery
+ * token of the sender is carried along, so at-least-once delivery is kept:
+ * messages dropped on overflow fail their token.
+ *
+ * Remaining messages are drained on `stop()`.
+ */
+class async_northbound : public northbound_interface {
+    /**
+     * @brief   Longest sleep of a waiting thread, waiters are woken up when the queue changes.
+     */
+    static constexpr auto WaitInterval = std::chrono::milliseconds{ 10 };
+    static constexpr std::size_t DrainBatch = 64;
+
+    struct entry {
+        message msg;
+        delivery_token* token { nullptr };
+    };
+
+    /**
+     * @brief   Counts a thread in `send()`.
+     */
+    struct sender_scope {
+        std::atomic_size_t& senders;
+
+        explicit sender_scope(std::atomic_size_t& counter)
+            : senders(counter)
+        {
+            senders.fetch_add(1);
+        }
+
+        ~sender_scope() {
+            senders.fetch_sub(1);
+        }
+
+        sender_scope(const sender_scope&)               = delete;
+        sender_scope& operator=(const sender_scope&)    = delete;
+    };
+
+public:
+    async_northbound(std::string name, std::unique_ptr<northbound_interface> interface, const async_northbound_cfg& cfg)
+        : m_name(std::move(name))
+        , m_interface(std::move(interface))
+        , m_overflow(cfg.overflow)
+        , m_queue(cfg.capacity)
+        , m_drain_thread([this](std::stop_token token) { drain(token); })
+    {}
+
+    async_northbound(const async_northbound&)               = delete;
+    async_northbound(async_northbound&&)                    = delete;
+    async_northbound& operator=(const async_northbound&)    = delete;
+    async_northbound& operator=(async_northbound&&)         = delete;
+
+    ~async_northbound() override = default;
+
+    /**
+     * @returns false if the message was dropped because of overflow.
+     */
+    auto send(const message& msg) -> bool override {
+        const sender_scope sender{ m_senders };
+
+        // Pairs with `stop()`: either the stop is seen here, or `stop()` waits for this sender.
+        if (m_stopped.load()) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        auto item = entry{ msg.owned(), delivery_scope::current() };
+        if (item.token != nullptr) {
+            item.token->acquire();
+        }
+
+        while (not m_queue.try_push(std::move(item))) {
+            if (m_stopped.load(std::memory_order_relaxed) or m_overflow == overflow_policy::drop_newest) {
+                discard(item);
+                return false;
+            }
+
+            if (m_overflow == overflow_policy::drop_oldest) {
+                auto oldest = entry{ };
+                if (m_queue.try_pop(oldest)) {
+                    discard(oldest);
+                }
+            } else {
+                (void)m_not_full.wait_for([&]() {
+                    return m_queue.size() < m_queue.capacity() or m_stopped.load(std::memory_order_relaxed);
+                }, WaitInterval);
+            }
+        }
+
+        m_not_empty.notify();
+        return true;
+    }
+
+    /**
+     * @brief   Stop accepting messages, forward the queued ones and stop the interface.
+     *
+     * Waits for the concurrent senders, messages still queued after the drain
+     * thread stopped are discarded.
+     */
+    void stop() override {
+        m_stopped.store(true);
+        while (m_senders.load() != 0) {
+            m_not_full.notify();
+            std::this_thread::yield();
+        }
+
+        if (m_drain_thread.joinable()) {
+            m_drain_thread.request_stop();
+            m_not_empty.notify();
+            m_drain_thread.join();
+        }
+
+        auto item = entry{ };
+        while (m_queue.try_pop(item)) {
+            discard(item);
+        }
+
+        m_interface->stop();
+    }
+
+    void update(metrics_registry& metrics) override {
+        const auto labels = prometheus::Labels{ { "interface", m_name } };
+        const auto dropped = m_dropped.load(std::memory_order_relaxed);
+
+        metrics.set("northbound_queue_depth", m_queue.size(), labels);
+        metrics.increment("northbound_queue_drop_messages_total", dropped - m_dropped_prev, labels);
+        m_dropped_prev = dropped;
+
+        m_interface->update(metrics);
+    }
+
+    auto saturation() const -> double override {
+        const auto fill = static_cast<double>(m_queue.size()) / static_cast<double>(m_queue.capacity());
+        return std::max(fill, m_interface->saturation());
+    }
+
+    auto unwrap() -> northbound_interface& override {
+        return m_interface->unwrap();
+    }
+
+private:
+    std::string m_name;
+    std::unique_ptr<northbound_interface> m_interface;
+    overflow_policy m_overflow;
+    mpmc_ring<entry> m_queue;
+    event_count m_not_empty;
+    event_count m_not_full;
+
+    std::atomic_bool m_stopped { false };
+    std::atomic_size_t m_senders { 0 };
+    std::atomic_uint64_t m_dropped { 0 };
+    std::uint64_t m_dropped_prev { 0 };
+
+    std::jthread m_drain_thread;
+
+    void discard(entry& item) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        if (item.token != nullptr) {
+            item.token->fail();
+            item.token->release();
+        }
+    }
+
+    void drain(const std::stop_token& token) {
+        place_thread(thread_role::AsyncDrain);
+        auto batch = std::vector<entry>(DrainBatch);
+
+        while (true) {
+            const auto n = m_queue.try_pop(std::span{ batch });
+            if (n == 0) {
+                if (token.stop_requested()) {
+                    break;
+                }
+                (void)m_not_empty.wait_for([&]() { return not m_queue.empty() or token.stop_requested(); }, WaitInterval);
+                continue;
+            }
+            m_not_full.notify();
+
+            for (auto& item : std::span{ batch }.first(n)) {
+                forward(item);
+                item = entry{ };
+            }
+        }
+    }
+
+    void forward(entry& item) {
+        auto delivered = false;
+        try {
+            const delivery_scope scope{ item.token };
+            delivered = m_interface->send(item.msg);
+        } catch (const std::exception& ex) {
+            nova::topic_log::error("dsp", "Northbound interface {} failed: {}", m_name, ex.what());
+        }
+
+        if (item.token != nullptr) {
+            if (not delivered) {
+                item.token->fail();
+            }
+            item.token->release();
+        }
+    }
+
+};
+
+/**
+ * @brief   Manual offset commit, see `kafka_listener`.
+ */
+struct kafka_commit_cfg {
+    std::chrono::milliseconds interval { 1000 };
+    std::uint64_t max_offsets { 10000 };
+};
+
+/**
+ * @brief   Pausing consumption while northbound is saturated, see `kafka_listener`.
+ */
+struct kafka_backpressure_cfg {
+    double high { 0.8 };
+    double low { 0.5 };
+};
+
+/**
+ * @brief   Reprocessing from a point in time, see `kafka_listener`.
+ *
+ * Rate limits are per second, 0 means unlimited.
+ */
+struct kafka_replay_cfg {
+    std::chrono::system_clock::time_point from;
+    double max_messages { 0 };
+    double max_bytes { 0 };
 };
 
 struct kafka_cfg {
@@ -99,34 +489,120 @@ struct kafka_cfg {
     std::vector<std::string> topics;
     std::size_t batch_size;
     std::chrono::milliseconds poll_timeout;
+    std::size_t consumers { 1 };
+    std::size_t partition_workers { 0 };
+    std::optional<kafka_commit_cfg> commit;
+    std::optional<kafka_backpressure_cfg> backpressure;
+    std::optional<kafka_replay_cfg> replay;
 
 };
 
+/**
+ * @brief   Kafka consumer interface.
+ *
+ * By default, messages are processed by one consumer and one handler on the
+ * listener thread.
+ *
+ * With more consumers, the listener creates them in the same group, each
+ * served by its own thread and having its own handler (created by the handler
+ * factory). The group coordinator balances the partitions between them as
+ * between separate processes, so one process can use more cores for
+ * consumption, with a single metrics endpoint.
+ *
+ * With partition workers, the partitions assigned to a consumer are
+ * distributed between worker threads, each having its own handler and batch.
+ * A partition is always processed by the same worker, therefore the ordering
+ * within a partition is kept. The consumer thread still serves the consumer
+ * queue (rebalance events, errors).
+ *
+ * With manual commit (at-least-once), the offset of a message is stored only
+ * after the messages derived from it are delivered northbound (see
+ * `kf::offset_tracker`). Stored offsets are committed asynchronously by the
+ * consumer thread, when the commit interval elapsed or the configured number
+ * of offsets completed, and synchronously when the listener stops or
+ * partitions are revoked.
+ *
+ * With backpressure, fetching all assigned partitions is paused when the
+ * saturation of the northbound interfaces reaches the high watermark, and
+ * resumed when it falls to the low one. Consumption slows down to the pace of
+ * northbound, instead of dropping messages.
+ *
+ * In replay mode, partitions start from a point in time when they are first
+ * assigned, and consumption is rate limited (token bucket, shared by all
+ * threads) to spare the brokers serving live traffic.
+ */
 class kafka_listener : public southbound_interface {
 public:
     kafka_listener(context ctx, kafka_cfg cfg, std::unique_ptr<kf::handler> handler)
-        : m_kafka_client(std::move(cfg.props))
-        , m_handler(std::move(handler))
-        , m_batch_size(cfg.batch_size)
+        : m_poll_timeout(cfg.poll_timeout)
+        , m_topics(std::move(cfg.topics))
+        , m_commit(cfg.commit)
+        , m_backpressure(cfg.backpressure)
+    {
+        if (cfg.consumers != 1 or cfg.partition_workers > 0) {
+            throw nova::exception("Multiple Kafka consumers or partition workers require a handler factory");
+        }
+
+        m_consumers.push_back(std::make_unique<consumer_unit>(*this, std::move(cfg.props), std::move(handler), cfg.batch_size));
+        replay(cfg.replay);
+        bind(std::move(ctx));
+    }
+
+    kafka_listener(context ctx, kafka_cfg cfg, const std::shared_ptr<kf::handler_factory>& factory)
+        : m_poll_timeout(cfg.poll_timeout)
         , m_topics(std::move(cfg.topics))
+        , m_commit(cfg.commit)
+        , m_backpressure(cfg.backpressure)
     {
+        if (cfg.consumers == 0) {
+            throw nova::exception("Kafka listener requires at least one consumer");
+        }
+
+        for (std::size_t i = 0; i < cfg.consumers; ++i) {
+            auto& unit = m_consumers.emplace_back(
+                std::make_unique<consumer_unit>(*this, cfg.props, factory->create(), cfg.batch_size)
+            );
+            unit->add_workers(*factory, cfg.partition_workers, cfg.batch_size);
+        }
+
+        replay(cfg.replay);
         bind(std::move(ctx));
     }
 
+    kafka_listener(const kafka_listener&)               = delete;
+    kafka_listener(kafka_listener&&)                    = delete;
+    kafka_listener& operator=(const kafka_listener&)    = delete;
+    kafka_listener& operator=(kafka_listener&&)         = delete;
+
+    ~kafka_listener() override = default;
+
     /**
      * @brief   Create listener function.
+     *
+     * The first consumer is served by the listener thread, the others by
+     * threads started here.
      */
     auto listener() -> std::function<void()> override {
         return [this]() {
-            nova::topic_log::info("dsp", "Starting Kafka listener (consuming topics: {})", m_topics);
-            m_kafka_client.subscribe(m_topics);
+            nova::topic_log::info(
+                "dsp",
+                "Starting Kafka listener (consuming topics: {}, consumers: {}, partition workers: {})",
+                m_topics,
+                m_consumers.size(),
+                m_consumers.front()->workers.size()
+            );
 
-            while (m_alive) {
-                for (auto& message : m_kafka_client.consume(m_batch_size, m_poll_timeout)) {
-                    m_handler->process(message);
-                }
+            auto consumer_threads = std::vector<std::jthread>{ };
+            for (std::size_t i = 1; i < m_consumers.size(); ++i) {
+                consumer_threads.emplace_back([this, i]() {
+                    place_thread(thread_role::KafkaConsumer);
+                    serve(*m_consumers[i]);
+                });
             }
 
+            serve(*m_consumers.front());
+            consumer_threads.clear();
+
             nova::topic_log::info("dsp", "Kafka listener stopped");
         };
     }
@@ -134,28 +610,427 @@ public:
     void stop() override {
         nova::topic_log::debug("dsp", "Stopping Kafka listener...");
         m_alive.store(false);
+
+        // Do not hold the consumer threads in the rate limiters.
+        if (m_message_limit != nullptr) {
+            m_message_limit->stop();
+        }
+
+        if (m_byte_limit != nullptr) {
+            m_byte_limit->stop();
+        }
     }
 
     /**
      * @brief   Update Kafka client metrics.
      *
-     * Note: Curently there are no custom Kafka client metrics.
-     * Internal client (librdkafka) metrics are updated via statistics
+     * Note: Internal client (librdkafka) metrics are updated via statistics
      * callback.
      */
-    void update(metrics_registry&) override { /* NO-OP */ }
+    void update(metrics_registry& metrics) override {
+        update_partitions(metrics);
+
+        if (m_backpressure.has_value()) {
+            std::size_t paused = 0;
+            std::uint64_t pauses = 0;
+            for (const auto& unit : m_consumers) {
+                if (unit->paused.load(std::memory_order_relaxed)) {
+                    ++paused;
+                }
+                pauses += unit->pauses.load(std::memory_order_relaxed);
+            }
+
+            metrics.set("consumer_paused", paused);
+            metrics.increment("consumer_pause_total", pauses - m_pauses_prev);
+            m_pauses_prev = pauses;
+        }
+
+        if (not m_commit.has_value()) {
+            return;
+        }
+
+        std::size_t in_flight = 0;
+        for (const auto& unit : m_consumers) {
+            for (const auto* tracker : unit->trackers) {
+                in_flight += tracker->in_flight();
+            }
+        }
+
+        metrics.set("kafka_uncommitted_messages", in_flight);
+    }
 
 private:
-    kf::consumer m_kafka_client;
-    nova::not_null<std::unique_ptr<kf::handler>> m_handler;
+
+    struct consumer_unit;
+
+    /**
+     * @brief   Commit offsets of the revoked partitions before they are unassigned.
+     *
+     * Partition metrics are exported only for assigned partitions.
+     */
+    class rebalance_hook : public kf::rebalance_handler {
+    public:
+        rebalance_hook(consumer_unit& unit)
+            : m_unit(unit)
+        {}
+
+        void on_assigning(const kf::partition_list& partitions) override {
+            for (auto* tracker : m_unit.trackers) {
+                tracker->assign(partitions);
+            }
+        }
+
+        void on_assign(const kf::partition_list& partitions) override {
+            for (auto* metrics : m_unit.partition_metrics) {
+                metrics->assign(partitions, true);
+            }
+
+            if (m_unit.paused.load(std::memory_order_relaxed)) {
+                m_unit.client.pause(partitions);
+            }
+        }
+
+        void on_revoke(const kf::partition_list& partitions) override {
+            if (m_unit.listener.m_commit.has_value()) {
+                m_unit.client.commit(m_unit.trackers, false);
+            }
+
+            revoke(partitions);
+        }
+
+        void on_lost(const kf::partition_list& partitions) override {
+            revoke(partitions);
+        }
+
+    private:
+        consumer_unit& m_unit;
+
+        void revoke(const kf::partition_list& partitions) {
+            for (auto* tracker : m_unit.trackers) {
+                tracker->revoke(partitions);
+            }
+
+            for (auto* metrics : m_unit.partition_metrics) {
+                metrics->assign(partitions, false);
+            }
+        }
+
+    };
+
+    struct partition_worker {
+        kf::queue queue;
+        nova::not_null<std::unique_ptr<kf::handler>> handler;
+        kf::batch batch;
+        kf::offset_tracker tracker;
+        kf::partition_metrics metrics;
+
+        partition_worker(kf::queue q, std::unique_ptr<kf::handler> h, std::size_t batch_size)
+            : queue(std::move(q))
+            , handler(std::move(h))
+            , batch(batch_size)
+        {}
+    };
+
+    /**
+     * @brief   A consumer of the group, with its handler, partition workers and state.
+     *
+     * Everything except the pause counters is accessed by the thread serving
+     * the consumer (and its partition workers), or while it is not running.
+     */
+    struct consumer_unit {
+        kafka_listener& listener;
+        kf::consumer client;
+        nova::not_null<std::unique_ptr<kf::handler>> handler;
+
+        // Partition queues must be destroyed before the consumer.
+        std::vector<std::unique_ptr<partition_worker>> workers;
+
+        kf::batch batch;
+        kf::offset_tracker tracker;
+        std::vector<kf::offset_tracker*> trackers{ &tracker };
+        kf::partition_metrics metrics;
+        std::vector<kf::partition_metrics*> partition_metrics{ &metrics };
+
+        std::atomic_bool paused { false };
+        std::atomic_uint64_t pauses { 0 };
+
+        rebalance_hook hook { *this };
+
+        consumer_unit(kafka_listener& l, kf::properties props, std::unique_ptr<kf::handler> h, std::size_t batch_size)
+            : listener(l)
+            , client(std::move(props))
+            , handler(std::move(h))
+            , batch(batch_size)
+        {
+            client.attach(&hook);
+        }
+
+        consumer_unit(const consumer_unit&)             = delete;
+        consumer_unit(consumer_unit&&)                  = delete;
+        consumer_unit& operator=(const consumer_unit&)  = delete;
+        consumer_unit& operator=(consumer_unit&&)       = delete;
+
+        ~consumer_unit() {
+            // The consumer is closed after the trackers and the hook are destroyed.
+            client.attach(nullptr);
+        }
+
+        void add_workers(kf::handler_factory& factory, std::size_t count, std::size_t batch_size) {
+            auto queues = std::vector<kf::queue*>{ };
+
+            for (std::size_t i = 0; i < count; ++i) {
+                auto& worker = workers.emplace_back(
+                    std::make_unique<partition_worker>(client.create_queue(), factory.create(), batch_size)
+                );
+                queues.push_back(&worker->queue);
+                trackers.push_back(&worker->tracker);
+                partition_metrics.push_back(&worker->metrics);
+            }
+
+            client.distribute(queues);
+        }
+
+        [[nodiscard]] auto completed_offsets() const -> std::uint64_t {
+            std::uint64_t n = 0;
+            for (const auto* t : trackers) {
+                n += t->completed();
+            }
+            return n;
+        }
+    };
 
     std::atomic_bool m_alive { true };
-    std::size_t m_batch_size { 1 };
     std::chrono::milliseconds m_poll_timeout { 100 };
     std::vector<std::string> m_topics;
 
+    std::optional<kafka_commit_cfg> m_commit;
+    std::chrono::steady_clock::time_point m_last_update { std::chrono::steady_clock::now() };
+
+    std::shared_ptr<cache> m_cache;
+    std::optional<kafka_backpressure_cfg> m_backpressure;
+    std::uint64_t m_pauses_prev { 0 };
+
+    std::unique_ptr<token_bucket> m_message_limit;
+    std::unique_ptr<token_bucket> m_byte_limit;
+
+    // Destroyed first, consumers refer to the listener state.
+    std::vector<std::unique_ptr<consumer_unit>> m_consumers;
+
     void bind(context ctx) override {
-        m_handler->bind(std::move(ctx));
+        m_cache = ctx.cache;
+        for (auto& unit : m_consumers) {
+            for (auto& worker : unit->workers) {
+                worker->handler->bind(ctx);
+            }
+            unit->handler->bind(ctx);
+        }
+    }
+
+    /**
+     * @brief   Configure replay mode, one second of burst is allowed.
+     */
+    void replay(const std::optional<kafka_replay_cfg>& cfg) {
+        if (not cfg.has_value()) {
+            return;
+        }
+
+        nova::topic_log::info("dsp", "Replay mode, starting from {} ms since epoch",
+            std::chrono::duration_cast<std::chrono::milliseconds>(cfg->from.time_since_epoch()).count());
+
+        for (auto& unit : m_consumers) {
+            unit->client.start_from(cfg->from);
+        }
+
+        if (cfg->max_messages > 0) {
+            m_message_limit = std::make_unique<token_bucket>(cfg->max_messages, cfg->max_messages);
+        }
+
+        if (cfg->max_bytes > 0) {
+            m_byte_limit = std::make_unique<token_bucket>(cfg->max_bytes, cfg->max_bytes);
+        }
+    }
+
+    /**
+     * @brief   Serve a consumer until the listener is stopped.
+     */
+    void serve(consumer_unit& unit) {
+        auto worker_threads = std::vector<std::jthread>{ };
+        for (auto& worker : unit.workers) {
+            worker_threads.emplace_back([this, &worker, &unit]() {
+                place_thread(thread_role::KafkaWorker);
+                serve(*worker, unit.client);
+            });
+        }
+
+        // Allocated again by the serving thread, now placed, to be local to its NUMA node.
+        unit.batch = kf::batch{ unit.batch.capacity() };
+
+        unit.client.subscribe(m_topics);
+
+        auto commit_timer = std::chrono::steady_clock::now();
+        auto committed = std::uint64_t{ 0 };
+
+        while (m_alive) {
+            unit.client.consume_into(unit.batch, m_poll_timeout);
+            process(*unit.handler, unit.batch, unit.tracker, unit.metrics);
+
+            if (m_commit.has_value()) {
+                unit.client.rewind(unit.tracker);
+
+                const auto now = std::chrono::steady_clock::now();
+                const auto completed = unit.completed_offsets();
+
+                if (completed - committed >= m_commit->max_offsets || now - commit_timer >= m_commit->interval) {
+                    unit.client.commit(unit.trackers);
+                    committed = completed;
+                    commit_timer = now;
+                }
+            }
+
+            if (m_backpressure.has_value()) {
+                apply_backpressure(unit);
+            }
+        }
+
+        unit.batch.clear();
+        worker_threads.clear();
+
+        if (m_commit.has_value()) {
+            unit.client.commit(unit.trackers, false);
+        }
+    }
+
+    void serve(partition_worker& worker, kf::consumer& client) {
+        worker.batch = kf::batch{ worker.batch.capacity() };
+
+        while (m_alive) {
+            worker.queue.consume_into(worker.batch, m_poll_timeout);
+            process(*worker.handler, worker.batch, worker.tracker, worker.metrics);
+
+            if (m_commit.has_value()) {
+                client.rewind(worker.tracker);
+            }
+        }
+
+        worker.batch.clear();
+    }
+
+    /**
+     * @brief   Pause or resume the assigned partitions based on northbound saturation.
+     */
+    void apply_backpressure(consumer_unit& unit) {
+        const auto saturation = m_cache->saturation();
+        const auto paused = unit.paused.load(std::memory_order_relaxed);
+
+        if (not paused and saturation >= m_backpressure->high) {
+            nova::topic_log::debug("dsp", "Northbound saturated ({:.2f}), pausing consumption", saturation);
+            unit.client.pause_assignment(true);
+            unit.paused.store(true, std::memory_order_relaxed);
+            unit.pauses.fetch_add(1, std::memory_order_relaxed);
+        } else if (paused and saturation <= m_backpressure->low) {
+            nova::topic_log::debug("dsp", "Northbound drained ({:.2f}), resuming consumption", saturation);
+            unit.client.pause_assignment(false);
+            unit.paused.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief   Process a batch, tracking the delivery of each message if manual commit is enabled.
+     *
+     * The scratch arena of the thread is rewound after the batch.
+     */
+    void process(kf::handler& handler, kf::batch& batch, kf::offset_tracker& tracker, kf::partition_metrics& metrics) {
+        const arena::scope scratch{ arena::local() };
+
+        for (auto& message : batch) {
+            if (m_message_limit != nullptr) {
+                m_message_limit->acquire(1);
+            }
+
+            if (m_byte_limit != nullptr) {
+                m_byte_limit->acquire(static_cast<double>(message.payload().size()));
+            }
+
+            metrics.observe(message);
+            auto* token = m_commit.has_value() ? tracker.track(message) : nullptr;
+
+            {
+                const delivery_scope scope{ token };
+                handler.process(message);
+            }
+
+            if (token != nullptr) {
+                token->release();
+            }
+        }
+    }
+
+    /**
+     * @brief   Export lag and throughput of the assigned partitions.
+     *
+     * Lag is the difference of the cached high watermark and the next offset
+     * to consume.
+     *
+     * A partition can move between the consumers of the listener, gauges of
+     * the revoked ones are removed first, so they don't remove the gauges of
+     * the new owner.
+     */
+    void update_partitions(metrics_registry& metrics) {
+        const auto now = std::chrono::steady_clock::now();
+        const auto elapsed = std::chrono::duration<double>(now - m_last_update).count();
+        m_last_update = now;
+
+        const auto labels_of = [](const kf::partition_metrics::counters& c) {
+            return prometheus::Labels{
+                { "topic", c.topic },
+                { "partition", std::to_string(c.partition) }
+            };
+        };
+
+        for (auto& unit : m_consumers) {
+            for (auto* table : unit->partition_metrics) {
+                table->for_each([&](kf::partition_metrics::counters& c) {
+                    if (c.assigned.load(std::memory_order_relaxed) or not c.exported) {
+                        return;
+                    }
+
+                    const auto labels = labels_of(c);
+                    metrics.remove_gauge("consumer_lag", labels);
+                    metrics.remove_gauge("consumer_messages_per_second", labels);
+                    metrics.remove_gauge("consumer_bytes_per_second", labels);
+                    c.exported = false;
+                });
+            }
+        }
+
+        for (auto& unit : m_consumers) {
+            for (auto* table : unit->partition_metrics) {
+                table->for_each([&](kf::partition_metrics::counters& c) {
+                    if (not c.assigned.load(std::memory_order_relaxed)) {
+                        return;
+                    }
+
+                    const auto labels = labels_of(c);
+                    const auto messages = c.messages.load(std::memory_order_relaxed);
+                    const auto bytes = c.bytes.load(std::memory_order_relaxed);
+
+                    if (elapsed > 0) {
+                        metrics.set("consumer_messages_per_second", static_cast<double>(messages - c.messages_prev) / elapsed, labels);
+                        metrics.set("consumer_bytes_per_second", static_cast<double>(bytes - c.bytes_prev) / elapsed, labels);
+                    }
+
+                    c.messages_prev = messages;
+                    c.bytes_prev = bytes;
+                    c.exported = true;
+
+                    const auto offset = c.offset.load(std::memory_order_relaxed);
+                    const auto watermarks = unit->client.cached_watermarks(c.topic, c.partition);
+                    if (offset >= 0 and watermarks.has_value()) {
+                        metrics.set("consumer_lag", std::max<std::int64_t>(watermarks->high - (offset + 1), 0), labels);
+                    }
+                });
+            }
+        }
     }
 
 };
@@ -10,7 +10,9 @@
 
 #pragma once
 
+#include <libdsp/affinity.hpp>
 #include <libdsp/cache.hpp>
+#include <libdsp/delivery.hpp>
 #include <libdsp/profiler.hpp>
 
 #include <libnova/error.hpp>
@@ -22,19 +24,125 @@
 #include <librdkafka/rdkafka.h>
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <ranges>
+#include <set>
+#include <shared_mutex>
 #include <string>
 #include <string_view>
 #include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 namespace dsp::kf {
 
+/**
+ * @brief   A header of a consumed message, viewing into the message.
+ *
+ * The value is empty for null headers.
+ */
+struct header {
+    std::string_view name;
+    nova::data_view value;
+};
+
+/**
+ * @brief   A lightweight range over the headers of a message.
+ *
+ * Iteration does not allocate, headers are accessed in place via librdkafka.
+ * Headers with the same name are all visited, in order.
+ */
+class header_range {
+public:
+    class iterator {
+    public:
+        using value_type = header;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+
+        explicit iterator(const rd_kafka_headers_t* headers)
+            : m_headers(headers)
+        {
+            fetch();
+        }
+
+        auto operator*() const -> const header& {
+            return m_current;
+        }
+
+        auto operator->() const -> const header* {
+            return &m_current;
+        }
+
+        auto operator++() -> iterator& {
+            ++m_index;
+            fetch();
+            return *this;
+        }
+
+        auto operator++(int) -> iterator {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        auto operator==(std::default_sentinel_t) const -> bool {
+            return m_headers == nullptr;
+        }
+
+    private:
+        const rd_kafka_headers_t* m_headers = nullptr;
+        std::size_t m_index = 0;
+        header m_current {};
+
+        void fetch() {
+            const char* name;
+            const void* value;
+            std::size_t size;
+
+            if (rd_kafka_header_get_all(m_headers, m_index, &name, &value, &size) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+                m_headers = nullptr;
+                return;
+            }
+
+            m_current = { name, nova::data_view{ value, size } };
+        }
+    };
+
+    explicit header_range(const rd_kafka_headers_t* headers)
+        : m_headers(headers)
+    {}
+
+    [[nodiscard]] auto begin() const -> iterator {
+        return m_headers == nullptr ? iterator{ } : iterator{ m_headers };
+    }
+
+    [[nodiscard]] auto end() const -> std::default_sentinel_t {
+        return std::default_sentinel;
+    }
+
+    [[nodiscard]] auto empty() const -> bool {
+        return begin() == end();
+    }
+
+private:
+    const rd_kafka_headers_t* m_headers;
+
+};
+
 namespace detail {
 
     constexpr auto PollTimeout = std::chrono::milliseconds { 1000 };
@@ -68,9 +176,9 @@ namespace detail {
      */
     template <typename RdKafkaMessage>
     class message_view {
-    public:
-        using header_map = std::unordered_map<const char*, nova::data_view>;
+        static constexpr std::size_t MaxHeaderNameOnStack = 128;
 
+    public:
         message_view(RdKafkaMessage* message_ptr)
             : m_message_ptr(message_ptr)
         {}
@@ -78,23 +186,22 @@ namespace detail {
         message_view(const message_view&)            = delete;
         message_view& operator=(const message_view&) = delete;
 
-        message_view(message_view&& rhs) {
+        message_view(message_view&& rhs) noexcept {
             m_message_ptr = rhs.m_message_ptr;
             rhs.m_message_ptr = nullptr;
         }
 
-        message_view& operator=(message_view&& rhs) {
-            m_message_ptr = rhs.m_message_ptr;
-            rhs.m_message_ptr = nullptr;
+        message_view& operator=(message_view&& rhs) noexcept {
+            if (this != &rhs) {
+                release();
+                m_message_ptr = rhs.m_message_ptr;
+                rhs.m_message_ptr = nullptr;
+            }
             return *this;
         }
 
         ~message_view() {
-            if constexpr (not std::is_const_v<RdKafkaMessage>) {
-                if (m_message_ptr != nullptr) {
-                    rd_kafka_message_destroy(m_message_ptr);
-                }
-            }
+            release();
         }
 
         [[nodiscard]] auto ok() const -> bool {
@@ -134,26 +241,68 @@ namespace detail {
         }
 
         /**
-         * Note: Headers are associated with the message by librdkafka
+         * @brief   Iterate over the headers.
+         *
+         * Note: Headers are parsed by librdkafka upon the first access and
+         * associated with the message, the range itself does not allocate.
          */
-        [[nodiscard]] auto headers() const -> header_map {
-            header_map ret;
-            rd_kafka_headers_t* headers;
+        [[nodiscard]] auto headers() const -> header_range {
+            return header_range{ header_handle() };
+        }
 
-            if (rd_kafka_message_headers(m_message_ptr, &headers) != RD_KAFKA_RESP_ERR_NO_ERROR) {
-                return ret;
-            };
+        /**
+         * @brief   Look up the last header with the given name.
+         *
+         * @returns the value or nullopt if there is no such header.
+         */
+        [[nodiscard]] auto header(std::string_view name) const -> std::optional<nova::data_view> {
+            const auto* headers = header_handle();
+            if (headers == nullptr) {
+                return std::nullopt;
+            }
 
-            std::size_t index = 0;
-            const char* key;
             const void* value;
             std::size_t size;
+            rd_kafka_resp_err_t err;
+
+            // librdkafka expects a null-terminated name.
+            if (name.size() < MaxHeaderNameOnStack) {
+                std::array<char, MaxHeaderNameOnStack> buffer;
+                std::ranges::copy(name, std::begin(buffer));
+                buffer[name.size()] = '\0';
 
-            while (rd_kafka_header_get_all(headers, index++, &key, &value, &size) == RD_KAFKA_RESP_ERR_NO_ERROR) {
-                ret.insert({ key, nova::data_view(value, size) });
+                err = rd_kafka_header_get_last(headers, buffer.data(), &value, &size);
+            } else {
+                err = rd_kafka_header_get_last(headers, std::string{ name }.c_str(), &value, &size);
             }
 
-            return ret;
+            if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+                return std::nullopt;
+            }
+
+            return nova::data_view{ value, size };
+        }
+
+        /**
+         * @brief   Copy the headers into message properties, reusing their storage.
+         *
+         * Existing properties are removed. The storage of the list is kept,
+         * therefore converting messages with similar headers does not
+         * allocate (see `dsp::property_list`).
+         *
+         * If a header occurs multiple times, the last one wins.
+         */
+        void headers_into(property_list& properties) const {
+            properties.clear();
+
+            const auto* headers = header_handle();
+            if (headers == nullptr) {
+                return;
+            }
+
+            for (const auto& [name, value] : header_range{ headers }) {
+                properties.set(name, std::string_view{ reinterpret_cast<const char*>(value.ptr()), value.size() });
+            }
         }
 
         /**
@@ -171,6 +320,22 @@ namespace detail {
     private:
         RdKafkaMessage* m_message_ptr;
 
+        [[nodiscard]] auto header_handle() const -> const rd_kafka_headers_t* {
+            rd_kafka_headers_t* headers = nullptr;
+            if (rd_kafka_message_headers(m_message_ptr, &headers) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+                return nullptr;
+            }
+            return headers;
+        }
+
+        void release() {
+            if constexpr (not std::is_const_v<RdKafkaMessage>) {
+                if (m_message_ptr != nullptr) {
+                    rd_kafka_message_destroy(m_message_ptr);
+                }
+            }
+        }
+
     };
 
 } // namespace detail
@@ -185,6 +350,636 @@ using message_view_owned = detail::message_view<rd_kafka_message_t>;
  */
 using message_view = detail::message_view<const rd_kafka_message_t>;
 
+/**
+ * @brief   A partition of a topic, passed to rebalance handlers.
+ *
+ * The topic name is valid only during the callback.
+ */
+struct topic_partition {
+    std::string_view topic;
+    std::int32_t partition;
+    std::int64_t offset;
+};
+
+using partition_list = std::vector<topic_partition>;
+
+/**
+ * @brief   A reusable batch of consumed messages.
+ *
+ * Storage is allocated once, at construction. Consuming into the batch again
+ * releases the previously consumed messages, but keeps the storage, therefore
+ * there is no heap allocation per consume call.
+ *
+ * Messages are valid until the next consume or `clear()`.
+ */
+class batch {
+    friend class consumer;
+    friend class queue;
+
+public:
+    using iterator = std::vector<message_view_owned>::iterator;
+
+    explicit batch(std::size_t capacity)
+        : m_handles(capacity)
+    {
+        m_messages.reserve(capacity);
+    }
+
+    [[nodiscard]] auto begin() -> iterator { return m_messages.begin(); }
+    [[nodiscard]] auto end()   -> iterator { return m_messages.end(); }
+
+    [[nodiscard]] auto size()     const -> std::size_t { return m_messages.size(); }
+    [[nodiscard]] auto capacity() const -> std::size_t { return m_handles.size(); }
+    [[nodiscard]] auto empty()    const -> bool        { return m_messages.empty(); }
+
+    /**
+     * @brief   Release the messages back to librdkafka.
+     */
+    void clear() {
+        m_messages.clear();
+    }
+
+private:
+    std::vector<rd_kafka_message_t*> m_handles;
+    std::vector<message_view_owned> m_messages;
+
+    /**
+     * @brief   Consume from a librdkafka queue, releasing the previous content.
+     */
+    auto fill(rd_kafka_queue_t* queue, std::chrono::milliseconds timeout) -> std::size_t {
+        DSP_PROFILING_ZONE("kafka-consume");
+        clear();
+
+        const auto n = rd_kafka_consume_batch_queue(
+            queue,
+            static_cast<int>(timeout.count()),
+            m_handles.data(),
+            m_handles.size()
+        );
+
+        if (n == -1) {
+            nova::topic_log::warn("kafka", "Error during consuming: {}", rd_kafka_err2str(rd_kafka_last_error()));
+            return 0;
+        }
+
+        for (std::size_t i = 0; i < static_cast<std::size_t>(n); ++i) {
+            m_messages.emplace_back(m_handles[i]);
+        }
+
+        return size();
+    }
+
+};
+
+/**
+ * @brief   A queue of consumed messages, separate from the consumer queue.
+ *
+ * Created by `consumer::create_queue()`. It is served by the application,
+ * typically on its own thread. Must be destroyed before its consumer.
+ */
+class queue {
+    friend class consumer;
+
+public:
+
+    /**
+     * @brief   Consume messages into a reusable batch. See `consumer::consume_into()`.
+     */
+    auto consume_into(batch& out, std::chrono::milliseconds timeout = detail::PollTimeout) -> std::size_t {
+        return out.fill(m_queue.get(), timeout);
+    }
+
+    /**
+     * @brief   Return the current number of elements in queue.
+     */
+    [[nodiscard]] auto size() const -> std::size_t {
+        return rd_kafka_queue_length(m_queue.get());
+    }
+
+private:
+    std::unique_ptr<rd_kafka_queue_t, detail::queue_del> m_queue;
+
+    queue(rd_kafka_queue_t* handle)
+        : m_queue(handle)
+    {}
+
+};
+
+namespace detail {
+
+    /**
+     * @brief   Key of a partition of consumed messages, the topic handle is unique per topic.
+     */
+    struct partition_key {
+        const rd_kafka_topic_t* topic;
+        std::int32_t partition;
+
+        auto operator==(const partition_key&) const -> bool = default;
+    };
+
+    struct partition_key_hash {
+        auto operator()(const partition_key& key) const -> std::size_t {
+            return std::hash<const void*>{}(key.topic) ^ static_cast<std::size_t>(key.partition);
+        }
+    };
+
+} // namespace detail
+
+/**
+ * @brief   Per-partition consumption counters.
+ *
+ * Updated by the thread serving the partitions (`observe()`), read by another
+ * one (`for_each()`), e.g. to export metrics.
+ */
+class partition_metrics {
+public:
+    struct counters {
+        std::string topic;
+        std::int32_t partition;
+
+        std::atomic_int64_t offset { RD_KAFKA_OFFSET_INVALID };
+        std::atomic_uint64_t messages { 0 };
+        std::atomic_uint64_t bytes { 0 };
+        std::atomic_bool assigned { true };
+
+        // Owned by the reader.
+        std::uint64_t messages_prev { 0 };
+        std::uint64_t bytes_prev { 0 };
+        bool exported { false };
+
+        counters(std::string_view t, std::int32_t p)
+            : topic(t)
+            , partition(p)
+        {}
+    };
+
+    /**
+     * @brief   Count a consumed message.
+     *
+     * There is a single writer, plain loads and stores are sufficient, no
+     * read-modify-write instruction is needed.
+     */
+    void observe(message_view_owned& message) {
+        if (not message.ok()) {
+            return;
+        }
+
+        auto& c = find(message);
+        c.offset.store(message.offset(), std::memory_order_relaxed);
+        c.messages.store(c.messages.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        c.bytes.store(c.bytes.load(std::memory_order_relaxed) + message.payload().size(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief   Mark partitions (not) assigned to the consumer.
+     */
+    void assign(const partition_list& partitions, bool assigned) {
+        const auto guard = std::scoped_lock{ m_lock };
+
+        for (auto& [_, c] : m_partitions) {
+            const auto match = std::ranges::any_of(partitions, [&c](const topic_partition& tp) {
+                return tp.partition == c->partition && tp.topic == c->topic;
+            });
+
+            if (match) {
+                c->assigned.store(assigned, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief   Visit the counters of every partition observed so far.
+     */
+    template <typename F>
+    void for_each(F&& f) {
+        const auto guard = std::scoped_lock{ m_lock };
+        for (auto& [_, c] : m_partitions) {
+            f(*c);
+        }
+    }
+
+private:
+    std::mutex m_lock;
+    std::unordered_map<detail::partition_key, std::unique_ptr<counters>, detail::partition_key_hash> m_partitions;
+
+    detail::partition_key m_last_key { nullptr, 0 };
+    counters* m_last = nullptr;
+
+    auto find(message_view_owned& message) -> counters& {
+        const auto key = detail::partition_key{ message.ptr()->rkt, message.partition() };
+        if (m_last != nullptr and key == m_last_key) {
+            return *m_last;
+        }
+
+        const auto guard = std::scoped_lock{ m_lock };
+
+        auto& c = m_partitions[key];
+        if (c == nullptr) {
+            c = std::make_unique<counters>(message.topic(), message.partition());
+        }
+
+        m_last_key = key;
+        m_last = c.get();
+
+        return *c;
+    }
+
+};
+
+/**
+ * @brief   Tracks the delivery of consumed messages for manual offset management.
+ *
+ * Each tracked message gets a delivery token (see `dsp::delivery_scope`). The
+ * offset of a partition advances over the messages whose derived messages are
+ * all delivered, in consume order. `consumer::commit()` collects the advanced
+ * offsets to store and commit them. It gives at-least-once semantics.
+ *
+ * If a message fails (e.g. dropped or not delivered), the offset of its
+ * partition stops before it and new messages of the partition are not tracked
+ * until the partition is rewound: `consumer::rewind()` seeks it back to the
+ * failed message, which is consumed again with the ones after it. A message
+ * failing `MaxRewinds` times in a row is given up (logged), so that a message
+ * that can never be delivered does not stop the partition.
+ *
+ * Only assigned partitions are tracked (`assign()`, `revoke()`).
+ *
+ * `track()` and `rewind()` must be called from the thread serving the
+ * partitions, tokens can be released from any thread.
+ */
+class offset_tracker {
+    struct partition_state;
+
+    class entry final : public delivery_token {
+    public:
+        entry(partition_state& owner, std::int64_t offset)
+            : m_owner(owner)
+            , m_offset(offset)
+        {}
+
+        [[nodiscard]] auto offset() const -> std::int64_t {
+            return m_offset;
+        }
+
+        bool done = false;
+
+    protected:
+        void on_complete() override {
+            m_owner.complete(*this);
+        }
+
+    private:
+        partition_state& m_owner;
+        std::int64_t m_offset;
+
+    };
+
+    struct partition_state {
+        std::string topic;
+        std::int32_t partition;
+        std::atomic_uint64_t& completed;
+        std::atomic_bool& failures;
+
+        std::mutex lock;
+        std::deque<entry> entries;
+        std::int64_t next_offset = RD_KAFKA_OFFSET_INVALID;
+        std::int64_t collected = RD_KAFKA_OFFSET_INVALID;
+
+        /**
+         * @brief   Offset of the first failed message, the partition waits for a rewind.
+         */
+        std::int64_t failed_offset = RD_KAFKA_OFFSET_INVALID;
+
+        /**
+         * @brief   Offset of a message given up, its failure does not stop the partition.
+         */
+        std::int64_t skipped_offset = RD_KAFKA_OFFSET_INVALID;
+        bool retired = false;
+
+        partition_state(std::string_view t, std::int32_t p, std::atomic_uint64_t& counter, std::atomic_bool& failure_flag)
+            : topic(t)
+            , partition(p)
+            , completed(counter)
+            , failures(failure_flag)
+        {}
+
+        [[nodiscard]] auto blocked() const -> bool {
+            return failed_offset != RD_KAFKA_OFFSET_INVALID;
+        }
+
+        /**
+         * @brief   Advance the offset over the completed messages at the front.
+         */
+        void complete(entry& e) {
+            const auto guard = std::scoped_lock{ lock };
+            e.done = true;
+            advance();
+        }
+
+        /**
+         * @brief   Pop the completed messages at the front, the lock must be held.
+         *
+         * A retired state is not committed anymore, its failed messages are
+         * popped as well.
+         */
+        void advance() {
+            std::uint64_t n = 0;
+            while (not entries.empty() and entries.front().done) {
+                const auto offset = entries.front().offset();
+
+                if (entries.front().failed() and offset != skipped_offset and not retired) {
+                    if (not blocked()) {
+                        nova::topic_log::warn("kafka", "Delivery failed, {}[{}] is rewound to offset {}", topic, partition, offset);
+                        failed_offset = offset;
+                        failures.store(true, std::memory_order_release);
+                    }
+                    break;
+                }
+
+                next_offset = offset + 1;
+                entries.pop_front();
+                ++n;
+            }
+
+            completed.fetch_add(n, std::memory_order_relaxed);
+        }
+    };
+
+    using partition_name = std::pair<std::string, std::int32_t>;
+
+    /**
+     * @brief   Consecutive rewinds of a partition to the same offset.
+     */
+    struct rewind_count {
+        std::int64_t offset;
+        std::size_t count;
+    };
+
+    /**
+     * @brief   State shared with the tokens. Leaked if tokens are still in flight at destruction.
+     */
+    struct shared_t {
+        std::mutex lock;
+        std::unordered_map<detail::partition_key, std::unique_ptr<partition_state>, detail::partition_key_hash> partitions;
+        std::vector<std::unique_ptr<partition_state>> retired;
+        std::set<partition_name> assigned;
+        std::map<partition_name, rewind_count> rewinds;
+        std::atomic_uint64_t completed { 0 };
+        std::atomic_bool failures { false };
+    };
+
+public:
+    static constexpr std::size_t MaxRewinds = 5;
+
+    offset_tracker() = default;
+
+    offset_tracker(const offset_tracker&)               = delete;
+    offset_tracker(offset_tracker&&)                    = delete;
+    offset_tracker& operator=(const offset_tracker&)    = delete;
+    offset_tracker& operator=(offset_tracker&&)         = delete;
+
+    ~offset_tracker() {
+        if (const auto n = in_flight(); n > 0) {
+            nova::topic_log::warn("kafka", "{} consumed message(s) still in flight, offsets are not committed", n);
+            [[maybe_unused]] auto* leaked = m_shared.release();
+        }
+    }
+
+    /**
+     * @brief   Start tracking a consumed message.
+     *
+     * @returns the delivery token of the message or nullptr if it is not
+     *          tracked (error message, partition not assigned or waiting for
+     *          a rewind). The caller owns one reference of the token and must
+     *          release it when the message is processed.
+     */
+    [[nodiscard]] auto track(message_view_owned& message) -> delivery_token* {
+        if (not message.ok()) {
+            return nullptr;
+        }
+
+        return track(message.ptr()->rkt, message.topic(), message.partition(), message.offset());
+    }
+
+    /**
+     * @param   handle Topic handle of the message, identifies the topic.
+     */
+    [[nodiscard]] auto track(const rd_kafka_topic_t* handle, std::string_view topic, std::int32_t partition, std::int64_t offset) -> delivery_token* {
+        while (true) {
+            auto* state = find({ handle, partition }, topic);
+            if (state == nullptr) {
+                return nullptr;
+            }
+
+            const auto guard = std::scoped_lock{ state->lock };
+
+            if (state->retired) {
+                m_last = nullptr;
+                continue;
+            }
+
+            if (state->blocked()) {
+                return nullptr;
+            }
+
+            return &state->entries.emplace_back(*state, offset);
+        }
+    }
+
+    /**
+     * @brief   Start tracking assigned partitions.
+     *
+     * Must be called before messages of the partitions are consumed.
+     */
+    void assign(const partition_list& partitions) {
+        const auto guard = std::scoped_lock{ m_shared->lock };
+        for (const auto& tp : partitions) {
+            m_shared->assigned.emplace(tp.topic, tp.partition);
+        }
+    }
+
+    /**
+     * @brief   Stop tracking revoked partitions.
+     *
+     * Their messages still in flight are not committed anymore. If the
+     * partition is assigned again, it is tracked from scratch.
+     */
+    void revoke(const partition_list& partitions) {
+        const auto guard = std::scoped_lock{ m_shared->lock };
+
+        for (const auto& tp : partitions) {
+            const auto name = partition_name{ tp.topic, tp.partition };
+            m_shared->assigned.erase(name);
+            m_shared->rewinds.erase(name);
+        }
+
+        retire_if([&partitions](const partition_state& state) {
+            return std::ranges::any_of(partitions, [&state](const topic_partition& tp) {
+                return tp.partition == state.partition && tp.topic == state.topic;
+            });
+        });
+    }
+
+    /**
+     * @brief   Add the partitions to rewind to the list, with their failed offset, and stop tracking them.
+     *
+     * The caller seeks them back before their next messages are tracked, they
+     * are tracked from scratch then.
+     *
+     * @returns the number of partitions added.
+     */
+    auto rewind(rd_kafka_topic_partition_list_t* offsets) -> std::size_t {
+        if (not m_shared->failures.exchange(false, std::memory_order_acquire)) {
+            return 0;
+        }
+
+        const auto guard = std::scoped_lock{ m_shared->lock };
+
+        std::size_t n = 0;
+        retire_if([&](const partition_state& state) {
+            if (not state.blocked()) {
+                return false;
+            }
+
+            auto& rewinds = m_shared->rewinds[{ state.topic, state.partition }];
+            rewinds.count = rewinds.offset == state.failed_offset ? rewinds.count + 1 : 1;
+            rewinds.offset = state.failed_offset;
+
+            rd_kafka_topic_partition_list_add(offsets, state.topic.c_str(), state.partition)->offset = state.failed_offset;
+            ++n;
+            return true;
+        });
+
+        return n;
+    }
+
+    /**
+     * @brief   Return the number of messages completed since the creation.
+     */
+    [[nodiscard]] auto completed() const -> std::uint64_t {
+        return m_shared->completed.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief   Return the number of tracked messages not completed yet.
+     */
+    [[nodiscard]] auto in_flight() const -> std::size_t {
+        const auto guard = std::scoped_lock{ m_shared->lock };
+
+        std::size_t n = 0;
+        for (const auto& [_, state] : m_shared->partitions) {
+            const auto partition_guard = std::scoped_lock{ state->lock };
+            n += state->entries.size();
+        }
+
+        for (const auto& state : m_shared->retired) {
+            const auto partition_guard = std::scoped_lock{ state->lock };
+            n += state->entries.size();
+        }
+
+        return n;
+    }
+
+    /**
+     * @brief   Add the offsets advanced since the last call to the list.
+     */
+    void collect(rd_kafka_topic_partition_list_t* offsets) {
+        const auto guard = std::scoped_lock{ m_shared->lock };
+
+        for (auto& [_, state] : m_shared->partitions) {
+            const auto partition_guard = std::scoped_lock{ state->lock };
+
+            if (state->next_offset != state->collected) {
+                rd_kafka_topic_partition_list_add(offsets, state->topic.c_str(), state->partition)->offset = state->next_offset;
+                state->collected = state->next_offset;
+            }
+        }
+    }
+
+private:
+    std::unique_ptr<shared_t> m_shared = std::make_unique<shared_t>();
+
+    detail::partition_key m_last_key { nullptr, 0 };
+    partition_state* m_last = nullptr;
+
+    /**
+     * @brief   Find the state of the partition, the last one is cached.
+     *
+     * Retired states are released here, only the thread calling `track()`
+     * can refer to them besides their in-flight tokens.
+     *
+     * @returns nullptr if the partition is not assigned.
+     */
+    auto find(const detail::partition_key& key, std::string_view topic) -> partition_state* {
+        if (m_last != nullptr and key == m_last_key) {
+            return m_last;
+        }
+
+        const auto guard = std::scoped_lock{ m_shared->lock };
+
+        std::erase_if(m_shared->retired, [](const std::unique_ptr<partition_state>& retired) {
+            const auto partition_guard = std::scoped_lock{ retired->lock };
+            return retired->entries.empty();
+        });
+
+        auto it = m_shared->partitions.find(key);
+        if (it == std::end(m_shared->partitions)) {
+            const auto name = partition_name{ topic, key.partition };
+            if (not m_shared->assigned.contains(name)) {
+                return nullptr;
+            }
+
+            auto state = std::make_unique<partition_state>(topic, key.partition, m_shared->completed, m_shared->failures);
+
+            // Rewound too many times to the same message, it is given up.
+            if (const auto rewinds = m_shared->rewinds.find(name); rewinds != std::end(m_shared->rewinds) and rewinds->second.count >= MaxRewinds) {
+                nova::topic_log::error(
+                    "kafka",
+                    "Delivery of {}[{}] at offset {} failed {} times, the message is given up",
+                    topic,
+                    key.partition,
+                    rewinds->second.offset,
+                    rewinds->second.count
+                );
+                state->skipped_offset = rewinds->second.offset;
+                m_shared->rewinds.erase(rewinds);
+            }
+
+            it = m_shared->partitions.emplace(key, std::move(state)).first;
+        }
+
+        m_last_key = key;
+        m_last = it->second.get();
+
+        return m_last;
+    }
+
+    /**
+     * @brief   Retire the states matching `pred`, the shared lock must be held.
+     */
+    template <typename Pred>
+    void retire_if(Pred&& pred) {
+        auto& map = m_shared->partitions;
+
+        for (auto it = std::begin(map); it != std::end(map); ) {
+            auto& state = *it->second;
+            if (not pred(state)) {
+                ++it;
+                continue;
+            }
+
+            {
+                const auto partition_guard = std::scoped_lock{ state.lock };
+                state.retired = true;
+                state.advance();
+            }
+
+            m_shared->retired.push_back(std::move(it->second));
+            it = map.erase(it);
+        }
+    }
+
+};
+
 /**
  * @brief   An abstraction that hides C API and delegates to error and success handlers.
  */
@@ -211,53 +1006,241 @@ public:
     virtual ~throttle_handler() = default;
 };
 
-class statistics_handler {
-public:
-    virtual void operator()(const std::string& json_str) = 0;
-    virtual ~statistics_handler() = default;
-};
+class statistics_handler {
+public:
+    virtual void operator()(const std::string& json_str) = 0;
+    virtual ~statistics_handler() = default;
+};
+
+/**
+ * @brief   Hooks called on consumer group rebalance.
+ *
+ * Called from the thread serving the consumer queue (`consume_into()`).
+ *
+ * With cooperative rebalancing (see `properties::cooperative_rebalance()`),
+ * only the partitions that changed are passed. With eager rebalancing, the
+ * whole assignment is revoked and then assigned again.
+ */
+class rebalance_handler {
+public:
+
+    /**
+     * @brief   Called before the partitions are assigned, none of their messages is consumed yet.
+     */
+    virtual void on_assigning(const partition_list&) { /* optional */ }
+
+    /**
+     * @brief   Called after the partitions are assigned.
+     */
+    virtual void on_assign(const partition_list&) { /* optional */ }
+
+    /**
+     * @brief   Called before the partitions are unassigned.
+     *
+     * The last chance to flush per-partition state and commit offsets.
+     */
+    virtual void on_revoke(const partition_list&) { /* optional */ }
+
+    /**
+     * @brief   Called if the assignment was lost (e.g. session timeout).
+     *
+     * Other consumers might already process the partitions, committing
+     * offsets fails.
+     */
+    virtual void on_lost(const partition_list& partitions) {
+        on_revoke(partitions);
+    }
+
+    virtual ~rebalance_handler() = default;
+};
+
+namespace detail {
+
+    enum RdKafkaLogLevel {
+        emerg = 0,
+        alert = 1,
+        crit = 2,
+        err = 3,
+        warning = 4,
+        notice = 5,
+        info = 6,
+        debug = 7,
+    };
+
+    constexpr std::size_t ErrorMsgLength = 512;
+
+    struct callbacks_t {
+        /**
+         * @brief   User handlers, shared by the clients created from copies of the same properties.
+         */
+        std::shared_ptr<delivery_handler> delivery = nullptr;
+        std::shared_ptr<throttle_handler> throttle = nullptr;
+        std::shared_ptr<statistics_handler> statistics = nullptr;
+        std::shared_ptr<rebalance_handler> rebalance = nullptr;
+
+        /**
+         * @brief   Rebalance handler of the application using the consumer, see `consumer::attach()`.
+         */
+        rebalance_handler* rebalance_hook = nullptr;
+
+        /**
+         * @brief   Destination queues of assigned partitions, see `consumer::distribute()`.
+         */
+        std::vector<rd_kafka_queue_t*> partition_queues;
+
+        /**
+         * @brief   Start time of newly assigned partitions, see `consumer::start_from()`.
+         */
+        std::optional<std::chrono::system_clock::time_point> start_time;
+        std::set<std::pair<std::string, std::int32_t>> started_partitions;
+
+        /**
+         * @brief   Partitions assigned paused, waiting for the lookup of their start offset, see `start_pending()`.
+         */
+        std::vector<std::pair<std::string, std::int32_t>> pending_start;
+
+        /**
+         * @brief   Set by `consumer::pause_assignment()`, deferred partitions are not resumed then.
+         */
+        bool assignment_paused = false;
+    };
+
+    constexpr auto OffsetsForTimesTimeout = std::chrono::milliseconds{ 10000 };
+
+    /**
+     * @brief   Replace the offsets with the earliest ones whose timestamp is at or after the given time.
+     *
+     * If there is no such message, the offset is the end of the partition.
+     * If the lookup of a partition failed, its offset is invalid (it starts
+     * from the committed offset).
+     */
+    inline auto offsets_for_time(
+            rd_kafka_t* client,
+            rd_kafka_topic_partition_list_t* partitions,
+            std::chrono::system_clock::time_point time) -> bool
+    {
+        const auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+        for (int i = 0; i < partitions->cnt; ++i) {
+            partitions->elems[i].offset = timestamp;
+        }
+
+        const auto err = rd_kafka_offsets_for_times(client, partitions, static_cast<int>(OffsetsForTimesTimeout.count()));
+        if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            nova::topic_log::error("kafka", "Cannot look up offsets for time: {}", rd_kafka_err2str(err));
+            return false;
+        }
+
+        for (int i = 0; i < partitions->cnt; ++i) {
+            auto& tp = partitions->elems[i];
+            if (tp.err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+                nova::topic_log::warn("kafka", "Cannot look up offset for time of {}[{}]: {}", tp.topic, tp.partition, rd_kafka_err2str(tp.err));
+                tp.offset = RD_KAFKA_OFFSET_INVALID;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief   Defer the start of the partitions assigned for the first time.
+     *
+     * The offset lookup blocks, it must not run in the rebalance callback:
+     * the partitions are assigned paused, `start_pending()` seeks and
+     * resumes them once the callback returned.
+     */
+    inline void defer_start(rd_kafka_t* client, const rd_kafka_topic_partition_list_t* partitions, callbacks_t& context) {
+        const auto pending = std::unique_ptr<rd_kafka_topic_partition_list_t, partition_del>(
+            rd_kafka_topic_partition_list_new(partitions->cnt)
+        );
+
+        for (int i = 0; i < partitions->cnt; ++i) {
+            const auto& tp = partitions->elems[i];
+            if (context.started_partitions.emplace(tp.topic, tp.partition).second) {
+                context.pending_start.emplace_back(tp.topic, tp.partition);
+                rd_kafka_topic_partition_list_add(pending.get(), tp.topic, tp.partition);
+            }
+        }
+
+        if (pending->cnt == 0) {
+            return;
+        }
+
+        if (const auto err = rd_kafka_pause_partitions(client, pending.get()); err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            nova::topic_log::warn("kafka", "Cannot pause partitions to start from time: {}", rd_kafka_err2str(err));
+        }
+    }
+
+    /**
+     * @brief   Seek the partitions deferred by `defer_start()` to their start offset and resume them.
+     *
+     * Partitions whose offset cannot be looked up start from the committed
+     * offset. While the whole assignment is paused, they stay paused.
+     */
+    inline void start_pending(rd_kafka_t* client, callbacks_t& context) {
+        if (context.pending_start.empty()) {
+            return;
+        }
+
+        const auto pending = std::unique_ptr<rd_kafka_topic_partition_list_t, partition_del>(
+            rd_kafka_topic_partition_list_new(static_cast<int>(context.pending_start.size()))
+        );
+
+        for (const auto& [topic, partition] : context.pending_start) {
+            rd_kafka_topic_partition_list_add(pending.get(), topic.c_str(), partition);
+        }
+        context.pending_start.clear();
 
-class rebalance_handler {
-public:
-    // TODO(feat): Finish rebalance callback API.
-    // virtual void operator()() = 0;
-    virtual void operator()(
-        rd_kafka_t* client,
-        rd_kafka_resp_err_t* err,
-        rd_kafka_topic_partition_list_t* partitions,
-        void* opaque) = 0;
+        const auto offsets = std::unique_ptr<rd_kafka_topic_partition_list_t, partition_del>(
+            rd_kafka_topic_partition_list_copy(pending.get())
+        );
 
-    virtual ~rebalance_handler() = default;
-};
+        if (offsets_for_time(client, offsets.get(), *context.start_time)) {
+            const auto seek = std::unique_ptr<rd_kafka_topic_partition_list_t, partition_del>(
+                rd_kafka_topic_partition_list_new(offsets->cnt)
+            );
 
-namespace detail {
+            for (int i = 0; i < offsets->cnt; ++i) {
+                const auto& tp = offsets->elems[i];
+                if (tp.offset != RD_KAFKA_OFFSET_INVALID) {
+                    rd_kafka_topic_partition_list_add(seek.get(), tp.topic, tp.partition)->offset = tp.offset;
+                    nova::topic_log::info("kafka", "Starting {}[{}] from offset {}", tp.topic, tp.partition, tp.offset);
+                }
+            }
 
-    enum RdKafkaLogLevel {
-        emerg = 0,
-        alert = 1,
-        crit = 2,
-        err = 3,
-        warning = 4,
-        notice = 5,
-        info = 6,
-        debug = 7,
-    };
+            if (seek->cnt > 0) {
+                if (auto* error = rd_kafka_seek_partitions(client, seek.get(), static_cast<int>(PollTimeout.count())); error != nullptr) {
+                    nova::topic_log::error("kafka", "Seek to start time failed: {}", rd_kafka_error_string(error));
+                    rd_kafka_error_destroy(error);
+                }
+            }
+        }
 
-    constexpr std::size_t ErrorMsgLength = 512;
+        // Resumed with the rest of the assignment instead, e.g. after backpressure.
+        if (context.assignment_paused) {
+            return;
+        }
 
-    struct callbacks_t {
-        std::unique_ptr<delivery_handler> delivery = nullptr;
-        std::unique_ptr<throttle_handler> throttle = nullptr;
-        std::unique_ptr<statistics_handler> statistics = nullptr;
-        std::unique_ptr<rebalance_handler> rebalance = nullptr;
-    };
+        if (const auto err = rd_kafka_resume_partitions(client, pending.get()); err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            nova::topic_log::error("kafka", "Cannot resume partitions started from time: {}", rd_kafka_err2str(err));
+        }
+    }
 
     /**
      * @brief   Trampoline function to call delivery handler object.
      */
     inline void delivery_callback([[maybe_unused]] rd_kafka_t* client, const rd_kafka_message_t* message, void* opaque) {
         auto* context = static_cast<callbacks_t*>(opaque);
-        context->delivery->operator()(message);
+        if (context->delivery != nullptr) {
+            context->delivery->operator()(message);
+        }
+
+        // Delivery token of the consumed message this one is derived from, see `producer::send_impl()`.
+        if (auto* token = static_cast<delivery_token*>(message->_private); token != nullptr) {
+            if (message->err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+                token->fail();
+            }
+            token->release();
+        }
     }
 
     /**
@@ -298,72 +1281,146 @@ namespace detail {
     }
 
     /**
-     * @brief   Trampoline function to call rebalance handler object.
+     * @brief   Select the destination queue of a partition.
+     */
+    [[nodiscard]] inline auto partition_index(std::string_view topic, std::int32_t partition, std::size_t n_queues) -> std::size_t {
+        return (std::hash<std::string_view>{}(topic) + static_cast<std::size_t>(partition)) % n_queues;
+    }
+
+    /**
+     * @brief   Forward the queues of the given partitions to the destination queues.
+     */
+    inline void forward_partitions(
+            rd_kafka_t* client,
+            const rd_kafka_topic_partition_list_t* partitions,
+            const std::vector<rd_kafka_queue_t*>& queues)
+    {
+        if (queues.empty()) {
+            return;
+        }
+
+        for (int i = 0; i < partitions->cnt; ++i) {
+            const auto& tp = partitions->elems[i];
+
+            const auto partition_queue = std::unique_ptr<rd_kafka_queue_t, queue_del>(
+                rd_kafka_queue_get_partition(client, tp.topic, tp.partition)
+            );
+
+            if (partition_queue == nullptr) {
+                nova::topic_log::warn("kafka", "No queue for partition {}[{}]", tp.topic, tp.partition);
+                continue;
+            }
+
+            rd_kafka_queue_forward(partition_queue.get(), queues[partition_index(tp.topic, tp.partition, queues.size())]);
+        }
+    }
+
+    [[nodiscard]] inline auto to_partition_list(const rd_kafka_topic_partition_list_t* partitions) -> partition_list {
+        auto ret = partition_list{ };
+        ret.reserve(static_cast<std::size_t>(partitions->cnt));
+
+        for (int i = 0; i < partitions->cnt; ++i) {
+            const auto& tp = partitions->elems[i];
+            ret.push_back({ tp.topic, tp.partition, tp.offset });
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief   Rebalance callback, (un)assigning partitions with the protocol in use.
      *
-     * Currently this is an example code copy-pasta'd from librdkafka's performance example.
-     * Not in use.
+     * Assigned partitions are forwarded to the partition queues (if any)
+     * before the assignment takes effect.
      *
-     * TODO(feat): Finish rebalance callback API.
+     * Rebalance handlers are called after assignment and before revocation.
+     * The application handler is called first on revoke (to flush its state),
+     * last on assign.
      */
     inline void rebalance_callback(
-            rd_kafka_t* rk,
+            rd_kafka_t* client,
             rd_kafka_resp_err_t err,
             rd_kafka_topic_partition_list_t* partitions,
-            [[maybe_unused]] void* opaque)
+            void* opaque)
     {
-        rd_kafka_error_t *error     = NULL;
-        rd_kafka_resp_err_t ret_err = RD_KAFKA_RESP_ERR_NO_ERROR;
+        auto* context = static_cast<callbacks_t*>(opaque);
+
+        const char* protocol = rd_kafka_rebalance_protocol(client);
+        const bool cooperative = protocol != nullptr && std::string_view{ protocol } == "COOPERATIVE";
 
-        if (!strcmp(rd_kafka_rebalance_protocol(rk), "COOPERATIVE"))
-                fprintf(stderr,
-                        "%% This example has not been modified to "
-                        "support -e (exit on EOF) when "
-                        "partition.assignment.strategy "
-                        "is set to an incremental/cooperative strategy: "
-                        "-e will not behave as expected\n");
+        const auto list = to_partition_list(partitions);
+        const auto handlers = std::array{ context->rebalance_hook, context->rebalance.get() };
+
+        rd_kafka_error_t* error = nullptr;
+        rd_kafka_resp_err_t ret_err = RD_KAFKA_RESP_ERR_NO_ERROR;
 
         switch (err) {
-        case RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS:
-                fprintf(stderr,
-                        "%% Group rebalanced (%s): "
-                        "%d new partition(s) assigned\n",
-                        rd_kafka_rebalance_protocol(rk), partitions->cnt);
-
-                if (!strcmp(rd_kafka_rebalance_protocol(rk), "COOPERATIVE")) {
-                        error = rd_kafka_incremental_assign(rk, partitions);
+            case RD_KAFKA_RESP_ERR__ASSIGN_PARTITIONS:
+                nova::topic_log::info("kafka", "Group rebalanced ({}): {} partition(s) assigned", protocol, partitions->cnt);
+                for (auto* handler : handlers) {
+                    if (handler != nullptr) {
+                        handler->on_assigning(list);
+                    }
+                }
+
+                forward_partitions(client, partitions, context->partition_queues);
+
+                if (cooperative) {
+                    error = rd_kafka_incremental_assign(client, partitions);
                 } else {
-                        ret_err = rd_kafka_assign(rk, partitions);
+                    ret_err = rd_kafka_assign(client, partitions);
+                }
+
+                if (context->start_time.has_value()) {
+                    defer_start(client, partitions, *context);
                 }
 
-                // partition_cnt += partitions->cnt;
+                for (auto* handler : handlers) {
+                    if (handler != nullptr) {
+                        handler->on_assign(list);
+                    }
+                }
                 break;
 
-        case RD_KAFKA_RESP_ERR__REVOKE_PARTITIONS:
-                fprintf(stderr,
-                        "%% Group rebalanced (%s): %d partition(s) revoked\n",
-                        rd_kafka_rebalance_protocol(rk), partitions->cnt);
+            case RD_KAFKA_RESP_ERR__REVOKE_PARTITIONS: {
+                nova::topic_log::info("kafka", "Group rebalanced ({}): {} partition(s) revoked", protocol, partitions->cnt);
 
-                if (!strcmp(rd_kafka_rebalance_protocol(rk), "COOPERATIVE")) {
-                        error = rd_kafka_incremental_unassign(rk, partitions);
-                        // partition_cnt -= partitions->cnt;
-                } else {
-                        ret_err       = rd_kafka_assign(rk, NULL);
-                        // partition_cnt = 0;
+                const bool lost = rd_kafka_assignment_lost(client) != 0;
+                if (lost) {
+                    nova::topic_log::warn("kafka", "Assignment lost, offsets of revoked partitions are not committed");
+                }
+
+                for (auto* handler : handlers | std::views::reverse) {
+                    if (handler == nullptr) {
+                        continue;
+                    }
+
+                    if (lost) {
+                        handler->on_lost(list);
+                    } else {
+                        handler->on_revoke(list);
+                    }
                 }
 
+                if (cooperative) {
+                    error = rd_kafka_incremental_unassign(client, partitions);
+                } else {
+                    ret_err = rd_kafka_assign(client, nullptr);
+                }
                 break;
+            }
 
-        default:
+            default:
+                nova::topic_log::error("kafka", "Rebalance failed: {}", rd_kafka_err2str(err));
+                ret_err = rd_kafka_assign(client, nullptr);
                 break;
         }
 
-        if (error) {
-                fprintf(stderr, "%% incremental assign failure: %s\n",
-                        rd_kafka_error_string(error));
-                rd_kafka_error_destroy(error);
-        } else if (ret_err) {
-                fprintf(stderr, "%% assign failure: %s\n",
-                        rd_kafka_err2str(ret_err));
+        if (error != nullptr) {
+            nova::topic_log::error("kafka", "Incremental assign failure: {}", rd_kafka_error_string(error));
+            rd_kafka_error_destroy(error);
+        } else if (ret_err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            nova::topic_log::error("kafka", "Assign failure: {}", rd_kafka_err2str(ret_err));
         }
     }
 
@@ -377,17 +1434,18 @@ namespace detail {
     }
 
     /**
-     * @brief   Trampoline function to call rebalancer handler object.
+     * @brief   Place the threads of librdkafka, see `thread_placement`.
      */
-    inline int rebalance_callback(
-            [[maybe_unused]] rd_kafka_t* client,
-            rd_kafka_resp_err_t* err,
-            rd_kafka_topic_partition_list_t* partitions,
-            void* opaque)
-    {
-        auto* context = static_cast<callbacks_t*>(opaque);
-        context->rebalance->operator()(client, err, partitions, opaque);
-        return 0;
+    inline rd_kafka_resp_err_t on_thread_start([[maybe_unused]] rd_kafka_t* client, rd_kafka_thread_type_t type, [[maybe_unused]] const char* name, [[maybe_unused]] void* opaque) {
+        place_thread(type == RD_KAFKA_THREAD_BROKER ? thread_role::RdkafkaBroker : thread_role::RdkafkaMain);
+        return RD_KAFKA_RESP_ERR_NO_ERROR;
+    }
+
+    /**
+     * @brief   Thread interceptors are added to the client instance, when it is created.
+     */
+    inline rd_kafka_resp_err_t on_new(rd_kafka_t* client, [[maybe_unused]] const rd_kafka_conf_t* config, [[maybe_unused]] void* opaque, [[maybe_unused]] char* errstr, [[maybe_unused]] size_t errstr_size) {
+        return rd_kafka_interceptor_add_on_thread_start(client, "dsp-placement", on_thread_start, nullptr);
     }
 
 } // namespace detail
@@ -400,8 +1458,14 @@ namespace detail {
  * - otherwise `set(key, value)` can be used.
  *
  * It holds both producer and consumer properties; not all of them applies to both.
+ *
+ * It is copyable, e.g. to create several consumers of the same group. The
+ * callbacks are shared by the copies, therefore they must be thread-safe when
+ * more clients are created.
  */
 class properties {
+    friend class consumer;
+
     using delivery_callback_signature = void(rd_kafka_t*, const rd_kafka_message_t*, void*);
     using throttle_callback_signature = void(rd_kafka_t*, const char*, int32_t, int, void*);
     using statistics_callback_signature = int(rd_kafka_t*, char*, size_t, void*);
@@ -412,6 +1476,11 @@ public:
     static constexpr auto OffsetReset = "auto.offset.reset";
     static constexpr auto StatisticsInterval = "statistics.interval.ms";
     static constexpr auto PartitionEof = "enable.partition.eof";
+    static constexpr auto AutoCommit = "enable.auto.commit";
+    static constexpr auto AutoOffsetStore = "enable.auto.offset.store";
+    static constexpr auto AssignmentStrategy = "partition.assignment.strategy";
+    static constexpr auto QueueMaxMessages = "queue.buffering.max.messages";
+    static constexpr std::size_t DefaultQueueMaxMessages = 100000;
 
     /**
      * @brief   Set an arbitrary property.
@@ -420,6 +1489,17 @@ public:
         m_cfg[key] = value;
     }
 
+    /**
+     * @brief   Return a property if it is set.
+     */
+    [[nodiscard]] auto get(const std::string& key) const -> std::optional<std::string> {
+        const auto it = m_cfg.find(key);
+        if (it == std::end(m_cfg)) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
     void bootstrap_server(const std::string& value) {
         m_cfg[BootstrapServers] = value;
     }
@@ -461,6 +1541,14 @@ public:
         m_cfg[PartitionEof] = "true";
     }
 
+    /**
+     * @brief   Offsets are stored and committed by the application, see `consumer::commit()`.
+     */
+    void manual_offsets() {
+        m_cfg[AutoCommit] = "false";
+        m_cfg[AutoOffsetStore] = "false";
+    }
+
     void delivery_callback(std::unique_ptr<delivery_handler> callback) {
         m_callbacks.delivery = std::move(callback);
     }
@@ -473,6 +1561,24 @@ public:
         m_callbacks.statistics = std::move(callback);
     }
 
+    /**
+     * @brief   Rebalance handler of the consumer, see `rebalance_handler`.
+     */
+    void rebalance_callback(std::unique_ptr<rebalance_handler> callback) {
+        m_callbacks.rebalance = std::move(callback);
+    }
+
+    /**
+     * @brief   Use incremental (cooperative-sticky) rebalancing.
+     *
+     * Only the moved partitions are revoked, others keep being consumed
+     * during the rebalance. All consumers of the group must use the same
+     * rebalance protocol.
+     */
+    void cooperative_rebalance() {
+        m_cfg[AssignmentStrategy] = "cooperative-sticky";
+    }
+
     /**
      * @brief   Create RdKafka configuration object.
      */
@@ -483,15 +1589,10 @@ public:
         set_basic_props(config);
         rd_kafka_conf_set_opaque(config, &m_callbacks);
         rd_kafka_conf_set_log_cb(config, detail::log_callback);
+        rd_kafka_conf_interceptor_add_on_new(config, "dsp-placement", detail::on_new, nullptr);
 
-        // TODO(feat): Finish rebalance callback API.
-        //             Must be added in consumer as it is a consumer-only configuration.
-        //
-        // rd_kafka_conf_set_rebalance_cb(config, detail::rebalance_callback);
-
-        if (m_callbacks.delivery != nullptr) {
-            set(config, detail::delivery_callback);
-        }
+        // Always set, it also acknowledges delivery tokens.
+        set(config, detail::delivery_callback);
 
         if (m_callbacks.throttle != nullptr) {
             set(config, detail::throttle_callback);
@@ -561,6 +1662,7 @@ class producer {
 
         void operator()() {
             DSP_PROFILING_ZONE("kafka-poll");
+            place_thread(thread_role::KafkaPoller);
             while (keep_alive.load()) {
                 rd_kafka_poll(producer, static_cast<int>(detail::PollTimeout.count()));
             }
@@ -574,6 +1676,9 @@ public:
      */
     producer(properties props)
         : m_props(std::move(props))
+        , m_queue_capacity(m_props.get(properties::QueueMaxMessages)
+            .transform([](const std::string& value) { return static_cast<std::size_t>(std::stoull(value)); })
+            .value_or(properties::DefaultQueueMaxMessages))
     {
         auto config = m_props.create();
 
@@ -635,6 +1740,13 @@ public:
         return static_cast<std::size_t>(ret);
     }
 
+    /**
+     * @brief   Return the maximum number of messages in the producer queue.
+     */
+    [[nodiscard]] auto queue_capacity() const -> std::size_t {
+        return m_queue_capacity;
+    }
+
     /**
      * @brief   Enqueue a message.
      *
@@ -702,20 +1814,33 @@ public:
 
 private:
     properties m_props;
+    std::size_t m_queue_capacity;
     std::unique_ptr<rd_kafka_t, detail::kafka_del> m_producer{ nullptr };
     std::jthread m_poll_thread;
     std::atomic_bool m_keep_alive = true;
 
     detail::topics_t m_topics;
+    std::shared_mutex m_topics_mutex;
 
     /**
      * @brief   Create a topic handle and cache it.
      *
+     * Thread-safe, handles are created once and live as long as the producer.
+     *
      * TODO: Update metadata?
      */
     auto topic(const std::string& name) -> rd_kafka_topic_t* {
-        if (not m_topics.contains(name)) {
-            detail::topic_t topic;
+        {
+            const auto lock = std::shared_lock{ m_topics_mutex };
+            if (const auto it = m_topics.find(name); it != std::end(m_topics)) {
+                return it->second.handle.get();
+            }
+        }
+
+        const auto lock = std::unique_lock{ m_topics_mutex };
+        auto [it, inserted] = m_topics.try_emplace(name);
+        if (inserted) {
+            auto& topic = it->second;
 
             // TODO: topic config
             // TODO: multiple partitions
@@ -726,25 +1851,32 @@ private:
             nova_assert(topic.handle != nullptr);
 
             rd_kafka_topic_partition_list_add(topic.partitions.get(), name.c_str(), RD_KAFKA_PARTITION_UA);
-            m_topics[name] = std::move(topic);
         }
 
-        return m_topics[name].handle.get();
+        return it->second.handle.get();
     }
 
+    /**
+     * @brief   Enqueue a message.
+     *
+     * The delivery token of the current thread (if any) is attached to the
+     * message and acknowledged by the delivery callback.
+     */
     auto send_impl(const dsp::message& msg) -> rd_kafka_resp_err_t {
         DSP_PROFILING_ZONE("kafka-produce");
         rd_kafka_resp_err_t err;
 
+        auto* token = delivery_scope::current();
+
         if (not msg.properties.empty()) {
             rd_kafka_headers_t* headers = rd_kafka_headers_new(msg.properties.size());
 
             for (const auto& [k, v] : msg.properties) {
                 const rd_kafka_resp_err_t header_err = rd_kafka_header_add(
                     headers,
-                    k.c_str(),
+                    k.data(),
                     static_cast<long>(k.size()),
-                    v.c_str(),
+                    v.data(),
                     static_cast<long>(v.size())
                 );
 
@@ -753,17 +1885,22 @@ private:
                 }
             }
 
+            if (token != nullptr) {
+                token->acquire();
+            }
+
             #pragma GCC diagnostic push
             #pragma GCC diagnostic ignored "-Wold-style-cast"
 
             err = rd_kafka_producev(
                 m_producer.get(),
-                RD_KAFKA_V_RKT(topic(msg.subject)),
+                RD_KAFKA_V_RKT(topic(msg.subject.str())),
                 RD_KAFKA_V_PARTITION(RD_KAFKA_PARTITION_UA),
                 RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
                 RD_KAFKA_V_VALUE(reinterpret_cast<void*>(const_cast<std::byte*>(msg.payload.data())), msg.payload.size()),
                 RD_KAFKA_V_KEY(reinterpret_cast<void*>(const_cast<std::byte*>(msg.key.data())), msg.key.size()),
                 RD_KAFKA_V_HEADERS(headers),
+                RD_KAFKA_V_OPAQUE(token),
                 RD_KAFKA_V_END
             );
 
@@ -773,19 +1910,27 @@ private:
                 rd_kafka_headers_destroy(headers);
             }
         } else {
+            if (token != nullptr) {
+                token->acquire();
+            }
+
             rd_kafka_produce(
-                topic(msg.subject),
+                topic(msg.subject.str()),
                 RD_KAFKA_PARTITION_UA,
                 RD_KAFKA_MSG_F_COPY,
                 reinterpret_cast<void*>(const_cast<std::byte*>(msg.payload.data())),
                 msg.payload.size(),
                 reinterpret_cast<const void*>(msg.key.data()),
                 msg.key.size(),
-                NULL
+                token
             );
             err = rd_kafka_last_error();
         }
 
+        if (err != RD_KAFKA_RESP_ERR_NO_ERROR and token != nullptr) {
+            token->release();
+        }
+
         return err;
     }
 
@@ -808,7 +1953,7 @@ public:
         : m_props(std::move(props))
     {
         auto config = m_props.create();
-        // TODO(feat): Configure rebalance callback.
+        rd_kafka_conf_set_rebalance_cb(config, detail::rebalance_callback);
 
         char errstr[detail::ErrorMsgLength];
         m_consumer = std::unique_ptr<rd_kafka_t, detail::kafka_del>(
@@ -905,16 +2050,246 @@ public:
         auto n = rd_kafka_consume_batch_queue(m_queue.get(), static_cast<int>(timeout.count()), messages.data(), batch_size);
         if (n == -1) {
             nova::topic_log::warn("kafka", "Error during consuming: {}", rd_kafka_err2str(rd_kafka_last_error()));
-        } else {
-            messages.resize(static_cast<std::size_t>(n));
+            n = 0;
         }
 
+        messages.resize(static_cast<std::size_t>(n));
+        detail::start_pending(m_consumer.get(), m_props.m_callbacks);
+
         std::vector<message_view_owned> ret;
-        ret.reserve(batch_size);
+        ret.reserve(messages.size());
         std::ranges::transform(messages, std::back_inserter(ret), [](rd_kafka_message_t* msg) { return message_view_owned{ msg }; });
         return ret;
     }
 
+    /**
+     * @brief   Consume messages into a reusable batch.
+     *
+     * The allocation-free variant of `consume()`, the batch size is the
+     * capacity of the batch. Previous content of the batch is released.
+     *
+     * @returns the number of consumed messages.
+     */
+    auto consume_into(batch& out, std::chrono::milliseconds timeout = detail::PollTimeout) -> std::size_t {
+        const auto n = out.fill(m_queue.get(), timeout);
+        detail::start_pending(m_consumer.get(), m_props.m_callbacks);
+        return n;
+    }
+
+    /**
+     * @brief   Create a queue that can be a destination of partitions.
+     */
+    [[nodiscard]] auto create_queue() -> queue {
+        return queue{ rd_kafka_queue_new(m_consumer.get()) };
+    }
+
+    /**
+     * @brief   Serve assigned partitions from the given queues instead of the consumer queue.
+     *
+     * Each partition is forwarded to one of the queues upon assignment, before
+     * fetching starts. A partition is always forwarded to the same queue,
+     * therefore the ordering within a partition is kept if each queue is
+     * served by one thread.
+     *
+     * The consumer queue still has to be served (`consume_into()`) for
+     * rebalance events and errors.
+     *
+     * Must be called before `subscribe()`. The queues must outlive the subscription.
+     */
+    void distribute(const std::vector<queue*>& queues) {
+        m_props.m_callbacks.partition_queues.clear();
+        for (auto* q : queues) {
+            m_props.m_callbacks.partition_queues.push_back(q->m_queue.get());
+        }
+    }
+
+    /**
+     * @brief   Start consuming from a point in time instead of the committed offsets.
+     *
+     * Applies to each partition when it is assigned for the first time, e.g.
+     * for reprocessing. The partition is assigned paused, its offset is looked
+     * up and sought by the next `consume()`/`consume_into()` after the
+     * rebalance, outside of the rebalance callback. Must be called before
+     * `subscribe()`.
+     */
+    void start_from(std::chrono::system_clock::time_point time) {
+        m_props.m_callbacks.start_time = time;
+    }
+
+    /**
+     * @brief   Seek all assigned partitions to a point in time.
+     *
+     * Each partition is positioned at its earliest message whose timestamp is
+     * at or after the given time, or at the end of the partition.
+     *
+     * @returns false if the offsets cannot be looked up or the seek failed.
+     */
+    auto seek_to_time(std::chrono::system_clock::time_point time, std::chrono::milliseconds timeout = detail::PollTimeout) -> bool {
+        rd_kafka_topic_partition_list_t* partitions = nullptr;
+
+        if (const auto err = rd_kafka_assignment(m_consumer.get(), &partitions); err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            nova::topic_log::warn("kafka", "Cannot get assignment: {}", rd_kafka_err2str(err));
+            return false;
+        }
+
+        const auto list = std::unique_ptr<rd_kafka_topic_partition_list_t, detail::partition_del>(partitions);
+        if (list->cnt == 0 or not detail::offsets_for_time(m_consumer.get(), list.get(), time)) {
+            return false;
+        }
+
+        if (auto* error = rd_kafka_seek_partitions(m_consumer.get(), list.get(), static_cast<int>(timeout.count())); error != nullptr) {
+            nova::topic_log::error("kafka", "Seek failed: {}", rd_kafka_error_string(error));
+            rd_kafka_error_destroy(error);
+            return false;
+        }
+
+        auto success = true;
+        for (int i = 0; i < list->cnt; ++i) {
+            const auto& tp = list->elems[i];
+            if (tp.err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+                nova::topic_log::warn("kafka", "Seek failed on {}[{}]: {}", tp.topic, tp.partition, rd_kafka_err2str(tp.err));
+                success = false;
+            }
+        }
+
+        return success;
+    }
+
+    /**
+     * @brief   Pause fetching the given partitions, e.g. for backpressure.
+     *
+     * Already fetched messages are still consumed.
+     */
+    void pause(const partition_list& partitions) {
+        pause_resume(partitions, true);
+    }
+
+    void resume(const partition_list& partitions) {
+        pause_resume(partitions, false);
+    }
+
+    /**
+     * @brief   Pause or resume fetching all assigned partitions.
+     *
+     * While paused, partitions started from a point in time (`start_from()`)
+     * are not resumed after their seek. Must be called by the thread serving
+     * the consumer queue.
+     */
+    void pause_assignment(bool pause) {
+        m_props.m_callbacks.assignment_paused = pause;
+
+        rd_kafka_topic_partition_list_t* partitions = nullptr;
+
+        if (const auto err = rd_kafka_assignment(m_consumer.get(), &partitions); err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            nova::topic_log::warn("kafka", "Cannot get assignment: {}", rd_kafka_err2str(err));
+            return;
+        }
+
+        const auto list = std::unique_ptr<rd_kafka_topic_partition_list_t, detail::partition_del>(partitions);
+        pause_resume(list.get(), pause);
+    }
+
+    /**
+     * @brief   Low and high watermark offsets of a partition.
+     */
+    struct watermarks {
+        std::int64_t low;
+        std::int64_t high;
+    };
+
+    /**
+     * @brief   Return the cached watermark offsets of a partition.
+     *
+     * They are updated by fetch responses, there is no broker round trip.
+     *
+     * @returns nullopt if they are not known (yet).
+     */
+    [[nodiscard]] auto cached_watermarks(const std::string& topic, std::int32_t partition) const -> std::optional<watermarks> {
+        auto ret = watermarks{ RD_KAFKA_OFFSET_INVALID, RD_KAFKA_OFFSET_INVALID };
+
+        const auto err = rd_kafka_get_watermark_offsets(m_consumer.get(), topic.c_str(), partition, &ret.low, &ret.high);
+        if (err != RD_KAFKA_RESP_ERR_NO_ERROR or ret.high == RD_KAFKA_OFFSET_INVALID) {
+            return std::nullopt;
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief   Attach the rebalance handler of the application using the consumer.
+     *
+     * It is called besides the one set in `properties::rebalance_callback()`.
+     * Must be called before `subscribe()`. The handler must be detached
+     * (nullptr) if it does not outlive the consumer.
+     */
+    void attach(rebalance_handler* handler) {
+        m_props.m_callbacks.rebalance_hook = handler;
+    }
+
+    /**
+     * @brief   Seek the partitions with failed messages back to them, see `offset_tracker`.
+     *
+     * Must be called by the thread tracking the messages, between batches.
+     */
+    void rewind(offset_tracker& tracker) {
+        static constexpr auto InitialSize = 1;
+
+        const auto offsets = std::unique_ptr<rd_kafka_topic_partition_list_t, detail::partition_del>(
+            rd_kafka_topic_partition_list_new(InitialSize)
+        );
+
+        if (tracker.rewind(offsets.get()) == 0) {
+            return;
+        }
+
+        if (auto* error = rd_kafka_seek_partitions(m_consumer.get(), offsets.get(), static_cast<int>(detail::PollTimeout.count())); error != nullptr) {
+            nova::topic_log::error("kafka", "Rewind failed: {}", rd_kafka_error_string(error));
+            rd_kafka_error_destroy(error);
+            return;
+        }
+
+        for (int i = 0; i < offsets->cnt; ++i) {
+            const auto& tp = offsets->elems[i];
+            if (tp.err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+                nova::topic_log::error("kafka", "Rewind failed on {}[{}]: {}", tp.topic, tp.partition, rd_kafka_err2str(tp.err));
+            }
+        }
+    }
+
+    /**
+     * @brief   Store and commit the offsets advanced by the trackers.
+     *
+     * Requires `properties::manual_offsets()`. Errors are logged, but not
+     * returned to the caller.
+     *
+     * @param async     if true, the function does not wait for the result.
+     */
+    void commit(const std::vector<offset_tracker*>& trackers, bool async = true) {
+        DSP_PROFILING_ZONE("kafka-commit");
+        static constexpr auto InitialSize = 8;
+
+        const auto offsets = std::unique_ptr<rd_kafka_topic_partition_list_t, detail::partition_del>(
+            rd_kafka_topic_partition_list_new(InitialSize)
+        );
+
+        for (auto* tracker : trackers) {
+            tracker->collect(offsets.get());
+        }
+
+        if (offsets->cnt == 0) {
+            return;
+        }
+
+        if (const auto err = rd_kafka_offsets_store(m_consumer.get(), offsets.get()); err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            nova::topic_log::warn("kafka", "Error during storing offsets: {}", rd_kafka_err2str(err));
+        }
+
+        const auto err = rd_kafka_commit(m_consumer.get(), nullptr, async ? 1 : 0);
+        if (err != RD_KAFKA_RESP_ERR_NO_ERROR and err != RD_KAFKA_RESP_ERR__NO_OFFSET) {
+            nova::topic_log::warn("kafka", "Error during committing offsets: {}", rd_kafka_err2str(err));
+        }
+    }
+
 private:
     properties m_props;
     std::unique_ptr<rd_kafka_t, detail::kafka_del> m_consumer { nullptr };
@@ -922,6 +2297,36 @@ private:
 
     detail::topics_t m_topics;
 
+    void pause_resume(const partition_list& partitions, bool pause) {
+        if (partitions.empty()) {
+            return;
+        }
+
+        const auto list = std::unique_ptr<rd_kafka_topic_partition_list_t, detail::partition_del>(
+            rd_kafka_topic_partition_list_new(static_cast<int>(partitions.size()))
+        );
+
+        for (const auto& tp : partitions) {
+            rd_kafka_topic_partition_list_add(list.get(), std::string{ tp.topic }.c_str(), tp.partition);
+        }
+
+        pause_resume(list.get(), pause);
+    }
+
+    void pause_resume(rd_kafka_topic_partition_list_t* partitions, bool pause) {
+        if (partitions->cnt == 0) {
+            return;
+        }
+
+        const auto err = pause
+            ? rd_kafka_pause_partitions(m_consumer.get(), partitions)
+            : rd_kafka_resume_partitions(m_consumer.get(), partitions);
+
+        if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            nova::topic_log::warn("kafka", "Cannot {} partitions: {}", pause ? "pause" : "resume", rd_kafka_err2str(err));
+        }
+    }
+
 };
 
 } // namespace dsp::kf
@@ -984,7 +2389,15 @@ public:
         }
 
         if (m_format_spec.find('h') != std::string_view::npos) {
-            fmt::format_to(ctx.out(), "headers={}", msg.headers());
+            fmt::format_to(ctx.out(), "headers={{");
+
+            auto separator = std::string_view{ "" };
+            for (const auto& [name, value] : msg.headers()) {
+                fmt::format_to(ctx.out(), "{}\"{}\": {}", separator, name, value);
+                separator = ", ";
+            }
+
+            fmt::format_to(ctx.out(), "}}");
         }
 
         return ctx.out();
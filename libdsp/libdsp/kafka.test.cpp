@@ -0,0 +1,170 @@
+#include <libdsp/kafka.hpp>
+
+#include <gmock/gmock.h>
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using namespace testing;
+
+namespace {
+
+using offsets_t = std::vector<std::pair<std::int32_t, std::int64_t>>;
+
+/**
+ * @brief   Topic handle, only compared by the tracker.
+ */
+int topic_handle = 0;
+const auto* const Topic = reinterpret_cast<const rd_kafka_topic_t*>(&topic_handle);
+
+struct list_del {
+    void operator()(rd_kafka_topic_partition_list_t* list) const {
+        rd_kafka_topic_partition_list_destroy(list);
+    }
+};
+
+auto partitions(std::initializer_list<std::int32_t> xs) -> dsp::kf::partition_list {
+    auto ret = dsp::kf::partition_list{ };
+    for (const auto x : xs) {
+        ret.push_back({ "topic", x, RD_KAFKA_OFFSET_INVALID });
+    }
+    return ret;
+}
+
+auto track(dsp::kf::offset_tracker& tracker, std::int64_t offset, std::int32_t partition = 0) -> dsp::delivery_token* {
+    return tracker.track(Topic, "topic", partition, offset);
+}
+
+template <typename F>
+auto offsets(F&& f) -> offsets_t {
+    const auto list = std::unique_ptr<rd_kafka_topic_partition_list_t, list_del>(rd_kafka_topic_partition_list_new(1));
+    f(list.get());
+
+    auto ret = offsets_t{ };
+    for (int i = 0; i < list->cnt; ++i) {
+        ret.emplace_back(list->elems[i].partition, list->elems[i].offset);
+    }
+    return ret;
+}
+
+auto collect(dsp::kf::offset_tracker& tracker) -> offsets_t {
+    return offsets([&](auto* list) { tracker.collect(list); });
+}
+
+auto rewind(dsp::kf::offset_tracker& tracker) -> offsets_t {
+    return offsets([&](auto* list) { (void)tracker.rewind(list); });
+}
+
+} // namespace
+
+TEST(Dsp, OffsetTracker_InOrder) {
+    auto tracker = dsp::kf::offset_tracker{ };
+    tracker.assign(partitions({ 0, 1 }));
+
+    auto* a = track(tracker, 10);
+    auto* b = track(tracker, 11);
+    auto* c = track(tracker, 5, 1);
+    ASSERT_THAT((std::vector{ a, b, c }), Each(NotNull()));
+    EXPECT_EQ(tracker.in_flight(), 3);
+
+    a->release();
+    b->release();
+    EXPECT_THAT(collect(tracker), ElementsAre(Pair(0, 12)));
+    EXPECT_THAT(collect(tracker), IsEmpty());
+
+    c->release();
+    EXPECT_THAT(collect(tracker), ElementsAre(Pair(1, 6)));
+    EXPECT_EQ(tracker.completed(), 3);
+    EXPECT_EQ(tracker.in_flight(), 0);
+}
+
+TEST(Dsp, OffsetTracker_OutOfOrder) {
+    auto tracker = dsp::kf::offset_tracker{ };
+    tracker.assign(partitions({ 0 }));
+
+    auto* a = track(tracker, 10);
+    auto* b = track(tracker, 11);
+
+    // A derived message still in flight holds the offset back.
+    b->acquire();
+    b->release();
+    b->release();
+    EXPECT_THAT(collect(tracker), IsEmpty());
+
+    a->release();
+    EXPECT_THAT(collect(tracker), ElementsAre(Pair(0, 12)));
+}
+
+TEST(Dsp, OffsetTracker_Failure) {
+    auto tracker = dsp::kf::offset_tracker{ };
+    tracker.assign(partitions({ 0 }));
+
+    auto* a = track(tracker, 10);
+    auto* b = track(tracker, 11);
+    auto* c = track(tracker, 12);
+    b->fail();
+    a->release();
+    b->release();
+    c->release();
+
+    // The offset stops before the failed message, until it is rewound.
+    EXPECT_THAT(collect(tracker), ElementsAre(Pair(0, 11)));
+    EXPECT_EQ(track(tracker, 13), nullptr);
+    EXPECT_THAT(rewind(tracker), ElementsAre(Pair(0, 11)));
+    EXPECT_THAT(rewind(tracker), IsEmpty());
+    EXPECT_EQ(tracker.in_flight(), 0);
+
+    // Consumed again from the failed message.
+    auto* retry = track(tracker, 11);
+    ASSERT_NE(retry, nullptr);
+    retry->release();
+    EXPECT_THAT(collect(tracker), ElementsAre(Pair(0, 12)));
+}
+
+TEST(Dsp, OffsetTracker_GiveUp) {
+    auto tracker = dsp::kf::offset_tracker{ };
+    tracker.assign(partitions({ 0 }));
+
+    for (std::size_t i = 0; i < dsp::kf::offset_tracker::MaxRewinds; ++i) {
+        auto* x = track(tracker, 10);
+        ASSERT_NE(x, nullptr);
+        x->fail();
+        x->release();
+        EXPECT_THAT(rewind(tracker), ElementsAre(Pair(0, 10)));
+    }
+
+    // Failing again, the message is skipped.
+    auto* x = track(tracker, 10);
+    auto* y = track(tracker, 11);
+    x->fail();
+    x->release();
+    y->release();
+    EXPECT_THAT(rewind(tracker), IsEmpty());
+    EXPECT_THAT(collect(tracker), ElementsAre(Pair(0, 12)));
+}
+
+TEST(Dsp, OffsetTracker_Revoke) {
+    auto tracker = dsp::kf::offset_tracker{ };
+    EXPECT_EQ(track(tracker, 10), nullptr);
+
+    tracker.assign(partitions({ 0 }));
+    auto* a = track(tracker, 10);
+    ASSERT_NE(a, nullptr);
+
+    tracker.revoke(partitions({ 0 }));
+    EXPECT_EQ(track(tracker, 11), nullptr);
+    EXPECT_EQ(tracker.in_flight(), 1);
+
+    // Completed after the revoke, not committed.
+    a->release();
+    EXPECT_EQ(tracker.in_flight(), 0);
+    EXPECT_THAT(collect(tracker), IsEmpty());
+
+    tracker.assign(partitions({ 0 }));
+    auto* b = track(tracker, 20);
+    ASSERT_NE(b, nullptr);
+    b->release();
+    EXPECT_THAT(collect(tracker), ElementsAre(Pair(0, 21)));
+}
@@ -0,0 +1,181 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Matchers
+ *
+ * String and numeric matchers used by routing rules, compiled once when the
+ * rules are loaded.
+ */
+
+#pragma once
+
+#include <libnova/error.hpp>
+
+#include <re2/re2.h>
+#include <re2/set.h>
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * @brief   How a value is compared.
+ *
+ * - exact: equal to the value,
+ * - prefix: starts with the value,
+ * - glob: matches the glob (`*`, `?`, `[...]`),
+ * - regex: contains a match of the regular expression (RE2 syntax),
+ * - range: a number within [min, max].
+ */
+enum class match_type : std::uint8_t {
+    exact,
+    prefix,
+    glob,
+    regex,
+    range,
+};
+
+/**
+ * @brief   Translate a glob into an anchored regular expression.
+ *
+ * `*` matches any sequence, `?` any character, `[...]` and `[!...]` a
+ * character class; everything else is literal.
+ */
+[[nodiscard]] inline auto glob_to_regex(std::string_view glob) -> std::string {
+    auto ret = std::string{ "^" };
+
+    for (std::size_t i = 0; i < glob.size(); ++i) {
+        const auto c = glob[i];
+        if (c == '*') {
+            ret += ".*";
+        } else if (c == '?') {
+            ret += '.';
+        } else if (c == '[' and glob.find(']', i + 1) != std::string_view::npos) {
+            const auto end = glob.find(']', i + 1);
+            ret += '[';
+            auto cls = glob.substr(i + 1, end - i - 1);
+            if (cls.starts_with('!')) {
+                ret += '^';
+                cls.remove_prefix(1);
+            }
+            for (const auto x : cls) {
+                ret += (x == '\\' or x == '[' or x == '^') ? std::string{ '\\', x } : std::string{ x };
+            }
+            ret += ']';
+            i = end;
+        } else {
+            ret += RE2::QuoteMeta(std::string{ c });
+        }
+    }
+
+    return ret + "$";
+}
+
+/**
+ * @brief   Anchored regular expression matching the values starting with `prefix`.
+ */
+[[nodiscard]] inline auto prefix_to_regex(std::string_view prefix) -> std::string {
+    return "^" + RE2::QuoteMeta(std::string{ prefix });
+}
+
+/**
+ * @brief   A set of regular expressions matched in a single pass.
+ *
+ * Patterns are combined into one automaton (RE2::Set), a value is scanned
+ * once whatever the number of patterns, and all the matching patterns are
+ * reported. Patterns are not anchored unless they say so.
+ */
+class pattern_set {
+public:
+    pattern_set()
+        : m_set(std::make_unique<RE2::Set>(options(), RE2::UNANCHORED))
+    {}
+
+    /**
+     * @returns index of the pattern, reported by `match()`.
+     * @throws  nova::exception if the pattern is invalid.
+     */
+    auto add(std::string_view pattern) -> int {
+        auto error = std::string{ };
+        const auto index = m_set->Add(pattern, &error);
+        if (index < 0) {
+            throw nova::exception("Invalid regular expression '{}': {}", pattern, error);
+        }
+        ++m_size;
+        return index;
+    }
+
+    /**
+     * @brief   Build the automaton, no patterns can be added afterwards.
+     */
+    void compile() {
+        if (not m_set->Compile()) {
+            throw nova::exception("Cannot compile regular expressions, out of memory");
+        }
+        m_compiled = true;
+    }
+
+    /**
+     * @brief   Indices of the patterns matching `text` into `hits`, in no particular order.
+     *
+     * `hits` is meant to be reused, so matching does not allocate once it grew.
+     */
+    void match(std::string_view text, std::vector<int>& hits) const {
+        hits.clear();
+        if (m_compiled and m_size > 0) {
+            m_set->Match(text, &hits);
+        }
+    }
+
+    [[nodiscard]] auto size()  const -> std::size_t { return m_size; }
+    [[nodiscard]] auto empty() const -> bool        { return m_size == 0; }
+
+private:
+    std::unique_ptr<RE2::Set> m_set;
+    std::size_t m_size { 0 };
+    bool m_compiled { false };
+
+    /**
+     * @brief   Errors are reported by `add()`, not logged by RE2.
+     */
+    [[nodiscard]] static auto options() -> RE2::Options {
+        auto ret = RE2::Options{ };
+        ret.set_log_errors(false);
+        return ret;
+    }
+
+};
+
+/**
+ * @brief   Inclusive numeric range.
+ */
+struct range_matcher {
+    double min;
+    double max;
+
+    /**
+     * @returns false if the value is not a number.
+     */
+    [[nodiscard]] auto operator()(std::optional<double> value) const -> bool {
+        return value.has_value() and min <= *value and *value <= max;
+    }
+
+    [[nodiscard]] static auto parse(std::string_view text) -> std::optional<double> {
+        double value = 0;
+        const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (ec != std::errc{ } or ptr != text.data() + text.size()) {
+            return std::nullopt;
+        }
+        return value;
+    }
+};
+
+} // namespace dsp
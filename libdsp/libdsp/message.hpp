@@ -0,0 +1,475 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Message
+ *
+ * The message passed from southbound handlers to northbound interfaces. It is
+ * built on the hot path for every consumed record, therefore constructing and
+ * copying it does not allocate in the common case:
+ * - key and properties are stored inline, up to a limit,
+ * - subjects are interned once and referred to by pointer,
+ * - payload is borrowed from the source or shared by reference counting.
+ */
+
+#pragma once
+
+#include <libnova/data.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+
+namespace dsp {
+
+/**
+ * @brief   A vector of trivially copyable elements, stored inline up to N.
+ *
+ * Grows into a heap buffer beyond N elements; it is kept on clear().
+ */
+template <typename T, std::size_t N>
+class small_vector {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    using value_type        = T;
+    using size_type         = std::size_t;
+    using iterator          = T*;
+    using const_iterator    = const T*;
+
+    small_vector() = default;
+
+    small_vector(const T* data, std::size_t size) {
+        append(data, size);
+    }
+
+    small_vector(const small_vector& other) {
+        append(other.data(), other.size());
+    }
+
+    small_vector(small_vector&& other) noexcept {
+        steal(other);
+    }
+
+    small_vector& operator=(const small_vector& other) {
+        if (this != &other) {
+            m_size = 0;
+            append(other.data(), other.size());
+        }
+        return *this;
+    }
+
+    small_vector& operator=(small_vector&& other) noexcept {
+        if (this != &other) {
+            steal(other);
+        }
+        return *this;
+    }
+
+    ~small_vector() = default;
+
+    [[nodiscard]] auto data()           -> T*          { return m_heap != nullptr ? m_heap.get() : m_inline; }
+    [[nodiscard]] auto data()     const -> const T*    { return m_heap != nullptr ? m_heap.get() : m_inline; }
+    [[nodiscard]] auto size()     const -> std::size_t { return m_size; }
+    [[nodiscard]] auto capacity() const -> std::size_t { return m_capacity; }
+    [[nodiscard]] auto empty()    const -> bool        { return m_size == 0; }
+
+    /**
+     * @brief   Return true if the elements are stored inline.
+     */
+    [[nodiscard]] auto is_inline() const -> bool { return m_heap == nullptr; }
+
+    [[nodiscard]] auto begin()       -> T*       { return data(); }
+    [[nodiscard]] auto end()         -> T*       { return data() + m_size; }
+    [[nodiscard]] auto begin() const -> const T* { return data(); }
+    [[nodiscard]] auto end()   const -> const T* { return data() + m_size; }
+
+    [[nodiscard]] auto operator[](std::size_t i)       -> T&       { return data()[i]; }
+    [[nodiscard]] auto operator[](std::size_t i) const -> const T& { return data()[i]; }
+
+    void push_back(const T& value) {
+        reserve(m_size + 1);
+        data()[m_size++] = value;
+    }
+
+    void append(const T* values, std::size_t n) {
+        if (n == 0) {
+            return;
+        }
+        reserve(m_size + n);
+        std::memcpy(data() + m_size, values, n * sizeof(T));
+        m_size += n;
+    }
+
+    void clear() {
+        m_size = 0;
+    }
+
+    void reserve(std::size_t n) {
+        if (n <= m_capacity) {
+            return;
+        }
+
+        const auto capacity = std::max(n, 2 * m_capacity);
+        auto heap = std::make_unique_for_overwrite<T[]>(capacity);
+        if (m_size > 0) {
+            std::memcpy(heap.get(), data(), m_size * sizeof(T));
+        }
+
+        m_heap = std::move(heap);
+        m_capacity = capacity;
+    }
+
+private:
+    std::unique_ptr<T[]> m_heap;
+    std::size_t m_size { 0 };
+    std::size_t m_capacity { N };
+    T m_inline[N];
+
+    void steal(small_vector& other) {
+        if (other.m_heap != nullptr) {
+            m_heap = std::move(other.m_heap);
+            m_capacity = other.m_capacity;
+        } else {
+            m_heap.reset();
+            m_capacity = N;
+            if (other.m_size > 0) {
+                std::memcpy(m_inline, other.m_inline, other.m_size * sizeof(T));
+            }
+        }
+
+        m_size = other.m_size;
+        other.m_size = 0;
+        other.m_capacity = N;
+    }
+
+};
+
+/**
+ * @brief   Message key, stored inline up to 32 bytes.
+ */
+class message_key : public small_vector<std::byte, 32> {
+public:
+    message_key() = default;
+
+    message_key(nova::data_view data)
+        : small_vector(data.ptr(), data.size())
+    {}
+
+    [[nodiscard]] auto view() const -> nova::data_view {
+        return { data(), size() };
+    }
+
+};
+
+/**
+ * @brief   Reference to an interned subject.
+ *
+ * Subjects are drawn from a small set (topics, routing rules), therefore
+ * they are interned into a process-wide table once and never freed. Copying
+ * and comparing references is a pointer operation.
+ *
+ * Interning takes a lock, it should be done at configuration time (e.g.
+ * routing rules hold their subjects already interned), not per message.
+ */
+class subject_ref {
+public:
+
+    /**
+     * @brief   Empty subject.
+     */
+    subject_ref()
+        : m_value(&empty_value())
+    {}
+
+    explicit subject_ref(std::string_view value)
+        : m_value(intern(value))
+    {}
+
+    [[nodiscard]] auto str()   const -> const std::string& { return *m_value; }
+    [[nodiscard]] auto view()  const -> std::string_view   { return *m_value; }
+    [[nodiscard]] auto data()  const -> const char*        { return m_value->data(); }
+    [[nodiscard]] auto size()  const -> std::size_t        { return m_value->size(); }
+    [[nodiscard]] auto empty() const -> bool               { return m_value->empty(); }
+
+    friend auto operator==(subject_ref lhs, subject_ref rhs) -> bool {
+        return lhs.m_value == rhs.m_value;
+    }
+
+    friend auto operator==(subject_ref lhs, std::string_view rhs) -> bool {
+        return lhs.view() == rhs;
+    }
+
+private:
+    const std::string* m_value;
+
+    struct table_t {
+        struct hash {
+            using is_transparent = void;
+            auto operator()(std::string_view s) const -> std::size_t { return std::hash<std::string_view>{ }(s); }
+        };
+
+        std::shared_mutex lock;
+        std::unordered_set<std::string, hash, std::equal_to<>> values;
+    };
+
+    [[nodiscard]] static auto empty_value() -> const std::string& {
+        static const auto value = std::string{ };
+        return value;
+    }
+
+    [[nodiscard]] static auto intern(std::string_view value) -> const std::string* {
+        if (value.empty()) {
+            return &empty_value();
+        }
+
+        static auto table = table_t{ };
+
+        {
+            const auto guard = std::shared_lock{ table.lock };
+            if (const auto it = table.values.find(value); it != std::end(table.values)) {
+                return &*it;
+            }
+        }
+
+        const auto guard = std::unique_lock{ table.lock };
+        return &*table.values.emplace(value).first;
+    }
+
+};
+
+/**
+ * @brief   Message properties, a flat list of key-value pairs.
+ *
+ * Keys and values are copied into an arena owned by the message, entries
+ * refer to them by offset, therefore the list is copied without rebasing.
+ * Both are inline up to a limit (4 properties, 128 bytes of text); larger
+ * lists spill to the heap.
+ *
+ * Lookup is linear, the lists are expected to be short. Insertion order is
+ * kept.
+ */
+class property_list {
+    struct entry {
+        std::uint32_t key_offset;
+        std::uint32_t key_size;
+        std::uint32_t value_offset;
+        std::uint32_t value_size;
+    };
+
+public:
+    using value_type = std::pair<std::string_view, std::string_view>;
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type   = std::ptrdiff_t;
+        using value_type        = property_list::value_type;
+        using pointer           = void;
+        using reference         = value_type;
+
+        iterator() = default;
+
+        iterator(const property_list* list, std::size_t index)
+            : m_list(list)
+            , m_index(index)
+        {}
+
+        auto operator*() const -> value_type {
+            return m_list->at(m_index);
+        }
+
+        auto operator++() -> iterator& {
+            ++m_index;
+            return *this;
+        }
+
+        auto operator++(int) -> iterator {
+            auto tmp = *this;
+            ++m_index;
+            return tmp;
+        }
+
+        friend auto operator==(const iterator& lhs, const iterator& rhs) -> bool {
+            return lhs.m_index == rhs.m_index;
+        }
+
+    private:
+        const property_list* m_list { nullptr };
+        std::size_t m_index { 0 };
+
+    };
+
+    property_list() = default;
+
+    property_list(std::initializer_list<value_type> properties) {
+        for (const auto& [k, v] : properties) {
+            set(k, v);
+        }
+    }
+
+    /**
+     * @brief   Set a property, overwriting the value of an existing key.
+     *
+     * The previous value stays in the arena until the list is cleared.
+     */
+    void set(std::string_view key, std::string_view value) {
+        for (auto& e : m_entries) {
+            if (text(e.key_offset, e.key_size) == key) {
+                e.value_offset = store(value);
+                e.value_size = static_cast<std::uint32_t>(value.size());
+                return;
+            }
+        }
+
+        const auto key_offset = store(key);
+        const auto value_offset = store(value);
+        m_entries.push_back({
+            key_offset, static_cast<std::uint32_t>(key.size()),
+            value_offset, static_cast<std::uint32_t>(value.size())
+        });
+    }
+
+    [[nodiscard]] auto find(std::string_view key) const -> std::optional<std::string_view> {
+        for (const auto& e : m_entries) {
+            if (text(e.key_offset, e.key_size) == key) {
+                return text(e.value_offset, e.value_size);
+            }
+        }
+        return std::nullopt;
+    }
+
+    [[nodiscard]] auto contains(std::string_view key) const -> bool {
+        return find(key).has_value();
+    }
+
+    [[nodiscard]] auto at(std::size_t i) const -> value_type {
+        const auto& e = m_entries[i];
+        return { text(e.key_offset, e.key_size), text(e.value_offset, e.value_size) };
+    }
+
+    [[nodiscard]] auto size()  const -> std::size_t { return m_entries.size(); }
+    [[nodiscard]] auto empty() const -> bool        { return m_entries.empty(); }
+
+    [[nodiscard]] auto begin() const -> iterator { return { this, 0 }; }
+    [[nodiscard]] auto end()   const -> iterator { return { this, m_entries.size() }; }
+
+    /**
+     * @brief   Remove all properties, keeping the storage.
+     */
+    void clear() {
+        m_entries.clear();
+        m_arena.clear();
+    }
+
+private:
+    small_vector<entry, 4> m_entries;
+    small_vector<char, 128> m_arena;
+
+    [[nodiscard]] auto store(std::string_view s) -> std::uint32_t {
+        const auto offset = static_cast<std::uint32_t>(m_arena.size());
+        m_arena.append(s.data(), s.size());
+        return offset;
+    }
+
+    [[nodiscard]] auto text(std::uint32_t offset, std::uint32_t size) const -> std::string_view {
+        return { m_arena.data() + offset, size };
+    }
+
+};
+
+/**
+ * @brief   Message payload, either borrowed or shared.
+ *
+ * A borrowed payload refers to memory owned by the source (e.g. a socket
+ * buffer or a consumed record), it is valid only while the message is being
+ * processed synchronously. Components keeping the message longer must take
+ * an owning copy via `owned()`.
+ *
+ * A shared payload is reference counted, copies of the message share it.
+ */
+class payload_buffer {
+public:
+    payload_buffer() = default;
+
+    [[nodiscard]] static auto borrow(nova::data_view data) -> payload_buffer {
+        auto ret = payload_buffer{ };
+        ret.m_view = data;
+        return ret;
+    }
+
+    [[nodiscard]] static auto share(nova::bytes data) -> payload_buffer {
+        auto ret = payload_buffer{ };
+        ret.m_owner = std::make_shared<const nova::bytes>(std::move(data));
+        ret.m_view = nova::data_view{ ret.m_owner->data(), ret.m_owner->size() };
+        return ret;
+    }
+
+    [[nodiscard]] static auto copy(nova::data_view data) -> payload_buffer {
+        return share(data.to_vec());
+    }
+
+    /**
+     * @brief   Copy into scratch memory, the result is borrowed from the arena.
+     */
+    [[nodiscard]] static auto copy(nova::data_view data, std::pmr::memory_resource& arena) -> payload_buffer {
+        if (data.size() == 0) {
+            return { };
+        }
+
+        auto* ptr = arena.allocate(data.size(), 1);
+        std::memcpy(ptr, data.ptr(), data.size());
+        return borrow({ ptr, data.size() });
+    }
+
+    [[nodiscard]] auto view()     const -> nova::data_view   { return m_view; }
+    [[nodiscard]] auto data()     const -> const std::byte*  { return m_view.ptr(); }
+    [[nodiscard]] auto size()     const -> std::size_t       { return m_view.size(); }
+    [[nodiscard]] auto empty()    const -> bool              { return m_view.size() == 0; }
+    [[nodiscard]] auto borrowed() const -> bool              { return m_owner == nullptr and m_view.size() > 0; }
+
+    /**
+     * @brief   Return a payload that owns its data, copying a borrowed one.
+     */
+    [[nodiscard]] auto owned() const -> payload_buffer {
+        return borrowed() ? copy(m_view) : *this;
+    }
+
+private:
+    std::shared_ptr<const nova::bytes> m_owner;
+    nova::data_view m_view;
+
+};
+
+// tag::message[]
+struct message {
+    message_key key;
+    subject_ref subject;
+    property_list properties;
+    payload_buffer payload;
+
+    /**
+     * @brief   Return a copy that does not borrow memory of the source.
+     */
+    [[nodiscard]] auto owned() const -> message {
+        auto ret = *this;
+        ret.payload = payload.owned();
+        return ret;
+    }
+};
+// end::message[]
+
+} // namespace dsp
@@ -0,0 +1,82 @@
+#include <libdsp/message.hpp>
+
+#include <gmock/gmock.h>
+
+#include <string>
+#include <utility>
+
+using namespace testing;
+
+TEST(Dsp, SmallVector_Inline) {
+    auto xs = dsp::small_vector<int, 4>{ };
+    for (int i = 0; i < 4; ++i) {
+        xs.push_back(i);
+    }
+
+    EXPECT_TRUE(xs.is_inline());
+    EXPECT_THAT(xs, ElementsAre(0, 1, 2, 3));
+
+    const auto copy = xs;
+    EXPECT_TRUE(copy.is_inline());
+    EXPECT_THAT(copy, ElementsAre(0, 1, 2, 3));
+}
+
+TEST(Dsp, SmallVector_Grow) {
+    auto xs = dsp::small_vector<int, 2>{ };
+    for (int i = 0; i < 5; ++i) {
+        xs.push_back(i);
+    }
+
+    EXPECT_FALSE(xs.is_inline());
+    EXPECT_THAT(xs, ElementsAre(0, 1, 2, 3, 4));
+
+    const auto moved = std::move(xs);
+    EXPECT_THAT(moved, ElementsAre(0, 1, 2, 3, 4));
+    EXPECT_TRUE(xs.empty());
+}
+
+TEST(Dsp, Subject_Interned) {
+    const auto a = dsp::subject_ref{ "heartbeats" };
+    const auto b = dsp::subject_ref{ std::string{ "heartbeats" } };
+
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(a.data(), b.data());
+    EXPECT_EQ(a, "heartbeats");
+    EXPECT_TRUE(dsp::subject_ref{ }.empty());
+}
+
+TEST(Dsp, Properties_SetFind) {
+    auto props = dsp::property_list{ { "type", "heartbeat" } };
+    props.set("source", "tcp");
+    props.set("type", "telemetry");
+
+    EXPECT_EQ(props.size(), 2);
+    EXPECT_EQ(props.find("type"), "telemetry");
+    EXPECT_EQ(props.find("source"), "tcp");
+    EXPECT_FALSE(props.find("missing").has_value());
+
+    // Copies do not refer to the storage of the source.
+    const auto copy = props;
+    props.clear();
+    EXPECT_EQ(copy.find("type"), "telemetry");
+    EXPECT_THAT(copy, ElementsAre(Pair("type", "telemetry"), Pair("source", "tcp")));
+}
+
+TEST(Dsp, Payload_Owned) {
+    auto text = std::string{ "payload" };
+    const auto msg = dsp::message{
+        .key = nova::data_view{ "key" },
+        .subject = { },
+        .properties = { },
+        .payload = dsp::payload_buffer::borrow(nova::data_view{ text })
+    };
+
+    EXPECT_TRUE(msg.payload.borrowed());
+
+    const auto owned = msg.owned();
+    text.assign("changed");
+
+    EXPECT_FALSE(owned.payload.borrowed());
+    EXPECT_EQ(owned.payload.view().as_string(), "payload");
+    EXPECT_EQ(owned.key.view().as_string(), "key");
+}
@@ -16,23 +16,34 @@
 
 #include <prometheus/counter.h>
 #include <prometheus/family.h>
+#include <prometheus/histogram.h>
 #include <prometheus/registry.h>
 
 #include <functional>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <vector>
 
 namespace dsp {
 
+/**
+ * @brief   Metric families by name, created at their first use.
+ *
+ * It is thread-safe: the families are looked up under a shared lock (and
+ * created under an exclusive one), Prometheus metrics synchronize their
+ * own updates.
+ */
 class metrics_registry {
     using counter_t = prometheus::Family<prometheus::Counter>;
     using gauge_t = prometheus::Family<prometheus::Gauge>;
+    using histogram_t = prometheus::Family<prometheus::Histogram>;
 
 public:
     auto increment(const std::string& name, nova::arithmetic auto value, const prometheus::Labels& labels = {}) {
         DSP_PROFILING_ZONE("metrics");
-        // TODO(safety): thread-safety
         auto& family = add_counter(name);
 
         // TODO(perf): Add labels only once (do not call it if no labels).
@@ -42,7 +53,6 @@ public:
 
     auto set(const std::string& name, nova::arithmetic auto value, const prometheus::Labels& labels = {}) {
         DSP_PROFILING_ZONE("metrics");
-        // TODO(safety): thread-safety
         auto& family = add_gauge(name);
 
         // TODO(perf): Add labels only once (do not call it if no labels).
@@ -50,6 +60,46 @@ public:
         x.Set(static_cast<double>(value));
     }
 
+    /**
+     * @brief   Observe a value in a histogram.
+     *
+     * The bucket boundaries are given when the labelled histogram is created,
+     * later calls must pass the same ones.
+     */
+    auto observe(const std::string& name, const prometheus::Histogram::BucketBoundaries& buckets, nova::arithmetic auto value, const prometheus::Labels& labels = {}) {
+        DSP_PROFILING_ZONE("metrics");
+        auto& family = add_histogram(name);
+        family.Add(labels, buckets).Observe(static_cast<double>(value));
+    }
+
+    /**
+     * @brief   Add observations aggregated elsewhere, e.g. in thread-local counters.
+     *
+     * @param   increments Number of new observations per bucket, including the last (+Inf) bucket.
+     * @param   sum Sum of the new observations.
+     */
+    void observe_multiple(const std::string& name, const prometheus::Histogram::BucketBoundaries& buckets, const std::vector<double>& increments, double sum, const prometheus::Labels& labels = {}) {
+        DSP_PROFILING_ZONE("metrics");
+        auto& family = add_histogram(name);
+        family.Add(labels, buckets).ObserveMultiple(increments, sum);
+    }
+
+    /**
+     * @brief   Remove a labelled gauge, e.g. of a partition which is not assigned anymore.
+     */
+    void remove_gauge(const std::string& name, const prometheus::Labels& labels) {
+        const auto lock = std::shared_lock{ m_mutex };
+        const auto it = m_gauges.find(name);
+        if (it == std::end(m_gauges)) {
+            return;
+        }
+
+        auto& family = it->second.get();
+        if (family.Has(labels)) {
+            family.Remove(&family.Add(labels));
+        }
+    }
+
     /**
      * @brief   For binding with Prometheus Exposer.
      */
@@ -59,40 +109,64 @@ public:
 
 private:
     std::shared_ptr<prometheus::Registry> m_registry = std::make_shared<prometheus::Registry>();
+    mutable std::shared_mutex m_mutex;
 
     std::unordered_map<std::string, std::reference_wrapper<counter_t>> m_counters;
     std::unordered_map<std::string, std::reference_wrapper<gauge_t>> m_gauges;
+    std::unordered_map<std::string, std::reference_wrapper<histogram_t>> m_histograms;
 
     auto add_counter(const std::string& name) -> counter_t& {
-        const auto it = m_counters.find(name);
-        if (it != std::end(m_counters)) {
-            return it->second;
-        }
+        return find_or_add(m_counters, name, [&]() -> counter_t& {
+            return prometheus::BuildCounter()
+                .Name(name)
+                // .Labels(metric.labels())
+                // .Help("")
+                .Register(*m_registry);
+        });
+    }
 
-        auto& counter = prometheus::BuildCounter()
-            .Name(name)
-            // .Labels(metric.labels())
-            // .Help("")
-            .Register(*m_registry);
+    auto add_gauge(const std::string& name) -> gauge_t& {
+        return find_or_add(m_gauges, name, [&]() -> gauge_t& {
+            return prometheus::BuildGauge()
+                .Name(name)
+                // .Labels(metric.labels())
+                // .Help("")
+                .Register(*m_registry);
+        });
+    }
 
-        m_counters.emplace(name, std::ref(counter));
-        return counter;
+    auto add_histogram(const std::string& name) -> histogram_t& {
+        return find_or_add(m_histograms, name, [&]() -> histogram_t& {
+            return prometheus::BuildHistogram()
+                .Name(name)
+                .Register(*m_registry);
+        });
     }
 
-    auto add_gauge(const std::string& name) -> gauge_t& {
-        const auto it = m_gauges.find(name);
-        if (it != std::end(m_gauges)) {
-            return it->second;
+    /**
+     * @brief   Find a family, or build and register it if it does not exist yet.
+     */
+    template <typename Family, typename Build>
+    auto find_or_add(
+            std::unordered_map<std::string, std::reference_wrapper<Family>>& families,
+            const std::string& name,
+            Build&& build) -> Family&
+    {
+        {
+            const auto lock = std::shared_lock{ m_mutex };
+            if (const auto it = families.find(name); it != std::end(families)) {
+                return it->second;
+            }
         }
 
-        auto& gauge = prometheus::BuildGauge()
-            .Name(name)
-            // .Labels(metric.labels())
-            // .Help("")
-            .Register(*m_registry);
+        const auto lock = std::unique_lock{ m_mutex };
+        if (const auto it = families.find(name); it != std::end(families)) {
+            return it->second;
+        }
 
-        m_gauges.emplace(name, std::ref(gauge));
-        return gauge;
+        auto& family = build();
+        families.emplace(name, std::ref(family));
+        return family;
     }
 };
 
@@ -0,0 +1,499 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Payload fields
+ *
+ * Values read from the payload of a message, so that routing rules can refer
+ * to its content without the handler copying it into properties:
+ * - `json:<key>[.<key>...]`: a scalar of a JSON object, e.g. `json:device.id`,
+ * - `bin:<offset>:<type>`: a fixed-size field of a binary payload, e.g.
+ *   `bin:8:u64` for the `dat::` formats.
+ */
+
+#pragma once
+
+#include <libdsp/message.hpp>
+
+#include <libnova/data.hpp>
+#include <libnova/error.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * @brief   Iterate over the structural characters of a JSON text.
+ *
+ * Structural characters are brackets, braces, colons, commas, quotes and
+ * backslashes. The text is classified 16 bytes at a time (SSE2 when
+ * available), then positions are taken from the bitmask, so the bytes of
+ * strings and numbers are never looked at one by one.
+ */
+class json_scanner {
+public:
+    static constexpr auto npos = std::string_view::npos;
+
+    explicit json_scanner(std::string_view text)
+        : m_text(text)
+    {}
+
+    [[nodiscard]] static constexpr auto is_structural(char c) -> bool {
+        return std::ranges::find(Structural, c) != Structural.end();
+    }
+
+    /**
+     * @returns position of the next structural character, `npos` at the end.
+     */
+    [[nodiscard]] auto next() -> std::size_t {
+        while (m_mask == 0) {
+            if (m_block >= m_text.size()) {
+                return npos;
+            }
+            m_base = m_block;
+            m_mask = classify(m_block);
+            m_block += BlockSize;
+        }
+
+        const auto ret = m_base + static_cast<std::size_t>(std::countr_zero(m_mask));
+        m_mask &= m_mask - 1;
+        return ret;
+    }
+
+private:
+    static constexpr std::size_t BlockSize = 16;
+    static constexpr std::array Structural { '{', '}', '[', ']', ':', ',', '"', '\\' };
+
+    std::string_view m_text;
+    std::size_t m_block { 0 };
+    std::size_t m_base { 0 };
+    std::uint32_t m_mask { 0 };
+
+    /**
+     * @returns bitmask of the structural characters of the block at `pos`.
+     */
+    [[nodiscard]] auto classify(std::size_t pos) const -> std::uint32_t {
+#if defined(__SSE2__)
+        if (pos + BlockSize <= m_text.size()) {
+            const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_text.data() + pos));
+            auto any = _mm_setzero_si128();
+            for (const auto c : Structural) {
+                any = _mm_or_si128(any, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+            }
+            return static_cast<std::uint32_t>(_mm_movemask_epi8(any));
+        }
+#endif
+
+        std::uint32_t ret = 0;
+        const auto end = std::min(pos + BlockSize, m_text.size());
+        for (auto i = pos; i < end; ++i) {
+            if (is_structural(m_text[i])) {
+                ret |= std::uint32_t{ 1 } << (i - pos);
+            }
+        }
+        return ret;
+    }
+
+};
+
+/**
+ * @brief   Find the scalar value of a key in a JSON object.
+ *
+ * `path` is a list of keys separated by dots, each key but the last names a
+ * nested object, e.g. `device.id` in `{"device": {"id": 42}}`. Strings are
+ * returned without their quotes and escape sequences are not decoded; numbers,
+ * booleans and null are returned as written.
+ *
+ * The text is not validated: scanning stops as soon as the value is found.
+ *
+ * @returns the value, or nothing if the key is missing, its value is an
+ *          object or an array, or the text is malformed.
+ */
+[[nodiscard]] inline auto json_find(std::string_view text, std::string_view path) -> std::optional<std::string_view> {
+    // Objects nested deeper are not searched.
+    static constexpr std::size_t MaxDepth = 64;
+
+    const auto is_space = [](char c) { return c == ' ' or c == '\t' or c == '\n' or c == '\r'; };
+    const auto skip_space = [&](std::size_t pos) {
+        while (pos < text.size() and is_space(text[pos])) {
+            ++pos;
+        }
+        return pos;
+    };
+
+    auto scanner = json_scanner{ text };
+
+    // Position of the closing quote of the string being scanned.
+    const auto string_end = [&]() -> std::size_t {
+        for (auto pos = scanner.next(); pos != json_scanner::npos; pos = scanner.next()) {
+            if (text[pos] == '"') {
+                return pos;
+            }
+            if (text[pos] == '\\' and pos + 1 < text.size() and json_scanner::is_structural(text[pos + 1])) {
+                (void)scanner.next();
+            }
+        }
+        return json_scanner::npos;
+    };
+
+    const auto value_at = [&](std::size_t pos) -> std::optional<std::string_view> {
+        pos = skip_space(pos);
+        if (pos >= text.size() or text[pos] == '{' or text[pos] == '[') {
+            return std::nullopt;
+        }
+
+        if (text[pos] == '"') {
+            (void)scanner.next();
+            const auto end = string_end();
+            if (end == json_scanner::npos) {
+                return std::nullopt;
+            }
+            return text.substr(pos + 1, end - pos - 1);
+        }
+
+        auto end = std::min(scanner.next(), text.size());
+        while (end > pos and is_space(text[end - 1])) {
+            --end;
+        }
+        return text.substr(pos, end - pos);
+    };
+
+    auto key = path.substr(0, path.find('.'));
+    std::size_t matched = 0;
+    std::size_t depth = 0;
+    std::uint64_t objects = 0;
+    bool expect_key = false;
+
+    const auto in_object = [&]() { return depth > 0 and (objects >> (depth - 1) & 1) != 0; };
+
+    for (auto pos = scanner.next(); pos != json_scanner::npos; pos = scanner.next()) {
+        switch (text[pos]) {
+            case '{':
+            case '[':
+                if (++depth > MaxDepth) {
+                    return std::nullopt;
+                }
+                objects = text[pos] == '{' ? objects | std::uint64_t{ 1 } << (depth - 1) : objects & ~(std::uint64_t{ 1 } << (depth - 1));
+                expect_key = text[pos] == '{';
+                break;
+
+            case '}':
+            case ']':
+                // The object searched for the key is closed.
+                if (depth == 0 or depth == matched + 1) {
+                    return std::nullopt;
+                }
+                --depth;
+                expect_key = false;
+                break;
+
+            case ',':
+                expect_key = in_object();
+                break;
+
+            case ':':
+                expect_key = false;
+                break;
+
+            case '"': {
+                const auto end = string_end();
+                if (end == json_scanner::npos) {
+                    return std::nullopt;
+                }
+
+                if (not expect_key or depth != matched + 1) {
+                    break;
+                }
+
+                const auto colon = scanner.next();
+                if (colon == json_scanner::npos or text[colon] != ':') {
+                    return std::nullopt;
+                }
+                expect_key = false;
+
+                if (text.substr(pos + 1, end - pos - 1) != key) {
+                    break;
+                }
+
+                ++matched;
+                if (key.size() == path.size()) {
+                    return value_at(colon + 1);
+                }
+                if (const auto next = skip_space(colon + 1); next >= text.size() or text[next] != '{') {
+                    return std::nullopt;
+                }
+                path.remove_prefix(key.size() + 1);
+                key = path.substr(0, path.find('.'));
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    return std::nullopt;
+}
+
+/**
+ * @brief   A field of the payload, as referred to by rules.
+ */
+struct payload_field {
+    enum class format_type : std::uint8_t {
+        json,
+        binary,
+    };
+
+    /**
+     * @brief   Type of a binary field.
+     *
+     * Integers are little-endian unless suffixed with `be`, they are
+     * formatted in decimal; `str<size>` is a string of `size` bytes, without
+     * the trailing null bytes.
+     */
+    enum class binary_type : std::uint8_t {
+        u8, i8, u16, i16, u32, i32, u64, i64,
+        str,
+    };
+
+    static constexpr auto JsonPrefix = std::string_view{ "json:" };
+    static constexpr auto BinaryPrefix = std::string_view{ "bin:" };
+
+    /**
+     * @brief   Longest formatted integer.
+     */
+    static constexpr std::size_t NumberSize = 24;
+
+    using number_buffer = std::array<char, NumberSize>;
+
+    format_type format { format_type::json };
+    std::string path;
+    std::size_t offset { 0 };
+    std::size_t size { 0 };
+    binary_type type { binary_type::str };
+    bool big_endian { false };
+
+    [[nodiscard]] static auto is_payload(std::string_view name) -> bool {
+        return name.starts_with(JsonPrefix) or name.starts_with(BinaryPrefix);
+    }
+
+    /**
+     * @brief   Parse `json:<path>` or `bin:<offset>:<type>`.
+     *
+     * @throws  nova::exception if it is malformed.
+     */
+    [[nodiscard]] static auto parse(std::string_view name) -> payload_field {
+        auto ret = payload_field{ };
+
+        if (name.starts_with(JsonPrefix)) {
+            ret.path = name.substr(JsonPrefix.size());
+            if (ret.path.empty() or ret.path.starts_with('.') or ret.path.ends_with('.') or ret.path.contains("..")) {
+                throw nova::exception("Invalid JSON payload field '{}'", name);
+            }
+            return ret;
+        }
+
+        const auto spec = name.substr(BinaryPrefix.size());
+        const auto colon = spec.find(':');
+        const auto offset = spec.substr(0, colon);
+        auto type = colon == std::string_view::npos ? std::string_view{ } : spec.substr(colon + 1);
+
+        ret.format = format_type::binary;
+        if (not number(offset, ret.offset)) {
+            throw nova::exception("Invalid offset of binary payload field '{}'", name);
+        }
+
+        if (type.starts_with("str")) {
+            ret.type = binary_type::str;
+            if (not number(type.substr(3), ret.size) or ret.size == 0) {
+                throw nova::exception("Invalid size of binary payload field '{}'", name);
+            }
+            return ret;
+        }
+
+        if (type.ends_with("be")) {
+            ret.big_endian = true;
+            type.remove_suffix(2);
+        }
+
+        static constexpr auto Integers = std::array{
+            std::pair{ "u8", binary_type::u8 },     std::pair{ "i8", binary_type::i8 },
+            std::pair{ "u16", binary_type::u16 },   std::pair{ "i16", binary_type::i16 },
+            std::pair{ "u32", binary_type::u32 },   std::pair{ "i32", binary_type::i32 },
+            std::pair{ "u64", binary_type::u64 },   std::pair{ "i64", binary_type::i64 },
+        };
+        const auto it = std::ranges::find(Integers, type, [](const auto& x) { return std::string_view{ x.first }; });
+        if (it == Integers.end()) {
+            throw nova::exception("Invalid type of binary payload field '{}'", name);
+        }
+        ret.type = it->second;
+        ret.size = std::size_t{ 1 } << (static_cast<std::size_t>(ret.type) / 2);
+        return ret;
+    }
+
+    /**
+     * @brief   Read the field, integers are formatted into `buffer`.
+     *
+     * @returns nothing if the payload has no such field.
+     */
+    [[nodiscard]] auto extract(nova::data_view payload, number_buffer& buffer) const -> std::optional<std::string_view> {
+        if (format == format_type::json) {
+            return json_find(payload.as_string_view(), path);
+        }
+
+        if (offset > payload.size() or size > payload.size() - offset) {
+            return std::nullopt;
+        }
+
+        if (type == binary_type::str) {
+            auto ret = payload.as_string_view(offset, size);
+            return ret.substr(0, ret.find('\0'));
+        }
+
+        const auto* bytes = payload.ptr() + offset;
+        std::uint64_t raw = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            const auto byte = std::to_integer<std::uint64_t>(bytes[big_endian ? i : size - 1 - i]);
+            raw = raw << 8 | byte;
+        }
+
+        const auto is_signed = static_cast<std::size_t>(type) % 2 == 1;
+        const auto shift = 64 - static_cast<int>(size) * 8;
+        const auto result = is_signed
+            ? std::to_chars(buffer.data(), buffer.data() + buffer.size(), static_cast<std::int64_t>(raw << shift) >> shift)
+            : std::to_chars(buffer.data(), buffer.data() + buffer.size(), raw);
+        return std::string_view{ buffer.data(), static_cast<std::size_t>(result.ptr - buffer.data()) };
+    }
+
+private:
+    [[nodiscard]] static auto number(std::string_view text, std::size_t& value) -> bool {
+        const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return not text.empty() and ec == std::errc{ } and ptr == text.data() + text.size();
+    }
+
+};
+
+/**
+ * @brief   A field of a message: a property, or a payload field by id.
+ */
+struct field_ref {
+    std::string name;
+    std::optional<std::uint32_t> payload;
+};
+
+/**
+ * @brief   Payload fields referred to by a set of rules.
+ *
+ * Fields are stored once whichever rules refer to them, so each one is
+ * extracted at most once per message, see `field_values`.
+ */
+class payload_fields {
+public:
+    /**
+     * @throws  nova::exception if the name is a malformed payload field.
+     */
+    auto add(std::string_view name) -> field_ref {
+        if (not payload_field::is_payload(name)) {
+            return { std::string{ name }, std::nullopt };
+        }
+
+        const auto it = std::ranges::find(m_names, name);
+        if (it != m_names.end()) {
+            return { std::string{ name }, static_cast<std::uint32_t>(it - m_names.begin()) };
+        }
+
+        m_fields.push_back(payload_field::parse(name));
+        m_names.emplace_back(name);
+        return { std::string{ name }, static_cast<std::uint32_t>(m_fields.size() - 1) };
+    }
+
+    [[nodiscard]] auto operator[](std::uint32_t id) const -> const payload_field& { return m_fields[id]; }
+
+    [[nodiscard]] auto size()  const -> std::size_t { return m_fields.size(); }
+    [[nodiscard]] auto empty() const -> bool        { return m_fields.empty(); }
+
+private:
+    std::vector<payload_field> m_fields;
+    std::vector<std::string> m_names;
+
+};
+
+/**
+ * @brief   Values of the fields of one message.
+ *
+ * Payload fields are extracted lazily, at their first use, and at most once.
+ * Values are kept in memory of the calling thread: only one instance can be
+ * in use per thread, and it must not outlive the message.
+ */
+class field_values {
+public:
+    field_values(const payload_fields& fields, const message& msg)
+        : m_fields(fields)
+        , m_msg(msg)
+        , m_memo(memo_t::local())
+    {
+        if (m_fields.empty()) {
+            return;
+        }
+        if (++m_memo.generation == 0) {
+            std::ranges::fill(m_memo.stamps, 0);
+            m_memo.generation = 1;
+        }
+        if (m_memo.stamps.size() < m_fields.size()) {
+            m_memo.stamps.resize(m_fields.size(), 0);
+            m_memo.values.resize(m_fields.size());
+            m_memo.buffers.resize(m_fields.size());
+        }
+    }
+
+    field_values(const field_values&)             = delete;
+    field_values& operator=(const field_values&)  = delete;
+
+    [[nodiscard]] auto operator()(const field_ref& field) -> std::optional<std::string_view> {
+        if (not field.payload.has_value()) {
+            return m_msg.properties.find(field.name);
+        }
+        return payload(*field.payload);
+    }
+
+    [[nodiscard]] auto payload(std::uint32_t id) -> std::optional<std::string_view> {
+        if (m_memo.stamps[id] != m_memo.generation) {
+            m_memo.stamps[id] = m_memo.generation;
+            m_memo.values[id] = m_fields[id].extract(m_msg.payload.view(), m_memo.buffers[id]);
+        }
+        return m_memo.values[id];
+    }
+
+private:
+    struct memo_t {
+        std::vector<std::uint32_t> stamps;
+        std::vector<std::optional<std::string_view>> values;
+        std::vector<payload_field::number_buffer> buffers;
+        std::uint32_t generation { 0 };
+
+        [[nodiscard]] static auto local() -> memo_t& {
+            static thread_local auto instance = memo_t{ };
+            return instance;
+        }
+    };
+
+    const payload_fields& m_fields;
+    const dsp::message& m_msg;
+    memo_t& m_memo;
+
+};
+
+} // namespace dsp
@@ -0,0 +1,107 @@
+#include <libdsp/payload.hpp>
+
+#include <libnova/error.hpp>
+
+#include <gmock/gmock.h>
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+using namespace testing;
+
+namespace {
+
+auto view(std::string_view text) -> nova::data_view {
+    return { reinterpret_cast<const std::byte*>(text.data()), text.size() };
+}
+
+auto extract(std::string_view name, nova::data_view payload) -> std::optional<std::string> {
+    auto buffer = dsp::payload_field::number_buffer{ };
+    const auto ret = dsp::payload_field::parse(name).extract(payload, buffer);
+    return ret.has_value() ? std::optional{ std::string{ *ret } } : std::nullopt;
+}
+
+} // namespace
+
+TEST(Dsp, Json_Scanner) {
+    const auto text = std::string_view{ R"({"a": "x\"y", "bb": [1, 2], "long string without structurals": 3})" };
+    auto scanner = dsp::json_scanner{ text };
+
+    auto positions = std::string{ };
+    for (auto pos = scanner.next(); pos != dsp::json_scanner::npos; pos = scanner.next()) {
+        positions += text[pos];
+    }
+    EXPECT_EQ(positions, R"({"":"\"","":[,],"":})");
+}
+
+TEST(Dsp, Json_Find) {
+    const auto text = std::string_view{ R"( {"id": 42, "name": "a \"b\" {c}", "tags": ["x", {"id": 1}],
+        "device": { "model" : "x-1" , "ok": true, "empty": {} }, "n": null } )" };
+
+    EXPECT_EQ(dsp::json_find(text, "id"), "42");
+    EXPECT_EQ(dsp::json_find(text, "name"), R"(a \"b\" {c})");
+    EXPECT_EQ(dsp::json_find(text, "device.model"), "x-1");
+    EXPECT_EQ(dsp::json_find(text, "device.ok"), "true");
+    EXPECT_EQ(dsp::json_find(text, "n"), "null");
+
+    // Containers, keys of other objects, missing keys.
+    EXPECT_EQ(dsp::json_find(text, "tags"), std::nullopt);
+    EXPECT_EQ(dsp::json_find(text, "device"), std::nullopt);
+    EXPECT_EQ(dsp::json_find(text, "model"), std::nullopt);
+    EXPECT_EQ(dsp::json_find(text, "id.model"), std::nullopt);
+    EXPECT_EQ(dsp::json_find(text, "device.empty.x"), std::nullopt);
+    EXPECT_EQ(dsp::json_find(text, "missing"), std::nullopt);
+
+    EXPECT_EQ(dsp::json_find(R"({"a": "unterminated)", "a"), std::nullopt);
+    EXPECT_EQ(dsp::json_find("}{", "a"), std::nullopt);
+    EXPECT_EQ(dsp::json_find("", "a"), std::nullopt);
+}
+
+TEST(Dsp, Payload_Binary) {
+    const auto bytes = std::array<unsigned char, 12>{ 0x01, 0x02, 0xff, 0xfe, 'a', 'b', 'c', 0, 0, 0, 0, 0x80 };
+    const auto payload = nova::data_view{ reinterpret_cast<const std::byte*>(bytes.data()), bytes.size() };
+
+    EXPECT_EQ(extract("bin:0:u8", payload), "1");
+    EXPECT_EQ(extract("bin:0:u16", payload), "513");
+    EXPECT_EQ(extract("bin:0:u16be", payload), "258");
+    EXPECT_EQ(extract("bin:2:i16", payload), "-257");
+    EXPECT_EQ(extract("bin:2:u16", payload), "65279");
+    EXPECT_EQ(extract("bin:11:i8", payload), "-128");
+    EXPECT_EQ(extract("bin:4:u64be", payload), "7017280021047804032");
+    EXPECT_EQ(extract("bin:4:str8", payload), "abc");
+    EXPECT_EQ(extract("bin:8:u32", payload), "2147483648");
+    EXPECT_EQ(extract("bin:9:u32", payload), std::nullopt);
+    EXPECT_EQ(extract("bin:100:u8", payload), std::nullopt);
+
+    EXPECT_EQ(extract("json:a", view(R"({"a": 1})")), "1");
+
+    for (const auto* name : { "bin:", "bin:x:u8", "bin:0", "bin:0:u24", "bin:0:str0", "json:", "json:a..b" }) {
+        EXPECT_THROW(static_cast<void>(dsp::payload_field::parse(name)), nova::exception) << name;
+    }
+}
+
+TEST(Dsp, Payload_Lazy) {
+    auto fields = dsp::payload_fields{ };
+    const auto property = fields.add("type");
+    const auto a = fields.add("json:a");
+    const auto b = fields.add("json:b");
+    EXPECT_FALSE(property.payload.has_value());
+    EXPECT_EQ(fields.add("json:a").payload, a.payload);
+    EXPECT_EQ(fields.size(), 2);
+
+    const auto text = std::string{ R"({"a": "x", "b": 2})" };
+    auto msg = dsp::message{ };
+    msg.properties.set("type", "t");
+    msg.payload = dsp::payload_buffer::borrow(view(text));
+
+    auto values = dsp::field_values{ fields, msg };
+    EXPECT_EQ(values(property), "t");
+    EXPECT_EQ(values(a), "x");
+
+    // Values are not extracted again within the same message.
+    const auto first = values(b);
+    EXPECT_EQ(values(b)->data(), first->data());
+}
@@ -0,0 +1,486 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Staged pipeline
+ *
+ * Processing split into stages running on their own threads, connected by
+ * bounded queues, e.g.:
+ *
+ *  auto p = dsp::pipeline<dsp::message>::builder("ingest")
+ *      .transform("decode", { .workers = 4 }, [](dsp::message m) -> std::optional<dsp::message> { ... })
+ *      .sink("route", { }, [&](dsp::message m) { ... });
+ *
+ *  p.push(msg.owned());     // e.g. from a southbound handler
+ */
+
+#pragma once
+
+#include <libdsp/metrics.hpp>
+#include <libdsp/ring.hpp>
+
+#include <libnova/log.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * @brief   Parallelism and input queue of a stage.
+ */
+struct stage_cfg {
+    std::size_t workers { 1 };
+    std::size_t capacity { 1024 };
+};
+
+namespace detail {
+
+template <typename T>
+struct is_optional : std::false_type { };
+
+template <typename T>
+struct is_optional<std::optional<T>> : std::true_type { };
+
+/**
+ * @brief   Bounded queue between stages, closed by the upstream side when it is done.
+ */
+template <typename T>
+class channel {
+    /**
+     * @brief   Longest sleep of a waiting thread, waiters are woken up when the channel changes.
+     */
+    static constexpr auto WaitInterval = std::chrono::milliseconds{ 10 };
+
+public:
+    explicit channel(std::size_t capacity)
+        : m_ring(capacity)
+    {}
+
+    /**
+     * @brief   Push, waiting for room.
+     *
+     * @returns false if the channel is closed, the value is dropped then.
+     */
+    auto push(T&& value) -> bool {
+        while (closed() or not m_ring.try_push(std::move(value))) {
+            if (closed()) {
+                return false;
+            }
+            (void)m_not_full.wait_for([&]() { return m_ring.size() < m_ring.capacity() or closed(); }, WaitInterval);
+        }
+        m_not_empty.notify();
+        return true;
+    }
+
+    /**
+     * @returns false if the channel is full or closed.
+     */
+    [[nodiscard]] auto try_push(T&& value) -> bool {
+        if (closed() or not m_ring.try_push(std::move(value))) {
+            return false;
+        }
+        m_not_empty.notify();
+        return true;
+    }
+
+    /**
+     * @brief   Pop up to `out.size()` values, waiting for at least one.
+     *
+     * @returns 0 once the channel is closed and empty.
+     */
+    auto pop(std::span<T> out) -> std::size_t {
+        while (true) {
+            // Values pushed before closing are still delivered.
+            const auto was_closed = closed();
+            if (const auto n = m_ring.try_pop(out); n > 0) {
+                m_not_full.notify();
+                return n;
+            }
+            if (was_closed) {
+                return 0;
+            }
+            (void)m_not_empty.wait_for([&]() { return not m_ring.empty() or closed(); }, WaitInterval);
+        }
+    }
+
+    void close() {
+        m_closed.store(true);
+        m_not_empty.notify();
+        m_not_full.notify();
+    }
+
+    [[nodiscard]] auto closed()   const -> bool        { return m_closed.load(); }
+    [[nodiscard]] auto size()     const -> std::size_t { return m_ring.size(); }
+    [[nodiscard]] auto capacity() const -> std::size_t { return m_ring.capacity(); }
+
+private:
+    mpmc_ring<T> m_ring;
+    event_count m_not_empty;
+    event_count m_not_full;
+    std::atomic_bool m_closed { false };
+
+};
+
+/**
+ * @brief   A stage, whatever its types.
+ */
+class stage_base {
+public:
+    explicit stage_base(std::string name, std::size_t workers)
+        : m_name(std::move(name))
+        , m_stats(workers)
+        , m_running(workers)
+    {}
+
+    stage_base(const stage_base&)             = delete;
+    stage_base& operator=(const stage_base&)  = delete;
+
+    virtual ~stage_base() = default;
+
+    virtual void start() = 0;
+
+    /**
+     * @brief   Wait until the workers are done, after the input was closed.
+     */
+    void join() {
+        m_threads.clear();
+    }
+
+    /**
+     * @brief   Export the increments since the previous call, it must be called by one thread.
+     */
+    void update(metrics_registry& metrics, const std::string& pipeline) {
+        auto current = totals_t{ };
+        for (const auto& s : m_stats) {
+            current.items += s.items.load(std::memory_order_relaxed);
+            current.errors += s.errors.load(std::memory_order_relaxed);
+            current.busy_ns += s.busy_ns.load(std::memory_order_relaxed);
+        }
+
+        const auto labels = prometheus::Labels{ { "pipeline", pipeline }, { "stage", m_name } };
+        metrics.increment("pipeline_stage_items_total", current.items - m_exported.items, labels);
+        metrics.increment("pipeline_stage_errors_total", current.errors - m_exported.errors, labels);
+        metrics.increment("pipeline_stage_busy_seconds_total", static_cast<double>(current.busy_ns - m_exported.busy_ns) * 1e-9, labels);
+        metrics.set("pipeline_stage_queue_depth", queue_depth(), labels);
+        metrics.set("pipeline_stage_workers", m_stats.size(), labels);
+        m_exported = current;
+    }
+
+    [[nodiscard]] auto name() const -> const std::string& { return m_name; }
+
+protected:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @brief   Counters of one worker; only the worker writes them.
+     */
+    struct alignas(CacheLineSize) worker_stats {
+        std::atomic_uint64_t items { 0 };
+        std::atomic_uint64_t errors { 0 };
+        std::atomic_uint64_t busy_ns { 0 };
+
+        static void add(std::atomic_uint64_t& x, std::uint64_t n) {
+            x.store(x.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    };
+
+    std::string m_name;
+    std::vector<worker_stats> m_stats;
+    std::atomic_size_t m_running;
+    std::vector<std::jthread> m_threads;
+
+    [[nodiscard]] virtual auto queue_depth() const -> std::size_t = 0;
+
+private:
+    struct totals_t {
+        std::uint64_t items { 0 };
+        std::uint64_t errors { 0 };
+        std::uint64_t busy_ns { 0 };
+    };
+
+    totals_t m_exported;
+
+};
+
+/**
+ * @brief   Stage applying `F` to the values of its input, by batches.
+ *
+ * `Out` is void for sinks. Busy time covers `F` only, not the wait for room
+ * downstream.
+ */
+template <typename In, typename Out, typename F>
+class stage : public stage_base {
+    static constexpr std::size_t Batch = 32;
+
+public:
+    stage(std::string name, const stage_cfg& cfg, F func, std::shared_ptr<channel<In>> in)
+        : stage_base(std::move(name), std::max<std::size_t>(cfg.workers, 1))
+        , m_func(std::move(func))
+        , m_in(std::move(in))
+    {}
+
+    ~stage() override {
+        m_in->close();
+        join();
+    }
+
+    /**
+     * @brief   Set the input of the next stage.
+     */
+    void connect(std::shared_ptr<channel<Out>> out) requires (not std::is_void_v<Out>) {
+        m_out = std::move(out);
+    }
+
+    void start() override {
+        for (std::size_t i = 0; i < m_stats.size(); ++i) {
+            m_threads.emplace_back([this, i]() { work(m_stats[i]); });
+        }
+    }
+
+private:
+    using output_type = std::conditional_t<std::is_void_v<Out>, int, Out>;
+
+    F m_func;
+    std::shared_ptr<channel<In>> m_in;
+    std::shared_ptr<channel<output_type>> m_out;
+
+    [[nodiscard]] auto queue_depth() const -> std::size_t override {
+        return m_in->size();
+    }
+
+    void work(worker_stats& stats) {
+        auto batch = std::vector<In>(Batch);
+        auto results = std::vector<output_type>{ };
+        results.reserve(Batch);
+
+        while (const auto n = m_in->pop(std::span{ batch })) {
+            const auto start = clock::now();
+            std::uint64_t errors = 0;
+
+            for (auto& value : std::span{ batch }.first(n)) {
+                try {
+                    process(std::move(value), results);
+                } catch (const std::exception& ex) {
+                    ++errors;
+                    nova::topic_log::error("dsp", "Pipeline stage {} failed: {}", m_name, ex.what());
+                }
+            }
+
+            const auto busy = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+            worker_stats::add(stats.items, n);
+            worker_stats::add(stats.errors, errors);
+            worker_stats::add(stats.busy_ns, static_cast<std::uint64_t>(busy.count()));
+
+            for (auto& result : results) {
+                (void)m_out->push(std::move(result));
+            }
+            results.clear();
+        }
+
+        // The last worker done closes the next stage.
+        if (m_running.fetch_sub(1) == 1 and m_out != nullptr) {
+            m_out->close();
+        }
+    }
+
+    void process(In&& value, std::vector<output_type>& results) {
+        using result_type = std::invoke_result_t<F&, In&&>;
+
+        if constexpr (std::is_void_v<Out>) {
+            std::invoke(m_func, std::move(value));
+        } else if constexpr (is_optional<result_type>::value) {
+            if (auto result = std::invoke(m_func, std::move(value)); result.has_value()) {
+                results.push_back(std::move(*result));
+            }
+        } else {
+            results.push_back(std::invoke(m_func, std::move(value)));
+        }
+    }
+
+};
+
+} // namespace detail
+
+/**
+ * @brief   Stages connected by bounded queues, fed by `push()`.
+ *
+ * Every stage has its own workers and input queue (`stage_cfg`), so a costly
+ * stage can be given more threads than the others. Values are handed over by
+ * batches; with several workers a stage does not keep their order. A full
+ * queue blocks the stage (or the caller of `push()`) feeding it, so a slow
+ * stage slows the pipeline down instead of growing memory.
+ *
+ * A transform returning `std::optional` drops the values it returns nothing
+ * for. Exceptions escaping a stage function are logged and counted, the value
+ * is dropped.
+ *
+ * Metrics (labels: pipeline, stage), exported by `update()`:
+ * - `pipeline_stage_items_total` and `pipeline_stage_errors_total`,
+ * - `pipeline_stage_busy_seconds_total`, time spent in the stage function,
+ *   its rate divided by the number of workers is the utilization,
+ * - `pipeline_stage_queue_depth` and `pipeline_stage_workers`.
+ *
+ * `stop()` (or destroying the pipeline) processes the queued values, then
+ * joins the stages one after the other; values pushed while it runs may be
+ * dropped.
+ */
+template <typename In>
+class pipeline {
+public:
+    /**
+     * @brief   Declare the stages of a pipeline, `Out` is the type produced by the last one.
+     */
+    template <typename Out>
+    class stage_builder {
+    public:
+        /**
+         * @param   func Called with `Out&&`, returns the value for the next stage,
+         *          or an optional of it.
+         */
+        template <typename F>
+        [[nodiscard]] auto transform(std::string name, const stage_cfg& cfg, F func) && {
+            using result_type = std::invoke_result_t<F&, Out&&>;
+            using next_type = typename unwrap<result_type>::type;
+            static_assert(not std::is_void_v<next_type>, "A transform must return a value, use a sink");
+
+            auto& s = add<next_type>(std::move(name), cfg, std::move(func));
+            auto ret = stage_builder<next_type>{ std::move(m_name), std::move(m_input), std::move(m_stages) };
+            ret.m_connect = [&s](std::shared_ptr<detail::channel<next_type>> out) { s.connect(std::move(out)); };
+            return ret;
+        }
+
+        /**
+         * @brief   Last stage, consuming the values; start the pipeline.
+         */
+        template <typename F>
+        [[nodiscard]] auto sink(std::string name, const stage_cfg& cfg, F func) && -> pipeline {
+            static_assert(std::is_invocable_v<F&, Out&&>);
+            add<void>(std::move(name), cfg, std::move(func));
+            return pipeline{ std::move(m_name), std::move(m_input), std::move(m_stages) };
+        }
+
+    private:
+        friend class pipeline;
+
+        template <typename T>
+        struct unwrap { using type = T; };
+
+        template <typename T>
+        struct unwrap<std::optional<T>> { using type = T; };
+
+        std::string m_name;
+        std::shared_ptr<detail::channel<In>> m_input;
+        std::vector<std::unique_ptr<detail::stage_base>> m_stages;
+
+        /**
+         * @brief   Connect the last stage to the next one, empty for the first stage.
+         */
+        std::function<void(std::shared_ptr<detail::channel<Out>>)> m_connect;
+
+        stage_builder(std::string name, std::shared_ptr<detail::channel<In>> input, std::vector<std::unique_ptr<detail::stage_base>> stages)
+            : m_name(std::move(name))
+            , m_input(std::move(input))
+            , m_stages(std::move(stages))
+        {}
+
+        template <typename Next, typename F>
+        auto add(std::string name, const stage_cfg& cfg, F func) -> detail::stage<Out, Next, F>& {
+            auto in = std::make_shared<detail::channel<Out>>(cfg.capacity);
+            if (m_connect) {
+                m_connect(in);
+            } else {
+                if constexpr (std::is_same_v<Out, In>) {
+                    m_input = in;
+                }
+            }
+
+            auto s = std::make_unique<detail::stage<Out, Next, F>>(std::move(name), cfg, std::move(func), std::move(in));
+            auto& ret = *s;
+            m_stages.push_back(std::move(s));
+            return ret;
+        }
+
+    };
+
+    [[nodiscard]] static auto builder(std::string name) -> stage_builder<In> {
+        return stage_builder<In>{ std::move(name), nullptr, { } };
+    }
+
+    pipeline(pipeline&&) noexcept             = default;
+    pipeline& operator=(pipeline&&) noexcept  = default;
+
+    ~pipeline() {
+        stop();
+    }
+
+    /**
+     * @brief   Push into the first stage, waiting for room.
+     *
+     * @returns false if the pipeline is stopped.
+     */
+    auto push(In value) -> bool {
+        return m_input->push(std::move(value));
+    }
+
+    /**
+     * @returns false if the first stage is full (e.g. to shed load) or the pipeline is stopped.
+     */
+    [[nodiscard]] auto try_push(In&& value) -> bool {
+        return m_input->try_push(std::move(value));
+    }
+
+    /**
+     * @brief   Process the queued values and stop the stages.
+     */
+    void stop() {
+        if (m_input == nullptr) {
+            return;
+        }
+        m_input->close();
+        for (auto& s : m_stages) {
+            s->join();
+        }
+    }
+
+    /**
+     * @brief   Export the stage metrics, e.g. from `service::on_update()`.
+     */
+    void update(metrics_registry& metrics) {
+        for (auto& s : m_stages) {
+            s->update(metrics, m_name);
+        }
+    }
+
+    [[nodiscard]] auto name() const -> const std::string& { return m_name; }
+
+private:
+    std::string m_name;
+    std::shared_ptr<detail::channel<In>> m_input;
+    std::vector<std::unique_ptr<detail::stage_base>> m_stages;
+
+    pipeline(std::string name, std::shared_ptr<detail::channel<In>> input, std::vector<std::unique_ptr<detail::stage_base>> stages)
+        : m_name(std::move(name))
+        , m_input(std::move(input))
+        , m_stages(std::move(stages))
+    {
+        for (auto& s : m_stages) {
+            s->start();
+        }
+    }
+
+};
+
+} // namespace dsp
@@ -0,0 +1,124 @@
+#include <libdsp/metrics.hpp>
+#include <libdsp/pipeline.hpp>
+
+#include <gmock/gmock.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace testing;
+
+namespace {
+
+/**
+ * @brief   Pipeline metric of `stage`.
+ */
+auto find(dsp::metrics_registry& metrics, const std::string& name, const std::string& stage) -> std::optional<prometheus::ClientMetric> {
+    for (const auto& family : metrics.prometheus_handle()->Collect()) {
+        if (family.name != name) {
+            continue;
+        }
+        for (const auto& m : family.metric) {
+            if (m.label.size() == 2 and m.label[1].value == stage) {
+                return m;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+auto counter(dsp::metrics_registry& metrics, const std::string& name, const std::string& stage) -> double {
+    const auto m = find(metrics, name, stage);
+    return m.has_value() ? m->counter.value : -1;
+}
+
+auto gauge(dsp::metrics_registry& metrics, const std::string& name, const std::string& stage) -> double {
+    const auto m = find(metrics, name, stage);
+    return m.has_value() ? m->gauge.value : -1;
+}
+
+} // namespace
+
+TEST(Dsp, Pipeline_Stages) {
+    auto mutex = std::mutex{ };
+    auto out = std::vector<std::string>{ };
+
+    auto p = dsp::pipeline<int>::builder("test")
+        .transform("even", { .workers = 3, .capacity = 8 }, [](int x) -> std::optional<int> {
+            if (x % 2 != 0) {
+                return std::nullopt;
+            }
+            return x;
+        })
+        .transform("format", { .workers = 2, .capacity = 8 }, [](int x) { return std::to_string(x); })
+        .sink("collect", { }, [&](std::string x) {
+            auto lock = std::lock_guard{ mutex };
+            out.push_back(std::move(x));
+        });
+
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(p.push(i));
+    }
+    p.stop();
+    EXPECT_FALSE(p.push(0));
+
+    EXPECT_EQ(out.size(), 500);
+    auto sorted = std::vector<int>{ };
+    for (const auto& x : out) {
+        sorted.push_back(std::stoi(x));
+    }
+    std::ranges::sort(sorted);
+    for (std::size_t i = 0; i < sorted.size(); ++i) {
+        EXPECT_EQ(sorted[i], 2 * static_cast<int>(i));
+    }
+
+    auto metrics = dsp::metrics_registry{ };
+    p.update(metrics);
+    EXPECT_EQ(counter(metrics, "pipeline_stage_items_total", "even"), 1000);
+    EXPECT_EQ(counter(metrics, "pipeline_stage_items_total", "format"), 500);
+    EXPECT_EQ(counter(metrics, "pipeline_stage_items_total", "collect"), 500);
+    EXPECT_EQ(gauge(metrics, "pipeline_stage_queue_depth", "even"), 0);
+    EXPECT_EQ(gauge(metrics, "pipeline_stage_workers", "even"), 3);
+    EXPECT_GT(counter(metrics, "pipeline_stage_busy_seconds_total", "even"), 0);
+
+    // Only increments are exported.
+    p.update(metrics);
+    EXPECT_EQ(counter(metrics, "pipeline_stage_items_total", "even"), 1000);
+}
+
+TEST(Dsp, Pipeline_Backpressure) {
+    auto release = std::atomic_bool{ false };
+    auto processed = std::atomic_int{ 0 };
+
+    auto p = dsp::pipeline<int>::builder("test")
+        .sink("slow", { .workers = 1, .capacity = 4 }, [&](int x) {
+            release.wait(false);
+            if (x < 0) {
+                throw std::runtime_error("negative");
+            }
+            ++processed;
+        });
+
+    // The worker holds on to its first batch, then the queue fills up.
+    auto pushed = 0;
+    while (pushed < 100 and p.try_push(int{ pushed })) {
+        ++pushed;
+    }
+    EXPECT_LT(pushed, 100);
+
+    release.store(true);
+    release.notify_all();
+    EXPECT_TRUE(p.push(-1));
+    p.stop();
+    EXPECT_EQ(processed.load(), pushed);
+
+    auto metrics = dsp::metrics_registry{ };
+    p.update(metrics);
+    EXPECT_EQ(counter(metrics, "pipeline_stage_errors_total", "slow"), 1);
+}
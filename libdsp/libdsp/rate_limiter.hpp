@@ -0,0 +1,102 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Rate limiter
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace dsp {
+
+/**
+ * @brief   Token bucket rate limiter.
+ *
+ * Tokens are refilled continuously at `rate` per second, up to `burst`
+ * tokens. A request always succeeds, but it can take more tokens than
+ * available: the bucket goes into debt and the caller has to wait until it
+ * is paid back. Requests larger than the burst size are served this way too.
+ *
+ * It is thread-safe. `stop()` interrupts the callers waiting in `acquire()`.
+ */
+class token_bucket {
+public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @param rate      tokens per second
+     * @param burst     bucket size, the bucket starts full
+     */
+    token_bucket(double rate, double burst, clock::time_point now = clock::now())
+        : m_rate(rate)
+        , m_burst(burst)
+        , m_tokens(burst)
+        , m_last(now)
+    {}
+
+    /**
+     * @brief   Take tokens.
+     *
+     * @returns how long the caller must wait before proceeding, zero if it
+     *          can proceed immediately.
+     */
+    [[nodiscard]] auto reserve(double n, clock::time_point now = clock::now()) -> clock::duration {
+        const auto guard = std::scoped_lock{ m_lock };
+
+        const auto elapsed = std::chrono::duration<double>(now - m_last).count();
+        if (elapsed > 0) {
+            m_tokens = std::min(m_burst, m_tokens + elapsed * m_rate);
+            m_last = now;
+        }
+
+        m_tokens -= n;
+        if (m_tokens >= 0) {
+            return clock::duration::zero();
+        }
+
+        return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(-m_tokens / m_rate));
+    }
+
+    /**
+     * @brief   Take tokens, blocking until they are available or the bucket is stopped.
+     *
+     * @returns false if the wait was interrupted by `stop()`.
+     */
+    auto acquire(double n) -> bool {
+        const auto wait = reserve(n);
+        if (wait <= clock::duration::zero()) {
+            return true;
+        }
+
+        auto guard = std::unique_lock{ m_wait_lock };
+        return not m_wakeup.wait_for(guard, wait, [this]() { return m_stopped; });
+    }
+
+    /**
+     * @brief   Wake up the waiting callers, later calls to `acquire()` do not wait anymore.
+     */
+    void stop() {
+        {
+            const auto guard = std::scoped_lock{ m_wait_lock };
+            m_stopped = true;
+        }
+        m_wakeup.notify_all();
+    }
+
+private:
+    std::mutex m_lock;
+    std::mutex m_wait_lock;
+    std::condition_variable m_wakeup;
+    bool m_stopped = false;
+    double m_rate;
+    double m_burst;
+    double m_tokens;
+    clock::time_point m_last;
+
+};
+
+} // namespace dsp
@@ -0,0 +1,55 @@
+#include <libdsp/rate_limiter.hpp>
+
+#include <gmock/gmock.h>
+
+#include <chrono>
+#include <thread>
+
+using namespace testing;
+using namespace std::chrono_literals;
+
+TEST(Dsp, TokenBucket_Burst) {
+    const auto t0 = dsp::token_bucket::clock::time_point{ };
+    auto bucket = dsp::token_bucket{ 10.0, 5.0, t0 };
+
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(bucket.reserve(1.0, t0), 0ns);
+    }
+
+    EXPECT_EQ(bucket.reserve(1.0, t0), 100ms);
+}
+
+TEST(Dsp, TokenBucket_Refill) {
+    const auto t0 = dsp::token_bucket::clock::time_point{ };
+    auto bucket = dsp::token_bucket{ 10.0, 5.0, t0 };
+
+    EXPECT_EQ(bucket.reserve(5.0, t0), 0ns);
+    EXPECT_EQ(bucket.reserve(2.0, t0 + 200ms), 0ns);
+
+    // Refill is capped at the burst size.
+    EXPECT_EQ(bucket.reserve(5.0, t0 + 10s), 0ns);
+    EXPECT_GT(bucket.reserve(1.0, t0 + 10s), 0ns);
+}
+
+TEST(Dsp, TokenBucket_Debt) {
+    const auto t0 = dsp::token_bucket::clock::time_point{ };
+    auto bucket = dsp::token_bucket{ 100.0, 10.0, t0 };
+
+    // Larger than the burst, served by going into debt.
+    EXPECT_EQ(bucket.reserve(60.0, t0), 500ms);
+
+    // Waits for the debt to be paid back first.
+    EXPECT_EQ(bucket.reserve(10.0, t0 + 500ms), 100ms);
+}
+
+TEST(Dsp, TokenBucket_Stop) {
+    auto bucket = dsp::token_bucket{ 1.0, 1.0 };
+    EXPECT_TRUE(bucket.acquire(1.0));
+
+    auto waiter = std::thread{ [&bucket]() { EXPECT_FALSE(bucket.acquire(60.0)); } };
+    bucket.stop();
+    waiter.join();
+
+    // Stopped, no more waiting.
+    EXPECT_FALSE(bucket.acquire(60.0));
+}
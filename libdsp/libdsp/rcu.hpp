@@ -0,0 +1,120 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Read-copy-update
+ *
+ * Configuration objects read for every message (e.g. the router) and replaced
+ * at runtime without stopping the readers.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace dsp {
+
+/**
+ * @brief   A value published as immutable snapshots.
+ *
+ * A writer builds a new value off the hot path and publishes it; readers keep
+ * using their snapshot until they notice the new version. A snapshot is freed
+ * when the last reader moved on.
+ *
+ * Readers on the hot path use a `reader`, which costs one acquire load per
+ * access while the value does not change. Taking a new snapshot (at most once
+ * per publication and reader) and publishing are serialized by a mutex.
+ */
+template <typename T>
+class rcu {
+public:
+    using value_type = T;
+    using snapshot_type = std::shared_ptr<const T>;
+
+    /**
+     * @brief   Cached snapshot of one reader, refreshed when a new version is published.
+     *
+     * It is not thread-safe, each reader thread has its own.
+     */
+    class reader {
+    public:
+        explicit reader(const rcu& source)
+            : m_source(&source)
+            , m_version(source.version())
+            , m_snapshot(source.load())
+        {}
+
+        [[nodiscard]] auto get() -> const T& {
+            if (const auto version = m_source->version(); version != m_version) [[unlikely]] {
+                m_version = version;
+                m_snapshot = m_source->load();
+            }
+            return *m_snapshot;
+        }
+
+        [[nodiscard]] auto operator*()  -> const T& { return get(); }
+        [[nodiscard]] auto operator->() -> const T* { return &get(); }
+
+    private:
+        const rcu* m_source;
+        std::uint64_t m_version;
+        snapshot_type m_snapshot;
+
+    };
+
+    rcu()
+        : m_value(std::make_shared<const T>())
+    {}
+
+    explicit rcu(T value)
+        : m_value(std::make_shared<const T>(std::move(value)))
+    {}
+
+    rcu(const rcu&)             = delete;
+    rcu& operator=(const rcu&)  = delete;
+
+    ~rcu() = default;
+
+    /**
+     * @brief   Replace the value, readers see it at their next access.
+     */
+    void publish(snapshot_type value) {
+        {
+            const auto lock = std::lock_guard{ m_mutex };
+            m_value.swap(value);
+        }
+        m_version.fetch_add(1, std::memory_order_release);
+
+        // The previous snapshot is released here, out of the lock, unless readers still use it.
+    }
+
+    void publish(T value) {
+        publish(std::make_shared<const T>(std::move(value)));
+    }
+
+    /**
+     * @brief   Current snapshot; prefer a `reader` on the hot path.
+     */
+    [[nodiscard]] auto load() const -> snapshot_type {
+        const auto lock = std::lock_guard{ m_mutex };
+        return m_value;
+    }
+
+    /**
+     * @brief   Number of publications so far.
+     */
+    [[nodiscard]] auto version() const -> std::uint64_t {
+        return m_version.load(std::memory_order_acquire);
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    snapshot_type m_value;
+    std::atomic_uint64_t m_version { 0 };
+
+};
+
+} // namespace dsp
@@ -0,0 +1,62 @@
+#include <libdsp/rcu.hpp>
+
+#include <gmock/gmock.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace testing;
+
+TEST(Dsp, Rcu_Publish) {
+    auto value = dsp::rcu<int>{ 1 };
+    auto reader = dsp::rcu<int>::reader{ value };
+    const auto old = value.load();
+
+    EXPECT_EQ(*reader, 1);
+    value.publish(2);
+    EXPECT_EQ(*reader, 2);
+    EXPECT_EQ(value.version(), 1);
+
+    // Snapshots outlive the publication.
+    EXPECT_EQ(*old, 1);
+}
+
+TEST(Dsp, Rcu_ConcurrentReaders) {
+    struct pair_t {
+        int a { 0 };
+        int b { 0 };
+    };
+
+    constexpr int Versions = 10000;
+
+    auto value = dsp::rcu<pair_t>{ };
+    auto done = std::atomic_bool{ false };
+    auto torn = std::atomic_int{ 0 };
+
+    {
+        auto threads = std::vector<std::jthread>{ };
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&]() {
+                auto reader = dsp::rcu<pair_t>::reader{ value };
+                auto last = 0;
+                while (not done.load()) {
+                    const auto& x = reader.get();
+                    if (x.a != x.b or x.a < last) {
+                        torn.fetch_add(1);
+                    }
+                    last = x.a;
+                }
+            });
+        }
+
+        for (int i = 1; i <= Versions; ++i) {
+            value.publish(pair_t{ i, i });
+        }
+        done.store(true);
+    }
+
+    EXPECT_EQ(torn.load(), 0);
+    EXPECT_EQ(value.load()->a, Versions);
+}
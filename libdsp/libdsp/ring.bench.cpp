@@ -0,0 +1,202 @@
+#include <libdsp/ring.hpp>
+#include <libdsp/task.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr std::int64_t ItemsPerIteration = 100'000;
+
+/**
+ * @brief   Baseline: a bounded queue guarded by a mutex, waiting on condition variables.
+ */
+template <typename T>
+class locked_queue {
+public:
+    static constexpr std::size_t Capacity = 4096;
+
+    void push(T value) {
+        {
+            auto lock = std::unique_lock{ m_mutex };
+            m_not_full.wait(lock, [&]() { return m_queue.size() < Capacity; });
+            m_queue.push_back(std::move(value));
+        }
+        m_not_empty.notify_one();
+    }
+
+    auto pop() -> T {
+        auto lock = std::unique_lock{ m_mutex };
+        m_not_empty.wait(lock, [&]() { return not m_queue.empty(); });
+        auto value = std::move(m_queue.front());
+        m_queue.pop_front();
+        lock.unlock();
+        m_not_full.notify_one();
+        return value;
+    }
+
+private:
+    std::deque<T> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+};
+
+/**
+ * @brief   One producer thread, the benchmark thread consumes by batches of `range(0)`.
+ */
+void BM_SpscThroughput(benchmark::State& state) {
+    auto ring = dsp::spsc_ring<std::int64_t>{ 4096 };
+    auto not_empty = dsp::event_count{ };
+    auto not_full = dsp::event_count{ };
+    const auto batch_size = static_cast<std::size_t>(state.range(0));
+
+    auto producer = std::jthread{ [&](const std::stop_token& token) {
+        auto batch = std::vector<std::int64_t>(batch_size);
+        while (not token.stop_requested()) {
+            auto rest = std::span{ batch };
+            while (not rest.empty() and not token.stop_requested()) {
+                rest = rest.subspan(ring.try_push(rest));
+                not_empty.notify();
+                if (not rest.empty()) {
+                    (void)not_full.wait_for([&]() { return ring.size() < ring.capacity(); }, std::chrono::milliseconds{ 1 });
+                }
+            }
+        }
+    } };
+
+    auto batch = std::vector<std::int64_t>(batch_size);
+    for (auto _ : state) {
+        for (std::int64_t n = 0; n < ItemsPerIteration; ) {
+            std::size_t popped = 0;
+            not_empty.wait([&]() { return (popped = ring.try_pop(std::span{ batch })) > 0; });
+            not_full.notify();
+            n += static_cast<std::int64_t>(popped);
+        }
+    }
+
+    // The producer does not wait longer than 1 ms.
+    producer.request_stop();
+    producer.join();
+    state.SetItemsProcessed(state.iterations() * ItemsPerIteration);
+}
+
+/**
+ * @brief   `range(0)` producer threads, the benchmark thread consumes by batches of `range(1)`.
+ */
+void BM_MpmcThroughput(benchmark::State& state) {
+    auto ring = dsp::mpmc_ring<std::int64_t>{ 4096 };
+    const auto batch_size = static_cast<std::size_t>(state.range(1));
+    auto stop = std::atomic_bool{ false };
+
+    auto producers = std::vector<std::jthread>{ };
+    for (int p = 0; p < state.range(0); ++p) {
+        producers.emplace_back([&]() {
+            auto batch = std::vector<std::int64_t>(batch_size);
+            while (not stop.load(std::memory_order_relaxed)) {
+                if (ring.try_push(std::span{ batch }) == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    auto batch = std::vector<std::int64_t>(batch_size);
+    for (auto _ : state) {
+        for (std::int64_t n = 0; n < ItemsPerIteration; ) {
+            const auto popped = ring.try_pop(std::span{ batch });
+            if (popped == 0) {
+                std::this_thread::yield();
+            }
+            n += static_cast<std::int64_t>(popped);
+        }
+    }
+
+    stop.store(true);
+    state.SetItemsProcessed(state.iterations() * ItemsPerIteration);
+}
+
+/**
+ * @brief   `range(0)` producer threads pushing into `Queue`, the benchmark thread pops.
+ */
+template <typename Queue>
+void BM_QueueThroughput(benchmark::State& state) {
+    auto q = Queue{ };
+    auto stop = std::atomic_bool{ false };
+
+    auto producers = std::vector<std::jthread>{ };
+    for (int p = 0; p < state.range(0); ++p) {
+        producers.emplace_back([&]() {
+            while (not stop.load(std::memory_order_relaxed)) {
+                q.push(1);
+            }
+        });
+    }
+
+    for (auto _ : state) {
+        for (std::int64_t n = 0; n < ItemsPerIteration; ++n) {
+            benchmark::DoNotOptimize(q.pop());
+        }
+    }
+
+    // Producers may wait for room, keep consuming until they are gone.
+    stop.store(true);
+    {
+        auto drain = std::jthread{ [&]() {
+            while (q.pop() >= 0) {
+            }
+        } };
+        producers.clear();
+        q.push(-1);
+    }
+    state.SetItemsProcessed(state.iterations() * ItemsPerIteration);
+}
+
+/**
+ * @brief   Round trip of a value to an echo thread and back.
+ */
+template <typename Queue>
+void BM_QueueLatency(benchmark::State& state) {
+    auto ping = Queue{ };
+    auto pong = Queue{ };
+
+    auto echo = std::jthread{ [&]() {
+        while (true) {
+            const auto x = ping.pop();
+            pong.push(x);
+            if (x < 0) {
+                return;
+            }
+        }
+    } };
+
+    for (auto _ : state) {
+        ping.push(1);
+        benchmark::DoNotOptimize(pong.pop());
+    }
+
+    ping.push(-1);
+    (void)pong.pop();
+}
+
+} // namespace
+
+BENCHMARK(BM_SpscThroughput)->Arg(1)->Arg(32)->UseRealTime();
+BENCHMARK(BM_MpmcThroughput)->Args({ 1, 1 })->Args({ 1, 32 })->Args({ 4, 1 })->Args({ 4, 32 })->UseRealTime();
+BENCHMARK(BM_QueueThroughput<dsp::queue<std::int64_t>>)->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK(BM_QueueThroughput<locked_queue<std::int64_t>>)->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK(BM_QueueLatency<dsp::queue<std::int64_t>>)->UseRealTime();
+BENCHMARK(BM_QueueLatency<locked_queue<std::int64_t>>)->UseRealTime();
+
+BENCHMARK_MAIN();
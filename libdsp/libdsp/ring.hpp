@@ -0,0 +1,455 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Lock-free ring queues
+ *
+ * Bounded queues for handing values over between threads. Operations never
+ * block; threads waiting for a ring to change use an `event_count`.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <span>
+#include <thread>
+#include <utility>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace dsp {
+
+/**
+ * @brief   Size of a cache line, indices written by different threads are
+ *          padded to it to avoid false sharing.
+ */
+inline constexpr std::size_t CacheLineSize = 64;
+
+/**
+ * @brief   Hint to the CPU that the thread is spinning.
+ */
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+ * @brief   Wait for a condition changed by other threads: spin, then sleep on a futex.
+ *
+ * Waiters spin for a short while, which is enough when the other side is
+ * running (not on single CPU hosts, where it cannot run meanwhile), then
+ * sleep. Notifying costs a fence and a load while nobody sleeps, and one
+ * system call per group of sleepers, so producers can notify after every
+ * push:
+ *
+ *  ring.try_push(x);        // producer
+ *  not_empty.notify();
+ *
+ *  not_empty.wait([&]() { return ring.try_pop(x); });   // consumer
+ */
+class event_count {
+public:
+    static constexpr int SpinCount = 128;
+
+    /**
+     * @brief   Wait until `ready()` returns true, `ready()` is called again after every wake-up.
+     */
+    template <typename Pred>
+    void wait(const Pred& ready) {
+        while (not wait_for(ready, std::chrono::seconds{ 1 })) {
+        }
+    }
+
+    /**
+     * @returns false if `ready()` is still false after `timeout` (or a spurious wake-up).
+     */
+    template <typename Pred>
+    [[nodiscard]] auto wait_for(const Pred& ready, std::chrono::nanoseconds timeout) -> bool {
+        static const auto spins = std::thread::hardware_concurrency() > 1 ? SpinCount : 0;
+
+        for (int i = 0; i < spins; ++i) {
+            if (ready()) {
+                return true;
+            }
+            cpu_relax();
+        }
+
+        const auto state = m_state.fetch_or(Waiting) | Waiting;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ready()) {
+            return true;
+        }
+
+        sleep(state, timeout);
+        return ready();
+    }
+
+    /**
+     * @brief   Wake the waiting threads, the condition must be changed before.
+     */
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto state = m_state.load(std::memory_order_relaxed);
+        if ((state & Waiting) != 0 and m_state.compare_exchange_strong(state, (state + Epoch) & ~Waiting)) {
+            wake();
+        }
+    }
+
+private:
+    static_assert(sizeof(std::atomic_uint32_t) == sizeof(std::uint32_t) and std::atomic_uint32_t::is_always_lock_free);
+
+    /**
+     * @brief   The state is an epoch, bumped by notifications, and a bit set by
+     *          threads going to sleep; only the first notification after it
+     *          was set wakes them up.
+     */
+    static constexpr std::uint32_t Waiting = 1;
+    static constexpr std::uint32_t Epoch = 2;
+
+    alignas(CacheLineSize) std::atomic_uint32_t m_state { 0 };
+
+    [[nodiscard]] auto word() -> std::uint32_t* {
+        return reinterpret_cast<std::uint32_t*>(&m_state);
+    }
+
+    /**
+     * @brief   Sleep unless the state changed since it was read.
+     */
+    void sleep(std::uint32_t state, std::chrono::nanoseconds timeout) {
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        const auto ts = timespec{
+            .tv_sec = seconds.count(),
+            .tv_nsec = (timeout - seconds).count(),
+        };
+        ::syscall(SYS_futex, word(), FUTEX_WAIT_PRIVATE, state, &ts, nullptr, 0);
+    }
+
+    void wake() {
+        ::syscall(SYS_futex, word(), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+};
+
+/**
+ * @brief   Bounded single-producer single-consumer queue.
+ *
+ * The producer owns the tail, the consumer the head; each side keeps a copy of
+ * the other index and reads it again only when the ring looks full (or
+ * empty), so the cache line of the other side is rarely touched.
+ *
+ * Capacity is rounded up to a power of two.
+ */
+template <typename T>
+class spsc_ring {
+public:
+    explicit spsc_ring(std::size_t capacity)
+        : m_capacity(std::bit_ceil(std::max<std::size_t>(capacity, 2)))
+        , m_mask(m_capacity - 1)
+        , m_values(std::make_unique<T[]>(m_capacity))
+    {}
+
+    spsc_ring(const spsc_ring&)             = delete;
+    spsc_ring(spsc_ring&&)                  = delete;
+    spsc_ring& operator=(const spsc_ring&)  = delete;
+    spsc_ring& operator=(spsc_ring&&)       = delete;
+
+    ~spsc_ring() = default;
+
+    /**
+     * @returns false if the queue is full, the value is not moved from then.
+     */
+    [[nodiscard]] auto try_push(T&& value) -> bool {
+        return try_push(std::span{ &value, 1 }) == 1;
+    }
+
+    /**
+     * @brief   Push as many values as there is room for, in order.
+     *
+     * @returns number of values pushed (moved from), from the front of `values`.
+     */
+    [[nodiscard]] auto try_push(std::span<T> values) -> std::size_t {
+        const auto tail = m_producer.index.load(std::memory_order_relaxed);
+        if (m_capacity - (tail - m_producer.other) < values.size()) {
+            m_producer.other = m_consumer.index.load(std::memory_order_acquire);
+        }
+
+        const auto n = std::min(values.size(), m_capacity - (tail - m_producer.other));
+        for (std::size_t i = 0; i < n; ++i) {
+            m_values[(tail + i) & m_mask] = std::move(values[i]);
+        }
+        if (n > 0) {
+            m_producer.index.store(tail + n, std::memory_order_release);
+        }
+        return n;
+    }
+
+    /**
+     * @returns false if the queue is empty.
+     */
+    [[nodiscard]] auto try_pop(T& out) -> bool {
+        return try_pop(std::span{ &out, 1 }) == 1;
+    }
+
+    /**
+     * @brief   Pop up to `out.size()` values, in order.
+     *
+     * @returns number of values popped into the front of `out`.
+     */
+    [[nodiscard]] auto try_pop(std::span<T> out) -> std::size_t {
+        const auto head = m_consumer.index.load(std::memory_order_relaxed);
+        if (m_consumer.other - head < out.size()) {
+            m_consumer.other = m_producer.index.load(std::memory_order_acquire);
+        }
+
+        const auto n = std::min(out.size(), m_consumer.other - head);
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = std::move(m_values[(head + i) & m_mask]);
+        }
+        if (n > 0) {
+            m_consumer.index.store(head + n, std::memory_order_release);
+        }
+        return n;
+    }
+
+    /**
+     * @brief   Approximate number of elements, exact when there are no concurrent operations.
+     */
+    [[nodiscard]] auto size() const -> std::size_t {
+        const auto head = m_consumer.index.load(std::memory_order_relaxed);
+        const auto tail = m_producer.index.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    [[nodiscard]] auto empty()    const -> bool        { return size() == 0; }
+    [[nodiscard]] auto capacity() const -> std::size_t { return m_capacity; }
+
+private:
+    /**
+     * @brief   Index written by one side, and its copy of the index of the other side.
+     */
+    struct alignas(CacheLineSize) side {
+        std::atomic_size_t index { 0 };
+        std::size_t other { 0 };
+    };
+
+    const std::size_t m_capacity;
+    const std::size_t m_mask;
+    std::unique_ptr<T[]> m_values;
+
+    side m_producer;
+    side m_consumer;
+
+};
+
+/**
+ * @brief   Bounded multi-producer multi-consumer queue (D. Vyukov).
+ *
+ * Every cell has a sequence number telling whether it is ready to be written
+ * or read in the current lap, so producers and consumers only contend on
+ * their own index. Operations never block; `try_push()` fails when the queue
+ * is full, `try_pop()` when it is empty.
+ *
+ * Capacity is rounded up to a power of two.
+ */
+template <typename T>
+class mpmc_ring {
+public:
+    explicit mpmc_ring(std::size_t capacity)
+        : m_capacity(std::bit_ceil(std::max<std::size_t>(capacity, 2)))
+        , m_mask(m_capacity - 1)
+        , m_cells(std::make_unique<cell[]>(m_capacity))
+    {
+        for (std::size_t i = 0; i < m_capacity; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    mpmc_ring(const mpmc_ring&)             = delete;
+    mpmc_ring(mpmc_ring&&)                  = delete;
+    mpmc_ring& operator=(const mpmc_ring&)  = delete;
+    mpmc_ring& operator=(mpmc_ring&&)       = delete;
+
+    ~mpmc_ring() = default;
+
+    /**
+     * @returns false if the queue is full, the value is not moved from then.
+     */
+    [[nodiscard]] auto try_push(T&& value) -> bool {
+        auto pos = m_tail.value.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto& c = m_cells[pos & m_mask];
+            const auto seq = c.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+            if (diff == 0) {
+                if (m_tail.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = std::move(value);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_tail.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @returns false if the queue is empty.
+     */
+    [[nodiscard]] auto try_pop(T& out) -> bool {
+        auto pos = m_head.value.load(std::memory_order_relaxed);
+
+        while (true) {
+            auto& c = m_cells[pos & m_mask];
+            const auto seq = c.sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+
+            if (diff == 0) {
+                if (m_head.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(c.value);
+                    c.sequence.store(pos + m_capacity, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_head.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief   Push as many values as there is room for, in order, claiming the cells at once.
+     *
+     * @returns number of values pushed (moved from), from the front of `values`.
+     */
+    [[nodiscard]] auto try_push(std::span<T> values) -> std::size_t {
+        if (values.empty()) {
+            return 0;
+        }
+
+        auto pos = m_tail.value.load(std::memory_order_relaxed);
+
+        while (true) {
+            const auto n = claimable(pos, 0, values.size());
+            if (n == 0) {
+                if (not retry(pos, 0, m_tail)) {
+                    return 0;
+                }
+                continue;
+            }
+
+            if (m_tail.value.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    auto& c = m_cells[(pos + i) & m_mask];
+                    c.value = std::move(values[i]);
+                    c.sequence.store(pos + i + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    /**
+     * @brief   Pop up to `out.size()` values, in order, claiming the cells at once.
+     *
+     * @returns number of values popped into the front of `out`.
+     */
+    [[nodiscard]] auto try_pop(std::span<T> out) -> std::size_t {
+        if (out.empty()) {
+            return 0;
+        }
+
+        auto pos = m_head.value.load(std::memory_order_relaxed);
+
+        while (true) {
+            const auto n = claimable(pos, 1, out.size());
+            if (n == 0) {
+                if (not retry(pos, 1, m_head)) {
+                    return 0;
+                }
+                continue;
+            }
+
+            if (m_head.value.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    auto& c = m_cells[(pos + i) & m_mask];
+                    out[i] = std::move(c.value);
+                    c.sequence.store(pos + i + m_capacity, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    /**
+     * @brief   Approximate number of elements, exact when there are no concurrent operations.
+     */
+    [[nodiscard]] auto size() const -> std::size_t {
+        const auto tail = m_tail.value.load(std::memory_order_relaxed);
+        const auto head = m_head.value.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    [[nodiscard]] auto empty()    const -> bool        { return size() == 0; }
+    [[nodiscard]] auto capacity() const -> std::size_t { return m_capacity; }
+
+private:
+    struct cell {
+        std::atomic_size_t sequence;
+        T value;
+    };
+
+    struct alignas(CacheLineSize) index {
+        std::atomic_size_t value { 0 };
+    };
+
+    const std::size_t m_capacity;
+    const std::size_t m_mask;
+    std::unique_ptr<cell[]> m_cells;
+
+    index m_head;
+    index m_tail;
+
+    /**
+     * @brief   Number of consecutive cells from `pos` in the expected lap.
+     *
+     * @param   offset 0 for cells ready to be written, 1 for cells ready to be read.
+     */
+    [[nodiscard]] auto claimable(std::size_t pos, std::size_t offset, std::size_t max) const -> std::size_t {
+        std::size_t n = 0;
+        while (n < max and m_cells[(pos + n) & m_mask].sequence.load(std::memory_order_acquire) == pos + n + offset) {
+            ++n;
+        }
+        return n;
+    }
+
+    /**
+     * @returns false if the queue is full (or empty), otherwise `pos` is reloaded.
+     */
+    [[nodiscard]] auto retry(std::size_t& pos, std::size_t offset, const index& i) const -> bool {
+        const auto seq = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+        if (static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + offset) < 0) {
+            return false;
+        }
+        pos = i.value.load(std::memory_order_relaxed);
+        return true;
+    }
+
+};
+
+} // namespace dsp
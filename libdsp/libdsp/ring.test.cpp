@@ -0,0 +1,140 @@
+#include <libdsp/ring.hpp>
+
+#include <gmock/gmock.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <thread>
+#include <vector>
+
+using namespace testing;
+
+TEST(Dsp, MpmcRing_Bounded) {
+    auto ring = dsp::mpmc_ring<int>{ 3 };
+    ASSERT_EQ(ring.capacity(), 4);
+
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(ring.try_push(int{ i }));
+    }
+    EXPECT_FALSE(ring.try_push(4));
+    EXPECT_EQ(ring.size(), 4);
+
+    int x = -1;
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(ring.try_pop(x));
+        EXPECT_EQ(x, i);
+    }
+    EXPECT_FALSE(ring.try_pop(x));
+    EXPECT_TRUE(ring.empty());
+}
+
+TEST(Dsp, MpmcRing_Concurrent) {
+    constexpr int Producers = 4;
+    constexpr int Consumers = 4;
+    constexpr std::int64_t PerProducer = 100000;
+
+    auto ring = dsp::mpmc_ring<std::int64_t>{ 1024 };
+    auto sum = std::atomic_int64_t{ 0 };
+    auto popped = std::atomic_int64_t{ 0 };
+
+    {
+        auto threads = std::vector<std::jthread>{ };
+        for (int p = 0; p < Producers; ++p) {
+            threads.emplace_back([&]() {
+                for (std::int64_t i = 1; i <= PerProducer; ++i) {
+                    while (not ring.try_push(std::int64_t{ i })) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        for (int c = 0; c < Consumers; ++c) {
+            threads.emplace_back([&]() {
+                std::int64_t x = 0;
+                while (popped.load() < Producers * PerProducer) {
+                    if (ring.try_pop(x)) {
+                        sum.fetch_add(x);
+                        popped.fetch_add(1);
+                    }
+                }
+            });
+        }
+    }
+
+    EXPECT_EQ(sum.load(), Producers * PerProducer * (PerProducer + 1) / 2);
+}
+
+TEST(Dsp, MpmcRing_Batch) {
+    auto ring = dsp::mpmc_ring<int>{ 8 };
+    auto in = std::vector<int>{ 0, 1, 2, 3, 4, 5 };
+    EXPECT_EQ(ring.try_push(std::span{ in }), 6);
+
+    in = { 6, 7, 8, 9 };
+    EXPECT_EQ(ring.try_push(std::span{ in }), 2);
+
+    auto out = std::vector<int>(5, -1);
+    EXPECT_EQ(ring.try_pop(std::span{ out }), 5);
+    EXPECT_THAT(out, ElementsAre(0, 1, 2, 3, 4));
+    EXPECT_EQ(ring.try_pop(std::span{ out }), 3);
+    EXPECT_THAT(std::span{ out }.first(3), ElementsAre(5, 6, 7));
+    EXPECT_EQ(ring.try_pop(std::span{ out }), 0);
+}
+
+TEST(Dsp, MpmcRing_EmptyBatch) {
+    auto ring = dsp::mpmc_ring<int>{ 2 };
+    EXPECT_EQ(ring.try_push(std::span<int>{ }), 0);
+    EXPECT_EQ(ring.try_pop(std::span<int>{ }), 0);
+
+    // Neither on a full ring.
+    EXPECT_TRUE(ring.try_push(1));
+    EXPECT_TRUE(ring.try_push(2));
+    EXPECT_EQ(ring.try_push(std::span<int>{ }), 0);
+    EXPECT_EQ(ring.try_pop(std::span<int>{ }), 0);
+    EXPECT_EQ(ring.size(), 2);
+}
+
+TEST(Dsp, SpscRing_Concurrent) {
+    constexpr std::int64_t Count = 1000000;
+
+    auto ring = dsp::spsc_ring<std::int64_t>{ 256 };
+    auto not_empty = dsp::event_count{ };
+    auto not_full = dsp::event_count{ };
+    auto received = std::vector<std::int64_t>{ };
+
+    {
+        auto producer = std::jthread{ [&]() {
+            auto batch = std::vector<std::int64_t>{ };
+            for (std::int64_t i = 0; i < Count; i += static_cast<std::int64_t>(batch.size())) {
+                batch.clear();
+                for (std::int64_t j = i; j < std::min(Count, i + 1 + i % 7); ++j) {
+                    batch.push_back(j);
+                }
+
+                auto rest = std::span{ batch };
+                while (not rest.empty()) {
+                    not_full.wait([&]() { return ring.size() < ring.capacity(); });
+                    rest = rest.subspan(ring.try_push(rest));
+                    not_empty.notify();
+                }
+            }
+        } };
+
+        auto batch = std::vector<std::int64_t>(16);
+        while (static_cast<std::int64_t>(received.size()) < Count) {
+            std::size_t n = 0;
+            not_empty.wait([&]() { return (n = ring.try_pop(std::span{ batch })) > 0; });
+            not_full.notify();
+            received.insert(received.end(), batch.begin(), batch.begin() + static_cast<std::ptrdiff_t>(n));
+        }
+    }
+
+    ASSERT_EQ(received.size(), Count);
+    for (std::int64_t i = 0; i < Count; ++i) {
+        ASSERT_EQ(received[static_cast<std::size_t>(i)], i);
+    }
+    EXPECT_TRUE(ring.empty());
+}
@@ -0,0 +1,133 @@
+#include <libdsp/router.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief   1000 rules: most on the message type, some on the source, a few exclusions.
+ */
+auto rules(int count) -> std::vector<dsp::router::rule_cfg> {
+    using enum dsp::router::action_type;
+
+    auto ret = std::vector<dsp::router::rule_cfg>{ };
+    for (int i = 0; i < count; ++i) {
+        const auto field = i % 10 == 0 ? "source" : "type";
+        ret.push_back({
+            .name = "rule-" + std::to_string(i),
+            .priority = i,
+            .condition = { .field = field, .value = "value-" + std::to_string(i) },
+            .action = i % 100 == 1 ? exclude : include,
+            .destination = "main-nb",
+            .subject = "subject-" + std::to_string(i % 16),
+        });
+    }
+    return ret;
+}
+
+void BM_Route(benchmark::State& state) {
+    const auto router = dsp::router{ rules(static_cast<int>(state.range(0))) };
+    const auto msg = dsp::message{
+        .key = { },
+        .subject = { },
+        .properties = {
+            { "type", "value-503" },
+            { "source", "value-70" },
+            { "region", "eu" },
+        },
+        .payload = { },
+    };
+
+    auto xs = dsp::router::routes_t{ };
+    for (auto _ : state) {
+        router.route(msg, xs);
+        benchmark::DoNotOptimize(xs.data());
+    }
+}
+
+/**
+ * @brief   Regular expressions on the same field, combined into one automaton.
+ */
+void BM_RouteRegex(benchmark::State& state) {
+    auto xs = std::vector<dsp::router::rule_cfg>{ };
+    for (int i = 0; i < state.range(0); ++i) {
+        xs.push_back({
+            .name = "rule-" + std::to_string(i),
+            .priority = i,
+            .condition = {
+                .field = "id",
+                .value = "^device-" + std::to_string(i) + "-[a-f0-9]+$",
+                .matcher = dsp::match_type::regex,
+            },
+            .destination = "main-nb",
+            .subject = "subject-" + std::to_string(i % 16),
+        });
+    }
+
+    const auto router = dsp::router{ std::move(xs) };
+    const auto msg = dsp::message{
+        .key = { },
+        .subject = { },
+        .properties = {
+            { "id", "device-42-0badc0ffee" },
+        },
+        .payload = { },
+    };
+
+    auto routes = dsp::router::routes_t{ };
+    for (auto _ : state) {
+        router.route(msg, routes);
+        benchmark::DoNotOptimize(routes.data());
+    }
+}
+
+/**
+ * @brief   Rules on a JSON key of a ~1 KiB payload, the key is extracted once for all of them.
+ */
+void BM_RoutePayload(benchmark::State& state) {
+    auto xs = std::vector<dsp::router::rule_cfg>{ };
+    for (int i = 0; i < state.range(0); ++i) {
+        xs.push_back({
+            .name = "rule-" + std::to_string(i),
+            .priority = i,
+            .condition = { .field = "json:device.model", .value = "model-" + std::to_string(i) },
+            .destination = "main-nb",
+            .subject = "subject-" + std::to_string(i % 16),
+        });
+    }
+
+    auto text = std::string{ R"({"id": 42, "samples": [)" };
+    for (int i = 0; i < 100; ++i) {
+        text += std::to_string(i * 1000) + ", ";
+    }
+    text += R"(0], "note": ")" + std::string(400, 'x') + R"(", "device": {"vendor": "acme", "model": "model-7"}})";
+
+    const auto router = dsp::router{ std::move(xs) };
+    const auto msg = dsp::message{
+        .key = { },
+        .subject = { },
+        .properties = { },
+        .payload = dsp::payload_buffer::borrow({ reinterpret_cast<const std::byte*>(text.data()), text.size() }),
+    };
+
+    auto routes = dsp::router::routes_t{ };
+    for (auto _ : state) {
+        router.route(msg, routes);
+        benchmark::DoNotOptimize(routes.data());
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(text.size()));
+}
+
+} // namespace
+
+BENCHMARK(BM_Route)->Arg(10)->Arg(1000);
+BENCHMARK(BM_RouteRegex)->Arg(10)->Arg(100);
+BENCHMARK(BM_RoutePayload)->Arg(10)->Arg(100);
+
+BENCHMARK_MAIN();
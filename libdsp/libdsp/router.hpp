@@ -7,114 +7,611 @@
 #pragma once
 
 #include <libdsp/cache.hpp>
+#include <libdsp/expression.hpp>
+#include <libdsp/matcher.hpp>
+#include <libdsp/payload.hpp>
 #include <libdsp/profiler.hpp>
+#include <libdsp/router_stats.hpp>
 
+#include <libnova/error.hpp>
+#include <libnova/log.hpp>
+
+#include <yaml-cpp/yaml.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace dsp {
 
+/**
+ * @brief   Route messages to northbound interfaces based on their properties
+ *          and payload fields.
+ *
+ * Rules are given by the configuration (`dsp.router`), validated, ordered by
+ * priority and compiled into a decision table:
+ * - include rules are indexed by property key, then by value, so a message
+ *   is routed with one hash lookup per property, regardless of the number
+ *   of rules,
+ * - exclude rules are few in practice, they are checked one by one,
+ * - wildcard rules (field `*`) match every message,
+ * - prefix, glob and regex rules on the same field are combined into one
+ *   automaton, the value is scanned once for all of them,
+ * - range rules parse the value once per field,
+ * - rules with boolean expressions (all/any/none of conditions) are compiled
+ *   into a shared DAG, see `expression_set`,
+ * - payload fields (`json:...`, `bin:...`, see `payload_field`) are extracted
+ *   only when a rule needs them, and at most once per message.
+ */
 class router {
-    static const std::pair<std::string, std::string> Everything;
+public:
+    static constexpr auto Wildcard = std::string_view{ "*" };
 
-    enum class match_type {
-        exact,
-    };
+    using match_type = dsp::match_type;
 
+    /**
+     * @brief   What a rule does with the messages matching its condition.
+     *
+     * - include: route the message if the condition is true,
+     * - exclude: route the message if the condition is false (e.g. the property is missing).
+     */
     enum class action_type {
-        allow,
-        deny,
+        include,
+        exclude,
     };
 
-    struct rule_t {
+    /**
+     * @brief   A routing rule as configured.
+     */
+    struct rule_cfg {
         std::string name;
         int priority;
-        std::pair<std::string, std::string> condition;
-        action_type action;
-        match_type matcher;
+        condition_cfg condition;
+        action_type action { action_type::include };
         std::string destination;
         std::string subject;
     };
 
-public:
-    router() {
-        const auto rule = rule_t{
-            .name = "",
-            .priority = 1,
-            .condition = { "type", "heartbeat" },
-            .action = action_type::allow,
-            .matcher = match_type::exact,
-            .destination = "main-nb",
-            .subject = "heartbeats"
-        };
-
-        const auto rule2 = rule_t{
-            .name = "",
-            .priority = 2,
-            .condition = { "type", "heartbeat" },
-            // .condition = { "*", "*" },
-            // .action = action_type::allow,
-            .action = action_type::deny,
-            .matcher = match_type::exact,
-            .destination = "main-nb",
-            .subject = "dev-test"
-        };
-
-        // TODO(feat): Sanity check priorities (they must be unique).
-        // TODO(feat): Sort by priority.
-        m_rules.push_back(rule);
-        m_rules.push_back(rule2);
+    /**
+     * @brief   Where and under which subject a routed message goes.
+     *
+     * A route does not hold the message: mirroring a message to several
+     * destinations sends the same message once per route, with the subject
+     * of the route.
+     */
+    struct route_t {
+        cache::destination destination;
+        subject_ref subject;
+
+        /**
+         * @brief   Index of the matching rule, in priority order.
+         */
+        std::uint32_t rule;
+    };
+
+    using routes_t = std::vector<route_t>;
+
+    /**
+     * @brief   Router without rules, routing nothing.
+     */
+    router() = default;
+
+    /**
+     * @throws  nova::exception if a rule is invalid or priorities are not unique.
+     */
+    explicit router(std::vector<rule_cfg> rules) {
+        validate(rules);
+        std::ranges::sort(rules, std::less{ }, &rule_cfg::priority);
+
+        m_rules.reserve(rules.size());
+        m_names.reserve(rules.size());
+        for (auto& cfg : rules) {
+            try {
+                compile(static_cast<std::uint32_t>(m_rules.size()), cfg);
+            } catch (const nova::exception& ex) {
+                throw nova::exception("Routing rule '{}' is invalid: {}", cfg.name, ex.what());
+            }
+            m_names.push_back(std::move(cfg.name));
+            m_rules.push_back({
+                .destination = std::move(cfg.destination),
+                .subject = subject_ref{ cfg.subject },
+            });
+        }
+        m_stats = std::make_unique<router_stats>(m_rules.size());
+
+        for (auto& field : m_fields) {
+            field.include.compile();
+            field.exclude.compile();
+        }
+    }
+
+    /**
+     * @brief   Resolve the destinations of the rules to northbound interfaces.
+     *
+     * It must be called after all northbound interfaces are attached. Rules
+     * with unknown destinations are disabled.
+     */
+    void resolve(const cache& c) {
+        for (std::size_t i = 0; i < m_rules.size(); ++i) {
+            auto& rule = m_rules[i];
+            rule.target = c.find(rule.destination);
+            if (not rule.target.has_value()) {
+                nova::topic_log::warn("dsp", "Routing rule '{}' targets unknown interface '{}', it is disabled", m_names[i], rule.destination);
+            }
+        }
     }
 
-    [[nodiscard]] auto route(const dsp::message& msg) -> std::vector<dsp::message> {
+    /**
+     * @brief   Route a message into `out`, which is cleared first.
+     *
+     * Routes are ordered by the priority of the rules. `out` is meant to be
+     * reused across messages, so routing does not allocate once it grew to
+     * the largest fan-out.
+     */
+    void route(const dsp::message& msg, routes_t& out) const {
         DSP_PROFILING_ZONE("route");
-        auto ret = std::vector<dsp::message>{ };
+        auto& stats = m_stats->local();
+        const auto sampled = stats.sample();
+        const auto start = sampled ? router_stats::clock::now() : router_stats::clock::time_point{ };
 
-        for (const auto& rule : m_rules) {
-            bool is_allowed = false;
-            if (rule.condition == Everything) {
-                is_allowed = match("*", rule);
-            } else {
-                auto it = msg.properties.find(rule.condition.first);
-                if (it != std::end(msg.properties)) {
-                    is_allowed = match(it->second, rule);
-                } else {
-                    is_allowed = default_match(rule);
+        out.clear();
+        auto fields = field_values{ m_payload, msg };
+
+        for (const auto i : m_wildcards) {
+            emit(i, out);
+        }
+
+        for (const auto& [key, value] : msg.properties) {
+            const auto field = m_includes.find(key);
+            if (field == m_includes.end()) {
+                continue;
+            }
+
+            const auto rules = field->second.find(value);
+            if (rules == field->second.end()) {
+                continue;
+            }
+
+            for (const auto i : rules->second) {
+                emit(i, out);
+            }
+        }
+
+        for (const auto& [field, values] : m_payload_includes) {
+            const auto value = fields.payload(field);
+            if (not value.has_value()) {
+                continue;
+            }
+
+            const auto rules = values.find(*value);
+            if (rules == values.end()) {
+                continue;
+            }
+
+            for (const auto i : rules->second) {
+                emit(i, out);
+            }
+        }
+
+        for (const auto& ex : m_excludes) {
+            if (fields(ex.field) != std::optional<std::string_view>{ ex.value }) {
+                emit(ex.rule, out);
+            }
+        }
+
+        for (const auto& field : m_fields) {
+            evaluate(field, fields(field.field), out);
+        }
+
+        if (not m_expression_rules.empty()) {
+            auto evaluate = expression_set::evaluator{ m_expressions, fields };
+            for (const auto& rule : m_expression_rules) {
+                if (evaluate(rule.root) == (rule.action == action_type::include)) {
+                    emit(rule.rule, out);
                 }
             }
+        }
 
-            if (is_allowed) {
-                auto out = msg;
-                out.subject = rule.subject;
-                ret.push_back(out);
+        // Few routes per message, insertion sort beats std::sort here.
+        for (std::size_t i = 1; i < out.size(); ++i) {
+            for (std::size_t j = i; j > 0 and out[j].rule < out[j - 1].rule; --j) {
+                std::swap(out[j], out[j - 1]);
             }
         }
 
-        return ret;
+        stats.routed(sampled ? std::optional{ router_stats::clock::now() - start } : std::nullopt);
+        for (const auto& r : out) {
+            stats.hit(r.rule);
+        }
+    }
+
+    /**
+     * @brief   Export rule hits and routing cost, see `router_stats`.
+     *
+     * It must be called by one thread, e.g. on the daemon tick.
+     */
+    void update(metrics_registry& metrics) const {
+        if (m_previous != nullptr) {
+            m_previous->update(metrics);
+
+            // No handler routes with it anymore, nor with an older one (they
+            // are released first, by the call above): its counts are all exported.
+            if (m_previous.use_count() == 1 and m_previous->m_previous == nullptr) {
+                m_previous.reset();
+            }
+        }
+
+        m_stats->update(metrics, m_names);
+    }
+
+    /**
+     * @brief   Take over the statistics of the router this one replaces.
+     *
+     * Handlers keep routing with the previous router until their next message
+     * (see `rcu`), `update()` exports its counts too until no handler uses it
+     * nor any router it replaced itself.
+     */
+    void replace(std::shared_ptr<const router> previous) {
+        m_previous = std::move(previous);
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t { return m_rules.size(); }
+
+    /**
+     * @brief   Name of the rule, the index is the one given by `route_t::rule`.
+     */
+    [[nodiscard]] auto rule_name(std::uint32_t rule) const -> const std::string& {
+        return m_names[rule];
     }
 
 private:
+    struct string_hash {
+        using is_transparent = void;
+        auto operator()(std::string_view s) const -> std::size_t { return std::hash<std::string_view>{ }(s); }
+    };
+
+    template <typename T>
+    using string_map = std::unordered_map<std::string, T, string_hash, std::equal_to<>>;
+
+    struct rule_t {
+        std::string destination;
+        subject_ref subject;
+
+        /**
+         * @brief   Resolved destination; broadcast until `resolve()`, empty if unknown.
+         */
+        std::optional<cache::destination> target { cache::Broadcast };
+    };
+
+    struct exclude_t {
+        field_ref field;
+        std::string value;
+        std::uint32_t rule;
+    };
+
+    struct range_t {
+        range_matcher matcher;
+        action_type action;
+        std::uint32_t rule;
+    };
+
+    struct expression_rule_t {
+        expression_set::node_id root;
+        action_type action;
+        std::uint32_t rule;
+    };
+
+    /**
+     * @brief   Non-exact rules on a field; pattern indices map to rules.
+     */
+    struct field_t {
+        field_ref field;
+        pattern_set include;
+        std::vector<std::uint32_t> include_rules;
+        pattern_set exclude;
+        std::vector<std::uint32_t> exclude_rules;
+        std::vector<range_t> ranges;
+    };
+
     std::vector<rule_t> m_rules;
+    std::vector<std::string> m_names;
+    std::unique_ptr<router_stats> m_stats { std::make_unique<router_stats>(0) };
 
-    [[nodiscard]] auto match(const auto& value, const rule_t& rule) -> bool {
-        if (rule.action == action_type::allow) {
-            return value == rule.condition.second;
+    /**
+     * @brief   Replaced router, see `replace()`; only `update()` touches it.
+     */
+    mutable std::shared_ptr<const router> m_previous;
+
+    /**
+     * @brief   Include rules by property key and value.
+     */
+    string_map<string_map<std::vector<std::uint32_t>>> m_includes;
+
+    /**
+     * @brief   Include rules by payload field and value.
+     */
+    std::vector<std::pair<std::uint32_t, string_map<std::vector<std::uint32_t>>>> m_payload_includes;
+    std::vector<exclude_t> m_excludes;
+    std::vector<std::uint32_t> m_wildcards;
+    std::vector<field_t> m_fields;
+    payload_fields m_payload;
+    expression_set m_expressions;
+    std::vector<expression_rule_t> m_expression_rules;
+
+    void emit(std::uint32_t i, routes_t& out) const {
+        const auto& rule = m_rules[i];
+        if (rule.target.has_value()) {
+            out.push_back({ *rule.target, rule.subject, i });
         }
-        return value != rule.condition.second;
     }
 
     /**
-     * @brief   Default boolean value when a message does not match a rule.
-     *
-     * A message that does not match an allow rule is not needed.
-     * A message that does not match a deny rule is needed.
+     * @brief   Pattern indices matched by the current message, reused by the thread.
      */
-    [[nodiscard]] auto default_match(const rule_t& rule) -> bool {
-        return rule.action == action_type::deny;
+    [[nodiscard]] static auto hits() -> std::vector<int>& {
+        static thread_local auto instance = std::vector<int>{ };
+        return instance;
     }
-};
 
-inline const std::pair<std::string, std::string> router::Everything = std::make_pair(std::string{ "*" }, std::string{ "*" });
+    void evaluate(const field_t& field, std::optional<std::string_view> value, routes_t& out) const {
+        auto& xs = hits();
+
+        if (value.has_value() and not field.include.empty()) {
+            field.include.match(*value, xs);
+            for (const auto x : xs) {
+                emit(field.include_rules[static_cast<std::size_t>(x)], out);
+            }
+        }
+
+        if (not field.exclude.empty()) {
+            xs.clear();
+            if (value.has_value()) {
+                field.exclude.match(*value, xs);
+                std::ranges::sort(xs);
+            }
+            for (std::size_t x = 0; x < field.exclude_rules.size(); ++x) {
+                if (not std::ranges::binary_search(xs, static_cast<int>(x))) {
+                    emit(field.exclude_rules[x], out);
+                }
+            }
+        }
+
+        if (not field.ranges.empty()) {
+            const auto number = value.has_value() ? range_matcher::parse(*value) : std::nullopt;
+            for (const auto& r : field.ranges) {
+                if (r.matcher(number) == (r.action == action_type::include)) {
+                    emit(r.rule, out);
+                }
+            }
+        }
+    }
+
+    void compile(std::uint32_t i, const rule_cfg& rule) {
+        const auto& cfg = rule.condition;
+
+        if (not cfg.is_match()) {
+            m_expression_rules.push_back({ m_expressions.add(cfg, m_payload), rule.action, i });
+            return;
+        }
+
+        if (cfg.field == Wildcard) {
+            m_wildcards.push_back(i);
+            return;
+        }
+
+        auto ref = m_payload.add(cfg.field);
+
+        if (cfg.matcher == match_type::exact) {
+            if (rule.action == action_type::exclude) {
+                m_excludes.push_back({ std::move(ref), cfg.value, i });
+            } else if (ref.payload.has_value()) {
+                auto it = std::ranges::find(m_payload_includes, *ref.payload, [](const auto& x) { return x.first; });
+                if (it == m_payload_includes.end()) {
+                    it = m_payload_includes.insert(it, { *ref.payload, { } });
+                }
+                it->second[cfg.value].push_back(i);
+            } else {
+                m_includes[cfg.field][cfg.value].push_back(i);
+            }
+            return;
+        }
+
+        auto it = std::ranges::find(m_fields, cfg.field, [](const field_t& x) -> const std::string& { return x.field.name; });
+        if (it == m_fields.end()) {
+            it = m_fields.insert(m_fields.end(), field_t{ .field = std::move(ref) });
+        }
+        auto& field = *it;
+
+        if (cfg.matcher == match_type::range) {
+            field.ranges.push_back({ { cfg.min, cfg.max }, rule.action, i });
+            return;
+        }
+
+        const auto pattern = [&]() -> std::string {
+            switch (cfg.matcher) {
+                case match_type::prefix:    return prefix_to_regex(cfg.value);
+                case match_type::glob:      return glob_to_regex(cfg.value);
+                default:                    return cfg.value;
+            }
+        }();
+
+        if (rule.action == action_type::include) {
+            field.include.add(pattern);
+            field.include_rules.push_back(i);
+        } else {
+            field.exclude.add(pattern);
+            field.exclude_rules.push_back(i);
+        }
+    }
+
+    static void validate(const std::vector<rule_cfg>& rules) {
+        auto priorities = std::unordered_set<int>{ };
+        auto names = std::unordered_set<std::string>{ };
+
+        for (const auto& rule : rules) {
+            if (rule.name.empty()) {
+                throw nova::exception("Routing rule without name");
+            }
+            if (not names.insert(rule.name).second) {
+                throw nova::exception("Routing rule '{}' is defined more than once", rule.name);
+            }
+            if (not priorities.insert(rule.priority).second) {
+                throw nova::exception("Routing rule '{}' has the same priority as another rule: {}", rule.name, rule.priority);
+            }
+            if (rule.condition.field == Wildcard and rule.action == action_type::exclude) {
+                throw nova::exception("Routing rule '{}' excludes every message", rule.name);
+            }
+            if (rule.condition.field == Wildcard and rule.condition.matcher != match_type::exact) {
+                throw nova::exception("Routing rule '{}' matches every message, it cannot have a matcher", rule.name);
+            }
+            validate(rule.name, rule.condition, true);
+            if (rule.destination.empty()) {
+                throw nova::exception("Routing rule '{}' has no destination", rule.name);
+            }
+            if (rule.subject.empty()) {
+                throw nova::exception("Routing rule '{}' has no subject", rule.name);
+            }
+        }
+    }
+
+    /**
+     * @param   top_level Only a whole condition can be a wildcard.
+     */
+    static void validate(const std::string& name, const condition_cfg& cfg, bool top_level) {
+        if (not cfg.is_match()) {
+            if (cfg.operands.empty()) {
+                throw nova::exception("Routing rule '{}' has a boolean condition without operands", name);
+            }
+            for (const auto& operand : cfg.operands) {
+                validate(name, operand, false);
+            }
+            return;
+        }
+
+        if (cfg.field.empty()) {
+            throw nova::exception("Routing rule '{}' has no condition field", name);
+        }
+        if (cfg.field == Wildcard and not top_level) {
+            throw nova::exception("Routing rule '{}' has a wildcard within a boolean condition", name);
+        }
+        if (cfg.matcher == match_type::range and not (cfg.min <= cfg.max)) {
+            throw nova::exception("Routing rule '{}' has an empty range: [{}, {}]", name, cfg.min, cfg.max);
+        }
+    }
+
+};
 
 } // namespace dsp
+
+/**
+ * @brief   Read a condition from the configuration: either a field matcher,
+ *          or `all`, `any`, `not` of a list of conditions, e.g.:
+ *
+ *  all:
+ *    - { field: type, value: heartbeat }
+ *    - any:
+ *      - { field: region, value: eu-, matcher: prefix }
+ *      - { field: severity, matcher: range, min: 3 }
+ *    - not: { field: source, value: test }
+ *    - { field: "json:device.model", value: "x-*", matcher: glob }
+ *
+ * Fields are properties, or payload fields: `json:<key>[.<key>...]` and
+ * `bin:<offset>:<type>`, see `dsp::payload_field`.
+ *
+ * Matchers are `exact` (default), `prefix`, `glob`, `regex` and `range`;
+ * range conditions have `min` and/or `max` instead of `value`.
+ */
+template <>
+struct YAML::convert<dsp::condition_cfg> {
+    static bool decode(const YAML::Node& node, dsp::condition_cfg& cond) {
+        using op_type = dsp::condition_cfg::op_type;
+
+        if (not node.IsMap()) {
+            return false;
+        }
+
+        for (const auto& [key, op] : { std::pair{ "all", op_type::all }, std::pair{ "any", op_type::any }, std::pair{ "not", op_type::none } }) {
+            if (const auto operands = node[key]; operands) {
+                cond.op = op;
+                if (operands.IsSequence()) {
+                    cond.operands = operands.as<std::vector<dsp::condition_cfg>>();
+                } else {
+                    cond.operands.push_back(operands.as<dsp::condition_cfg>());
+                }
+                return true;
+            }
+        }
+
+        cond.op = op_type::match;
+        cond.field = node["field"].as<std::string>();
+        cond.value = node["value"].as<std::string>(std::string{ dsp::router::Wildcard });
+
+        if (const auto matcher = node["matcher"].as<std::string>("exact"); matcher == "exact") {
+            cond.matcher = dsp::match_type::exact;
+        } else if (matcher == "prefix") {
+            cond.matcher = dsp::match_type::prefix;
+        } else if (matcher == "glob") {
+            cond.matcher = dsp::match_type::glob;
+        } else if (matcher == "regex") {
+            cond.matcher = dsp::match_type::regex;
+        } else if (matcher == "range") {
+            cond.matcher = dsp::match_type::range;
+            cond.min = node["min"].as<double>(cond.min);
+            cond.max = node["max"].as<double>(cond.max);
+        } else {
+            throw nova::exception("Unknown matcher of field '{}': {}", cond.field, matcher);
+        }
+
+        return true;
+    }
+};
+
+/**
+ * @brief   Read a routing rule from the configuration, e.g.:
+ *
+ *  - name: hb
+ *    priority: 1
+ *    condition:
+ *      field: type
+ *      value: heartbeat
+ *    action: include
+ *    destination: main-nb
+ *    subject: heartbeats
+ */
+template <>
+struct YAML::convert<dsp::router::rule_cfg> {
+    static bool decode(const YAML::Node& node, dsp::router::rule_cfg& rule) {
+        if (not node.IsMap()) {
+            return false;
+        }
+
+        rule.name = node["name"].as<std::string>();
+        rule.priority = node["priority"].as<int>();
+        rule.destination = node["destination"].as<std::string>();
+        rule.subject = node["subject"].as<std::string>();
+
+        try {
+            rule.condition = node["condition"].as<dsp::condition_cfg>();
+        } catch (const nova::exception& ex) {
+            throw nova::exception("Routing rule '{}' is invalid: {}", rule.name, ex.what());
+        }
+
+        if (const auto action = node["action"].as<std::string>(); action == "include") {
+            rule.action = dsp::router::action_type::include;
+        } else if (action == "exclude") {
+            rule.action = dsp::router::action_type::exclude;
+        } else {
+            throw nova::exception("Routing rule '{}' has unknown action: {}", rule.name, action);
+        }
+
+        return true;
+    }
+};
@@ -1,22 +1,385 @@
 #include <libdsp/cache.hpp>
+#include <libdsp/metrics.hpp>
 #include <libdsp/router.hpp>
 
+#include <libnova/error.hpp>
+
 #include <gmock/gmock.h>
+#include <prometheus/metric_family.h>
+#include <yaml-cpp/yaml.h>
+
+#include <memory>
+#include <string>
+#include <vector>
 
 using namespace testing;
 
-TEST(Dsp, Router_Allow) {
-    const auto msg = dsp::message{
+namespace {
+
+struct null_northbound : public dsp::northbound_interface {
+    bool send(const dsp::message&) override { return true; }
+    void stop() override { }
+};
+
+auto heartbeat() -> dsp::message {
+    return dsp::message{
         .key = { },
         .subject = { },
-        .properties = { },
+        .properties = {
+            { "type", "heartbeat" },
+            { "source", "dev" },
+        },
         .payload = { },
     };
+}
+
+auto rules() -> std::vector<dsp::router::rule_cfg> {
+    using enum dsp::router::action_type;
+    return {
+        { .name = "all",   .priority = 3, .condition = { .field = "*",      .value = "*" },         .action = include, .destination = "main-nb", .subject = "all" },
+        { .name = "hb",    .priority = 1, .condition = { .field = "type",   .value = "heartbeat" }, .action = include, .destination = "main-nb", .subject = "heartbeats" },
+        { .name = "other", .priority = 2, .condition = { .field = "type",   .value = "other" },     .action = include, .destination = "main-nb", .subject = "others" },
+        { .name = "prod",  .priority = 4, .condition = { .field = "source", .value = "prod" },      .action = exclude, .destination = "main-nb", .subject = "dev" },
+    };
+}
+
+/**
+ * @brief   Value of a counter labelled with `rule`.
+ */
+auto counter(dsp::metrics_registry& metrics, const std::string& name, const std::string& rule) -> double {
+    for (const auto& family : metrics.prometheus_handle()->Collect()) {
+        if (family.name != name) {
+            continue;
+        }
+        for (const auto& metric : family.metric) {
+            if (metric.label.size() == 1 and metric.label[0].value == rule) {
+                return metric.counter.value;
+            }
+        }
+    }
+    return -1;
+}
+
+auto subjects(const dsp::router::routes_t& xs) -> std::vector<std::string> {
+    auto ret = std::vector<std::string>{ };
+    for (const auto& x : xs) {
+        ret.push_back(x.subject.str());
+    }
+    return ret;
+}
 
+} // namespace
+
+TEST(Dsp, Router_Empty) {
     auto router = dsp::router{ };
-    const auto xs = router.route(msg);
-    ASSERT_GE(xs.size(), 1);
-    EXPECT_EQ(xs.size(), 1);
+    auto xs = dsp::router::routes_t{ };
+    router.route(heartbeat(), xs);
+    EXPECT_TRUE(xs.empty());
+}
+
+TEST(Dsp, Router_Priority) {
+    const auto router = dsp::router{ rules() };
+    auto xs = dsp::router::routes_t{ };
+
+    router.route(heartbeat(), xs);
+    EXPECT_THAT(subjects(xs), ElementsAre("heartbeats", "all", "dev"));
+    EXPECT_EQ(xs[0].destination, dsp::cache::Broadcast);
+    EXPECT_EQ(router.rule_name(xs[0].rule), "hb");
+
+    auto msg = heartbeat();
+    msg.properties.set("type", "other");
+    msg.properties.set("source", "prod");
+    router.route(msg, xs);
+    EXPECT_THAT(subjects(xs), ElementsAre("others", "all"));
+}
+
+TEST(Dsp, Router_Validate) {
+    auto xs = rules();
+    xs[0].priority = 1;
+    EXPECT_THROW(dsp::router{ xs }, nova::exception);
+
+    xs = rules();
+    xs[1].name = "all";
+    EXPECT_THROW(dsp::router{ xs }, nova::exception);
+
+    xs = rules();
+    xs[0].action = dsp::router::action_type::exclude;
+    EXPECT_THROW(dsp::router{ xs }, nova::exception);
+}
+
+TEST(Dsp, Router_Matchers) {
+    using enum dsp::router::action_type;
+    using enum dsp::router::match_type;
+
+    const auto router = dsp::router{ {
+        { .name = "prefix", .priority = 1, .condition = { .field = "type",     .value = "heart",        .matcher = prefix },               .action = include, .destination = "main-nb", .subject = "prefix" },
+        { .name = "glob",   .priority = 2, .condition = { .field = "type",     .value = "h?art[a-z]*",  .matcher = glob },                 .action = include, .destination = "main-nb", .subject = "glob" },
+        { .name = "regex",  .priority = 3, .condition = { .field = "id",       .value = "^dev-[0-9]+$", .matcher = regex },                .action = include, .destination = "main-nb", .subject = "regex" },
+        { .name = "noreg",  .priority = 4, .condition = { .field = "id",       .value = "^prod-",       .matcher = regex },                .action = exclude, .destination = "main-nb", .subject = "noreg" },
+        { .name = "range",  .priority = 5, .condition = { .field = "severity",                          .matcher = range, .min = 1, .max = 3 }, .action = include, .destination = "main-nb", .subject = "range" },
+        { .name = "other",  .priority = 6, .condition = { .field = "type",     .value = "beat*",        .matcher = glob },                 .action = include, .destination = "main-nb", .subject = "other" },
+    } };
+    auto xs = dsp::router::routes_t{ };
+
+    auto msg = heartbeat();
+    msg.properties.set("id", "dev-42");
+    msg.properties.set("severity", "2.5");
+    router.route(msg, xs);
+    EXPECT_THAT(subjects(xs), ElementsAre("prefix", "glob", "regex", "noreg", "range"));
+
+    msg.properties.set("id", "prod-42");
+    msg.properties.set("severity", "high");
+    router.route(msg, xs);
+    EXPECT_THAT(subjects(xs), ElementsAre("prefix", "glob"));
+
+    EXPECT_EQ(dsp::glob_to_regex("a.b*[!x]?"), R"(^a\.b.*[^x].$)");
+    EXPECT_THROW((dsp::router{ { { .name = "bad", .priority = 1, .condition = { .field = "id", .value = "(", .matcher = regex }, .destination = "main-nb", .subject = "x" } } }), nova::exception);
+}
+
+TEST(Dsp, Router_Expression) {
+    const auto node = YAML::Load(R"(
+        - name: eu
+          priority: 1
+          condition:
+            all:
+              - { field: type, value: heartbeat }
+              - any:
+                - { field: region, value: eu-, matcher: prefix }
+                - { field: severity, matcher: range, min: 3 }
+              - not: { field: source, value: test }
+          action: include
+          destination: main-nb
+          subject: eu
+        - name: not-eu
+          priority: 2
+          condition:
+            all:
+              - { field: type, value: heartbeat }
+              - any:
+                - { field: region, value: eu-, matcher: prefix }
+                - { field: severity, matcher: range, min: 3 }
+          action: exclude
+          destination: main-nb
+          subject: not-eu
+    )");
+
+    const auto router = dsp::router{ node.as<std::vector<dsp::router::rule_cfg>>() };
+    auto xs = dsp::router::routes_t{ };
+
+    auto msg = heartbeat();
+    msg.properties.set("region", "eu-west");
+    router.route(msg, xs);
+    EXPECT_THAT(subjects(xs), ElementsAre("eu"));
+
+    msg.properties.set("region", "us-east");
+    router.route(msg, xs);
+    EXPECT_THAT(subjects(xs), ElementsAre("not-eu"));
+
+    msg.properties.set("severity", "5");
+    msg.properties.set("source", "test");
+    router.route(msg, xs);
+    EXPECT_TRUE(xs.empty());
+}
+
+TEST(Dsp, Expression_Shared) {
+    auto fields = dsp::payload_fields{ };
+    auto set = dsp::expression_set{ };
+    const auto type = dsp::condition_cfg{ .field = "type", .value = "heartbeat" };
+    const auto a = set.add({ .op = dsp::condition_cfg::op_type::all, .operands = { type, { .field = "x", .value = "1" } } }, fields);
+    const auto b = set.add({ .op = dsp::condition_cfg::op_type::none, .operands = { { .op = dsp::condition_cfg::op_type::all, .operands = { type, { .field = "x", .value = "1" } } } } }, fields);
+
+    // type, x, all(type, x) and none(...)
+    EXPECT_EQ(set.size(), 4);
+
+    auto msg = heartbeat();
+    msg.properties.set("x", "1");
+    auto values = dsp::field_values{ fields, msg };
+    auto evaluate = dsp::expression_set::evaluator{ set, values };
+    EXPECT_TRUE(evaluate(a));
+    EXPECT_FALSE(evaluate(b));
+}
+
+TEST(Dsp, Expression_RangeBounds) {
+    auto fields = dsp::payload_fields{ };
+    auto set = dsp::expression_set{ };
+
+    // Equal once printed with 6 decimals, they must not be shared.
+    const auto a = set.add({ .field = "x", .matcher = dsp::match_type::range, .min = 1e-7 }, fields);
+    const auto b = set.add({ .field = "x", .matcher = dsp::match_type::range, .min = 2e-7 }, fields);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(set.add({ .field = "x", .matcher = dsp::match_type::range, .min = 1e-7 }, fields), a);
+}
+
+TEST(Dsp, Router_Payload) {
+    const auto node = YAML::Load(R"(
+        - name: model
+          priority: 1
+          condition: { field: "json:device.model", value: "x-*", matcher: glob }
+          action: include
+          destination: main-nb
+          subject: models
+        - name: eu
+          priority: 2
+          condition:
+            all:
+              - { field: "json:region", value: eu }
+              - { field: "json:severity", matcher: range, min: 3 }
+          action: include
+          destination: main-nb
+          subject: eu
+        - name: test
+          priority: 3
+          condition: { field: "json:device.test", value: "true" }
+          action: exclude
+          destination: main-nb
+          subject: prod
+        - name: region
+          priority: 4
+          condition: { field: "json:region", value: eu }
+          action: include
+          destination: main-nb
+          subject: region
+    )");
+
+    const auto router = dsp::router{ node.as<std::vector<dsp::router::rule_cfg>>() };
+    auto xs = dsp::router::routes_t{ };
+
+    const auto text = std::string{ R"({"region": "eu", "device": {"model": "x-1", "test": true}, "severity": 4})" };
+    auto msg = heartbeat();
+    msg.payload = dsp::payload_buffer::borrow({ reinterpret_cast<const std::byte*>(text.data()), text.size() });
+    router.route(msg, xs);
+    EXPECT_THAT(subjects(xs), ElementsAre("models", "eu", "region"));
+
+    router.route(heartbeat(), xs);
+    EXPECT_THAT(subjects(xs), ElementsAre("prod"));
+
+    EXPECT_THROW((dsp::router{ { { .name = "bad", .priority = 1, .condition = { .field = "bin:4:f32", .value = "1" }, .destination = "main-nb", .subject = "x" } } }), nova::exception);
+}
+
+TEST(Dsp, Router_Yaml) {
+    const auto node = YAML::Load(R"(
+        - name: hb
+          priority: 1
+          condition:
+            field: type
+            value: heartbeat
+            matcher: exact
+          action: include
+          destination: main-nb
+          subject: heartbeats
+    )");
+
+    const auto router = dsp::router{ node.as<std::vector<dsp::router::rule_cfg>>() };
+    auto xs = dsp::router::routes_t{ };
+    router.route(heartbeat(), xs);
+    EXPECT_THAT(subjects(xs), ElementsAre("heartbeats"));
+
+    const auto bad = YAML::Load(R"(
+        - name: hb
+          priority: 1
+          condition: { field: type, value: heartbeat, matcher: fuzzy }
+          action: include
+          destination: main-nb
+          subject: heartbeats
+    )");
+    EXPECT_THROW(static_cast<void>(bad.as<std::vector<dsp::router::rule_cfg>>()), nova::exception);
+}
+
+TEST(Dsp, Router_Resolve) {
+    auto cache = dsp::cache{ };
+    cache.attach_northbound("other-nb", std::make_unique<null_northbound>());
+    cache.attach_northbound("main-nb", std::make_unique<null_northbound>());
+
+    auto router = dsp::router{ rules() };
+    router.resolve(cache);
+
+    auto xs = dsp::router::routes_t{ };
+    router.route(heartbeat(), xs);
+    ASSERT_EQ(xs.size(), 3);
+    EXPECT_EQ(xs[0].destination, cache.resolve("main-nb"));
+    EXPECT_EQ(xs[0].destination.index, 1);
+
+    // Unknown destinations disable the rules.
+    auto unresolved = dsp::router{ rules() };
+    unresolved.resolve(dsp::cache{ });
+    unresolved.route(heartbeat(), xs);
+    EXPECT_TRUE(xs.empty());
+}
+
+TEST(Dsp, Router_Stats) {
+    const auto router = dsp::router{ rules() };
+    auto metrics = dsp::metrics_registry{ };
+    auto xs = dsp::router::routes_t{ };
+
+    auto other = heartbeat();
+    other.properties.set("type", "other");
+
+    router.route(heartbeat(), xs);
+    router.route(heartbeat(), xs);
+    router.route(other, xs);
+    router.update(metrics);
+
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "hb"), 2);
+    EXPECT_EQ(counter(metrics, "router_rule_misses_total", "hb"), 1);
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "all"), 3);
+
+    // Only increments are exported.
+    router.route(other, xs);
+    router.update(metrics);
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "hb"), 2);
+    EXPECT_EQ(counter(metrics, "router_rule_misses_total", "hb"), 2);
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "other"), 2);
+}
+
+TEST(Dsp, Router_StatsReplaced) {
+    auto previous = std::make_shared<const dsp::router>(rules());
+    auto current = dsp::router{ rules() };
+    current.replace(previous);
+
+    auto metrics = dsp::metrics_registry{ };
+    auto xs = dsp::router::routes_t{ };
+
+    // A handler still routing with the previous rules, alternating with the current ones.
+    previous->route(heartbeat(), xs);
+    current.route(heartbeat(), xs);
+    previous->route(heartbeat(), xs);
+    current.update(metrics);
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "hb"), 3);
+
+    // Counted after the last update of the previous router.
+    previous->route(heartbeat(), xs);
+    previous.reset();
+    current.update(metrics);
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "hb"), 4);
+
+    current.route(heartbeat(), xs);
+    current.update(metrics);
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "hb"), 5);
+}
+
+TEST(Dsp, Router_StatsReloadedTwice) {
+    auto first = std::make_shared<const dsp::router>(rules());
+    auto second = std::make_shared<dsp::router>(rules());
+    second->replace(first);
+    auto third = dsp::router{ rules() };
+    third.replace(second);
+    second.reset();
+
+    auto metrics = dsp::metrics_registry{ };
+    auto xs = dsp::router::routes_t{ };
+
+    // An idle handler still holds the rules of two reloads ago.
+    third.update(metrics);
+    first->route(heartbeat(), xs);
+    third.update(metrics);
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "hb"), 1);
+
+    first->route(heartbeat(), xs);
+    first.reset();
+    third.update(metrics);
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "hb"), 2);
 
-    EXPECT_EQ(xs[0].subject, "dev-test");
+    third.route(heartbeat(), xs);
+    third.update(metrics);
+    EXPECT_EQ(counter(metrics, "router_rule_hits_total", "hb"), 3);
 }
@@ -0,0 +1,222 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Router statistics
+ */
+
+#pragma once
+
+#include <libdsp/metrics.hpp>
+#include <libdsp/ring.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dsp {
+
+/**
+ * @brief   Rule hit counters and sampled routing cost.
+ *
+ * Every routing thread writes its own shard, so recording is a few relaxed
+ * stores without contention. Shards are summed by `update()` on the daemon
+ * tick, which exports the increments since the previous tick:
+ * - `router_rule_hits_total` and `router_rule_misses_total` (labels: rule),
+ * - `router_route_duration_seconds`, a histogram of one in `SampleEvery`
+ *   routed messages.
+ */
+class router_stats {
+public:
+    static constexpr std::uint64_t SampleEvery = 64;
+    static constexpr std::size_t LocalCacheSize = 4;
+
+    static constexpr std::array<double, 8> BucketBoundaries {
+        250e-9, 500e-9, 1e-6, 2.5e-6, 5e-6, 10e-6, 25e-6, 100e-6,
+    };
+
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @brief   Counters of one thread; only the owner thread writes them.
+     */
+    class alignas(CacheLineSize) shard {
+    public:
+        explicit shard(std::size_t rules)
+            : m_owner(std::this_thread::get_id())
+            , m_hits(rules)
+        {}
+
+        /**
+         * @returns true if the current message is timed.
+         */
+        [[nodiscard]] auto sample() -> bool {
+            return m_sequence++ % SampleEvery == 0;
+        }
+
+        void hit(std::uint32_t rule) {
+            add(m_hits[rule], 1);
+        }
+
+        void routed(std::optional<clock::duration> elapsed) {
+            add(m_messages, 1);
+            if (not elapsed.has_value()) {
+                return;
+            }
+
+            const auto seconds = std::chrono::duration<double>{ *elapsed }.count();
+            std::size_t bucket = 0;
+            while (bucket < BucketBoundaries.size() and seconds > BucketBoundaries[bucket]) {
+                ++bucket;
+            }
+            add(m_buckets[bucket], 1);
+            add(m_sum_ns, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(*elapsed).count()));
+        }
+
+    private:
+        friend class router_stats;
+
+        std::thread::id m_owner;
+        std::uint64_t m_sequence { 0 };
+
+        std::vector<std::atomic_uint64_t> m_hits;
+        std::atomic_uint64_t m_messages { 0 };
+        std::array<std::atomic_uint64_t, BucketBoundaries.size() + 1> m_buckets { };
+        std::atomic_uint64_t m_sum_ns { 0 };
+
+        /**
+         * @brief   Single writer: no read-modify-write needed, readers see whole values.
+         */
+        static void add(std::atomic_uint64_t& x, std::uint64_t n) {
+            x.store(x.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    };
+
+    explicit router_stats(std::size_t rules)
+        : m_id(next_id())
+        , m_rules(rules)
+        , m_exported_hits(rules, 0)
+        , m_exported_misses(rules, 0)
+    {}
+
+    router_stats(const router_stats&)             = delete;
+    router_stats& operator=(const router_stats&)  = delete;
+
+    ~router_stats() = default;
+
+    /**
+     * @brief   Shard of the calling thread, created at its first use.
+     *
+     * Each thread caches the shards of its last `LocalCacheSize` instances,
+     * so a thread routing with the old and the new rules during a reload
+     * does not take the lock at each message.
+     */
+    [[nodiscard]] auto local() -> shard& {
+        struct cache_t {
+            std::uint64_t id { 0 };
+            shard* value { nullptr };
+        };
+        static thread_local auto cache = std::array<cache_t, LocalCacheSize>{ };
+        static thread_local std::size_t next = 0;
+
+        for (const auto& entry : cache) {
+            if (entry.id == m_id) {
+                return *entry.value;
+            }
+        }
+
+        auto& entry = cache[next++ % LocalCacheSize];
+        entry = { m_id, &find_or_create() };
+        return *entry.value;
+    }
+
+    /**
+     * @brief   Export the increments since the previous call, it must be called by one thread.
+     *
+     * @param   names Names of the rules, by index.
+     */
+    void update(metrics_registry& metrics, std::span<const std::string> names) {
+        auto hits = std::vector<std::uint64_t>(m_rules, 0);
+        std::uint64_t messages = 0;
+        auto buckets = std::array<std::uint64_t, BucketBoundaries.size() + 1>{ };
+        std::uint64_t sum_ns = 0;
+
+        {
+            const auto lock = std::lock_guard{ m_mutex };
+            for (const auto& s : m_shards) {
+                for (std::size_t i = 0; i < m_rules; ++i) {
+                    hits[i] += s->m_hits[i].load(std::memory_order_relaxed);
+                }
+                messages += s->m_messages.load(std::memory_order_relaxed);
+                for (std::size_t i = 0; i < buckets.size(); ++i) {
+                    buckets[i] += s->m_buckets[i].load(std::memory_order_relaxed);
+                }
+                sum_ns += s->m_sum_ns.load(std::memory_order_relaxed);
+            }
+        }
+
+        for (std::size_t i = 0; i < m_rules and i < names.size(); ++i) {
+            // Counters are read one by one while routing goes on, a hit may be seen before its message.
+            const auto misses = std::max(messages, hits[i]) - hits[i];
+            const auto new_misses = std::max(misses, m_exported_misses[i]) - m_exported_misses[i];
+
+            const auto labels = prometheus::Labels{ { "rule", names[i] } };
+            metrics.increment("router_rule_hits_total", hits[i] - m_exported_hits[i], labels);
+            metrics.increment("router_rule_misses_total", new_misses, labels);
+            m_exported_misses[i] += new_misses;
+        }
+
+        auto increments = std::vector<double>(buckets.size(), 0);
+        for (std::size_t i = 0; i < buckets.size(); ++i) {
+            increments[i] = static_cast<double>(buckets[i] - m_exported_buckets[i]);
+        }
+        const auto sum = static_cast<double>(sum_ns - m_exported_sum_ns) * 1e-9;
+        metrics.observe_multiple("router_route_duration_seconds", { BucketBoundaries.begin(), BucketBoundaries.end() }, increments, sum);
+
+        m_exported_hits = std::move(hits);
+        m_exported_buckets = buckets;
+        m_exported_sum_ns = sum_ns;
+    }
+
+private:
+    const std::uint64_t m_id;
+    const std::size_t m_rules;
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<shard>> m_shards;
+
+    std::vector<std::uint64_t> m_exported_hits;
+    std::vector<std::uint64_t> m_exported_misses;
+    std::array<std::uint64_t, BucketBoundaries.size() + 1> m_exported_buckets { };
+    std::uint64_t m_exported_sum_ns { 0 };
+
+    /**
+     * @brief   Identify instances for the thread-local cache, addresses may be reused.
+     */
+    [[nodiscard]] static auto next_id() -> std::uint64_t {
+        static auto counter = std::atomic_uint64_t{ 0 };
+        return ++counter;
+    }
+
+    auto find_or_create() -> shard& {
+        const auto lock = std::lock_guard{ m_mutex };
+        for (const auto& s : m_shards) {
+            if (s->m_owner == std::this_thread::get_id()) {
+                return *s;
+            }
+        }
+        return *m_shards.emplace_back(std::make_unique<shard>(m_rules));
+    }
+
+};
+
+} // namespace dsp
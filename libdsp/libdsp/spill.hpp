@@ -0,0 +1,532 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Spill queue
+ *
+ * An append-only, memory-mapped segment log on local disk. It absorbs
+ * messages that cannot be enqueued into a northbound interface (e.g. the
+ * Kafka producer queue is full) so they can be replayed later instead of
+ * being dropped.
+ *
+ * Segment file layout:
+ * - 64-byte header: magic and the read offset (replay progress).
+ * - Records, 8-byte aligned: 4-byte body length, 4-byte CRC-32 of the length
+ *   and the body, then the body. A zero length or a checksum mismatch marks
+ *   the end of the data, e.g. a record torn by a crash, or stale bytes left
+ *   behind it.
+ *
+ * Dev note: the read offset is persisted in the mapping, therefore a restart
+ * resumes replaying where it stopped. A crash can replay the last few records
+ * again (at-least-once).
+ *
+ * Records are written to a shared mapping: they survive a crash of the
+ * process, but not of the host unless `config::sync` is set.
+ */
+
+#pragma once
+
+#include <libdsp/cache.hpp>
+
+#include <libnova/error.hpp>
+#include <libnova/log.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace dsp::spill {
+
+struct config {
+    std::filesystem::path directory;
+    std::size_t segment_size;
+    std::size_t max_segments;
+
+    /**
+     * @brief   Replay is paused while the producer queue is above this size.
+     */
+    std::size_t replay_queue_size;
+
+    /**
+     * @brief   Flush every record to disk (`msync`) before the append returns.
+     */
+    bool sync { false };
+};
+
+namespace detail {
+
+    constexpr std::uint64_t SegmentMagic = 0x4453'5053'494c'4c32;       // "DSPSILL2"
+    constexpr std::size_t HeaderSize = 64;
+    constexpr std::size_t Alignment = 8;
+    constexpr std::size_t LengthSize = sizeof(std::uint32_t);
+    constexpr std::size_t RecordHeaderSize = 2 * LengthSize;
+
+    constexpr auto CrcTable = []() {
+        auto table = std::array<std::uint32_t, 256>{ };
+        for (std::uint32_t i = 0; i < table.size(); ++i) {
+            auto x = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                x = (x & 1) != 0 ? 0xedb8'8320 ^ (x >> 1) : x >> 1;
+            }
+            table[i] = x;
+        }
+        return table;
+    }();
+
+    /**
+     * @brief   CRC-32 (IEEE), continued from `crc`.
+     */
+    [[nodiscard]] inline auto crc32(const std::byte* data, std::size_t size, std::uint32_t crc = 0) -> std::uint32_t {
+        crc = ~crc;
+        for (std::size_t i = 0; i < size; ++i) {
+            crc = CrcTable[(crc ^ static_cast<std::uint32_t>(data[i])) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    struct segment_header {
+        std::uint64_t magic;
+        std::uint64_t read_offset;
+    };
+
+    [[nodiscard]] constexpr auto align(std::size_t n) -> std::size_t {
+        return (n + Alignment - 1) & ~(Alignment - 1);
+    }
+
+    inline void put_u32(std::byte*& out, std::size_t value) {
+        const auto x = static_cast<std::uint32_t>(value);
+        std::memcpy(out, &x, sizeof(x));
+        out += sizeof(x);
+    }
+
+    inline void put_bytes(std::byte*& out, const void* data, std::size_t size) {
+        if (size > 0) {
+            std::memcpy(out, data, size);
+        }
+        out += size;
+    }
+
+    [[nodiscard]] inline auto get_u32(const std::byte*& in) -> std::size_t {
+        std::uint32_t x;
+        std::memcpy(&x, in, sizeof(x));
+        in += sizeof(x);
+        return x;
+    }
+
+    /**
+     * @brief   Size of the serialized message body.
+     */
+    [[nodiscard]] inline auto encoded_size(const message& msg) -> std::size_t {
+        auto size = 4 * LengthSize + msg.key.size() + msg.subject.size() + msg.payload.size();
+        for (const auto& [k, v] : msg.properties) {
+            size += 2 * LengthSize + k.size() + v.size();
+        }
+        return size;
+    }
+
+    /**
+     * @brief   Serialize a message: key, subject, properties, payload; each prefixed by its length.
+     */
+    inline void encode(const message& msg, std::byte* out) {
+        put_u32(out, msg.key.size());
+        put_bytes(out, msg.key.data(), msg.key.size());
+        put_u32(out, msg.subject.size());
+        put_bytes(out, msg.subject.data(), msg.subject.size());
+        put_u32(out, msg.properties.size());
+        for (const auto& [k, v] : msg.properties) {
+            put_u32(out, k.size());
+            put_bytes(out, k.data(), k.size());
+            put_u32(out, v.size());
+            put_bytes(out, v.data(), v.size());
+        }
+        put_u32(out, msg.payload.size());
+        put_bytes(out, msg.payload.data(), msg.payload.size());
+    }
+
+    [[nodiscard]] inline auto decode(const std::byte* in) -> message {
+        auto ret = message{ };
+
+        const auto as_chars = [](const std::byte* ptr) { return reinterpret_cast<const char*>(ptr); };
+
+        const auto key_size = get_u32(in);
+        ret.key = nova::data_view{ in, key_size };
+        in += key_size;
+
+        const auto subject_size = get_u32(in);
+        ret.subject = subject_ref{ std::string_view{ as_chars(in), subject_size } };
+        in += subject_size;
+
+        const auto n_properties = get_u32(in);
+        for (std::size_t i = 0; i < n_properties; ++i) {
+            const auto k_size = get_u32(in);
+            const auto k = std::string_view(as_chars(in), k_size);
+            in += k_size;
+
+            const auto v_size = get_u32(in);
+            const auto v = std::string_view(as_chars(in), v_size);
+            in += v_size;
+
+            ret.properties.set(k, v);
+        }
+
+        // Copied, the record is removed from the segment independently.
+        const auto payload_size = get_u32(in);
+        ret.payload = payload_buffer::copy(nova::data_view{ in, payload_size });
+
+        return ret;
+    }
+
+    /**
+     * @brief   A fixed-size, memory-mapped segment file.
+     *
+     * It is non-copyable and non-movable.
+     */
+    class segment {
+    public:
+
+        /**
+         * @brief   Open or create a segment file.
+         *
+         * Existing files are scanned for records to recover the write offset.
+         *
+         * @throws  if the file cannot be created or mapped.
+         */
+        segment(std::filesystem::path path, std::size_t size)
+            : m_path(std::move(path))
+            , m_size(size)
+        {
+            const int fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (fd == -1) {
+                throw nova::exception("Cannot open spill segment {}: {}", m_path.string(), std::strerror(errno));
+            }
+
+            if (::ftruncate(fd, static_cast<off_t>(m_size)) == -1) {
+                ::close(fd);
+                throw nova::exception("Cannot resize spill segment {}: {}", m_path.string(), std::strerror(errno));
+            }
+
+            void* ptr = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+
+            if (ptr == MAP_FAILED) {
+                throw nova::exception("Cannot map spill segment {}: {}", m_path.string(), std::strerror(errno));
+            }
+
+            m_data = static_cast<std::byte*>(ptr);
+            recover();
+        }
+
+        segment(const segment&)             = delete;
+        segment(segment&&)                  = delete;
+        segment& operator=(const segment&)  = delete;
+        segment& operator=(segment&&)       = delete;
+
+        ~segment() {
+            ::munmap(m_data, m_size);
+        }
+
+        /**
+         * @brief   Append a message.
+         *
+         * @returns false if the record does not fit into the segment.
+         */
+        [[nodiscard]] auto append(const message& msg, std::size_t body_size, bool sync = false) -> bool {
+            const auto record_size = align(RecordHeaderSize + body_size);
+            if (m_write_offset + record_size > m_size) {
+                return false;
+            }
+
+            auto* record = m_data + m_write_offset;
+            auto* out = record;
+            encode(msg, record + RecordHeaderSize);
+            put_u32(out, body_size);
+            put_u32(out, checksum(record, body_size));
+
+            if (sync) {
+                // The first record also flushes the header, without its magic the segment is not recovered.
+                const auto from = m_write_offset == HeaderSize ? 0 : m_write_offset;
+                flush(from, m_write_offset + record_size - from);
+            }
+
+            m_write_offset += record_size;
+            ++m_records;
+            return true;
+        }
+
+        [[nodiscard]] auto front() const -> message {
+            return decode(m_data + header().read_offset + RecordHeaderSize);
+        }
+
+        /**
+         * @brief   Remove the oldest record.
+         *
+         * @returns the size of the removed record on disk.
+         */
+        auto pop() -> std::size_t {
+            const auto record_size = align(RecordHeaderSize + length_at(header().read_offset));
+            header().read_offset += record_size;
+            --m_records;
+            return record_size;
+        }
+
+        [[nodiscard]] auto empty() const -> bool { return m_records == 0; }
+        [[nodiscard]] auto records() const -> std::size_t { return m_records; }
+        [[nodiscard]] auto pending_bytes() const -> std::size_t { return m_write_offset - header().read_offset; }
+        [[nodiscard]] auto path() const -> const std::filesystem::path& { return m_path; }
+
+    private:
+        std::filesystem::path m_path;
+        std::size_t m_size;
+        std::byte* m_data { nullptr };
+
+        std::size_t m_write_offset { HeaderSize };
+        std::size_t m_records { 0 };
+
+        [[nodiscard]] auto header() const -> segment_header& {
+            return *reinterpret_cast<segment_header*>(m_data);
+        }
+
+        [[nodiscard]] auto length_at(std::size_t offset) const -> std::size_t {
+            std::uint32_t length;
+            std::memcpy(&length, m_data + offset, sizeof(length));
+            return length;
+        }
+
+        /**
+         * @brief   Checksum of the length and the body of a record.
+         */
+        [[nodiscard]] static auto checksum(const std::byte* record, std::size_t body_size) -> std::uint32_t {
+            return crc32(record + RecordHeaderSize, body_size, crc32(record, LengthSize));
+        }
+
+        /**
+         * @brief   Write a range of the mapping to disk.
+         */
+        void flush(std::size_t offset, std::size_t size) const {
+            static const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            const auto begin = offset / page_size * page_size;
+            if (::msync(m_data + begin, offset + size - begin, MS_SYNC) == -1) {
+                nova::topic_log::warn("dsp", "Cannot sync spill segment {}: {}", m_path.string(), std::strerror(errno));
+            }
+        }
+
+        /**
+         * @brief   Restore offsets of an existing file or initialize a new one.
+         */
+        void recover() {
+            auto& hdr = header();
+            if (hdr.magic != SegmentMagic) {
+                hdr.magic = SegmentMagic;
+                hdr.read_offset = HeaderSize;
+                return;
+            }
+
+            std::size_t offset = HeaderSize;
+            while (offset + RecordHeaderSize <= m_size) {
+                const auto length = length_at(offset);
+                if (length == 0 || offset + RecordHeaderSize + length > m_size) {
+                    break;
+                }
+
+                if (length_at(offset + LengthSize) != checksum(m_data + offset, length)) {
+                    nova::topic_log::warn("dsp", "Spill segment {} is truncated at offset {}, corrupted record", m_path.string(), offset);
+                    break;
+                }
+
+                if (offset >= hdr.read_offset) {
+                    ++m_records;
+                }
+
+                offset += align(RecordHeaderSize + length);
+            }
+
+            m_write_offset = offset;
+            hdr.read_offset = std::min(hdr.read_offset, m_write_offset);
+        }
+    };
+
+} // namespace detail
+
+/**
+ * @brief   A bounded FIFO of messages persisted in memory-mapped segment files.
+ *
+ * Disk usage is bounded by `segment_size * max_segments`. Fully replayed
+ * segments are deleted.
+ *
+ * Thread-safe; designed for one or more appending threads and one replaying
+ * thread.
+ */
+class segment_log {
+public:
+
+    /**
+     * @brief   Open the spill directory and recover existing segments.
+     *
+     * @throws  if the directory or a segment cannot be created.
+     */
+    segment_log(config cfg)
+        : m_cfg(std::move(cfg))
+    {
+        if (m_cfg.segment_size <= detail::HeaderSize) {
+            throw nova::exception("Spill segment size is too small: {}", m_cfg.segment_size);
+        }
+
+        std::filesystem::create_directories(m_cfg.directory);
+        recover();
+    }
+
+    /**
+     * @brief   Append a message to the end of the log.
+     *
+     * @returns false if the disk quota is exhausted or the message is larger than a segment.
+     */
+    [[nodiscard]] auto append(const message& msg) -> bool {
+        const auto body_size = detail::encoded_size(msg);
+
+        // It would not fit in a new segment either, do not create one for nothing.
+        if (detail::align(detail::RecordHeaderSize + body_size) > m_cfg.segment_size - detail::HeaderSize) {
+            return false;
+        }
+
+        std::lock_guard lock(m_mtx);
+
+        if (m_segments.empty() || not m_segments.back()->append(msg, body_size, m_cfg.sync)) {
+            if (m_segments.size() >= m_cfg.max_segments) {
+                return false;
+            }
+
+            m_segments.push_back(create_segment());
+            if (not m_segments.back()->append(msg, body_size, m_cfg.sync)) {
+                return false;
+            }
+        }
+
+        m_depth.fetch_add(1, std::memory_order_release);
+        m_bytes.fetch_add(detail::align(detail::RecordHeaderSize + body_size), std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief   Return a copy of the oldest message without removing it.
+     */
+    [[nodiscard]] auto front() -> std::optional<message> {
+        std::lock_guard lock(m_mtx);
+        drop_drained();
+
+        if (m_segments.empty() || m_segments.front()->empty()) {
+            return std::nullopt;
+        }
+
+        return m_segments.front()->front();
+    }
+
+    /**
+     * @brief   Remove the oldest message.
+     */
+    void pop() {
+        std::lock_guard lock(m_mtx);
+        drop_drained();
+
+        if (m_segments.empty() || m_segments.front()->empty()) {
+            return;
+        }
+
+        const auto record_size = m_segments.front()->pop();
+        m_depth.fetch_sub(1, std::memory_order_release);
+        m_bytes.fetch_sub(record_size, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief   Lock-free check, safe to call on the hot path.
+     */
+    [[nodiscard]] auto empty() const -> bool {
+        return m_depth.load(std::memory_order_acquire) == 0;
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t { return m_depth.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief   Disk space used by pending records (including framing).
+     */
+    [[nodiscard]] auto bytes() const -> std::size_t { return m_bytes.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief   Disk quota of the log.
+     */
+    [[nodiscard]] auto capacity() const -> std::size_t { return m_cfg.segment_size * m_cfg.max_segments; }
+
+private:
+    config m_cfg;
+    std::mutex m_mtx;
+    std::deque<std::unique_ptr<detail::segment>> m_segments;
+    std::uint64_t m_next_sequence { 0 };
+
+    std::atomic<std::size_t> m_depth { 0 };
+    std::atomic<std::size_t> m_bytes { 0 };
+
+    [[nodiscard]] auto segment_path(std::uint64_t sequence) const -> std::filesystem::path {
+        return m_cfg.directory / fmt::format("segment-{:020}.log", sequence);
+    }
+
+    [[nodiscard]] auto create_segment() -> std::unique_ptr<detail::segment> {
+        return std::make_unique<detail::segment>(segment_path(m_next_sequence++), m_cfg.segment_size);
+    }
+
+    /**
+     * @brief   Delete fully replayed segments, except the one being written.
+     */
+    void drop_drained() {
+        while (m_segments.size() > 1 && m_segments.front()->empty()) {
+            const auto path = m_segments.front()->path();
+            m_segments.pop_front();
+            std::filesystem::remove(path);
+        }
+    }
+
+    /**
+     * @brief   Reopen segment files left behind by a previous run, in sequence order.
+     */
+    void recover() {
+        auto paths = std::vector<std::filesystem::path>{ };
+        for (const auto& entry : std::filesystem::directory_iterator(m_cfg.directory)) {
+            const auto name = entry.path().filename().string();
+            if (entry.is_regular_file() && name.starts_with("segment-") && name.ends_with(".log")) {
+                paths.push_back(entry.path());
+            }
+        }
+
+        std::ranges::sort(paths);
+
+        for (const auto& path : paths) {
+            auto seg = std::make_unique<detail::segment>(path, std::filesystem::file_size(path));
+            m_depth += seg->records();
+            m_bytes += seg->pending_bytes();
+            m_segments.push_back(std::move(seg));
+
+            const auto stem = path.stem().string();
+            m_next_sequence = std::max<std::uint64_t>(m_next_sequence, std::stoull(stem.substr(stem.find('-') + 1)) + 1);
+        }
+
+        drop_drained();
+
+        if (not m_segments.empty()) {
+            nova::topic_log::info("dsp", "Recovered {} spilled messages from {}", size(), m_cfg.directory.string());
+        }
+    }
+};
+
+} // namespace dsp::spill
@@ -0,0 +1,178 @@
+#include <libdsp/spill.hpp>
+
+#include <gmock/gmock.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace testing;
+
+namespace {
+
+constexpr std::size_t SegmentSize = 4096;
+
+/**
+ * @brief   Spill directory, removed with its segments.
+ */
+struct spill_dir {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / fmt::format("dsp-spill-{}", ::getpid());
+
+    spill_dir() {
+        std::filesystem::remove_all(path);
+    }
+
+    ~spill_dir() {
+        std::filesystem::remove_all(path);
+    }
+
+    spill_dir(const spill_dir&)             = delete;
+    spill_dir& operator=(const spill_dir&)  = delete;
+
+    [[nodiscard]] auto open(std::size_t max_segments = 4) const -> dsp::spill::segment_log {
+        return dsp::spill::segment_log{ { .directory = path, .segment_size = SegmentSize, .max_segments = max_segments, .replay_queue_size = 0 } };
+    }
+
+    /**
+     * @brief   Overwrite bytes of the first segment, as a crash in the middle of a write would leave them.
+     */
+    void overwrite(std::size_t offset, const std::vector<std::byte>& bytes) const {
+        auto file = std::fstream{ path / "segment-00000000000000000000.log", std::ios::in | std::ios::out | std::ios::binary };
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+};
+
+auto make(const std::string& payload) -> dsp::message {
+    return dsp::message{
+        .key = nova::data_view{ "key" },
+        .subject = dsp::subject_ref{ "subject" },
+        .properties = { { "type", "test" } },
+        .payload = dsp::payload_buffer::copy(nova::data_view{ payload })
+    };
+}
+
+/**
+ * @brief   Size of the record holding `msg` in a segment.
+ */
+auto record_size(const dsp::message& msg) -> std::size_t {
+    return dsp::spill::detail::align(dsp::spill::detail::RecordHeaderSize + dsp::spill::detail::encoded_size(msg));
+}
+
+auto pop_all(dsp::spill::segment_log& log) -> std::vector<std::string> {
+    auto ret = std::vector<std::string>{ };
+    while (auto msg = log.front()) {
+        ret.push_back(msg->payload.view().as_string());
+        log.pop();
+    }
+    return ret;
+}
+
+} // namespace
+
+TEST(Dsp, Spill_AppendPop) {
+    const auto dir = spill_dir{ };
+    auto log = dir.open();
+    EXPECT_TRUE(log.empty());
+
+    ASSERT_TRUE(log.append(make("a")));
+    ASSERT_TRUE(log.append(make("b")));
+    EXPECT_EQ(log.size(), 2);
+    EXPECT_EQ(log.bytes(), 2 * record_size(make("a")));
+
+    const auto front = log.front();
+    ASSERT_TRUE(front.has_value());
+    EXPECT_EQ(front->key.view().as_string(), "key");
+    EXPECT_EQ(front->subject, "subject");
+    EXPECT_EQ(front->properties.find("type"), "test");
+
+    EXPECT_THAT(pop_all(log), ElementsAre("a", "b"));
+    EXPECT_TRUE(log.empty());
+    EXPECT_EQ(log.bytes(), 0);
+}
+
+TEST(Dsp, Spill_Quota) {
+    const auto dir = spill_dir{ };
+    auto log = dir.open(2);
+    const auto big = std::string(SegmentSize / 3, 'x');
+
+    auto appended = 0;
+    while (log.append(make(big))) {
+        ++appended;
+    }
+    EXPECT_EQ(appended, 4);
+    EXPECT_FALSE(log.append(make(std::string(SegmentSize, 'x'))));
+
+    // Drained segments are deleted, making room again.
+    log.pop();
+    log.pop();
+    log.pop();
+    EXPECT_TRUE(log.append(make(big)));
+    EXPECT_EQ(log.size(), 2);
+}
+
+TEST(Dsp, Spill_Oversized) {
+    const auto dir = spill_dir{ };
+    auto log = dir.open(2);
+
+    // Rejected without using up the quota.
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_FALSE(log.append(make(std::string(SegmentSize, 'x'))));
+    }
+    EXPECT_TRUE(log.empty());
+    EXPECT_EQ(std::distance(std::filesystem::directory_iterator{ dir.path }, std::filesystem::directory_iterator{ }), 0);
+
+    const auto big = std::string(SegmentSize / 3, 'x');
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_TRUE(log.append(make(big)));
+    }
+}
+
+TEST(Dsp, Spill_Reopen) {
+    const auto dir = spill_dir{ };
+    {
+        auto log = dir.open();
+        for (const auto* x : { "a", "b", "c" }) {
+            ASSERT_TRUE(log.append(make(x)));
+        }
+        log.pop();
+    }
+
+    auto log = dir.open();
+    EXPECT_EQ(log.size(), 2);
+    ASSERT_TRUE(log.append(make("d")));
+    EXPECT_THAT(pop_all(log), ElementsAre("b", "c", "d"));
+}
+
+TEST(Dsp, Spill_TornTail) {
+    const auto dir = spill_dir{ };
+    const auto second = dsp::spill::detail::HeaderSize + record_size(make("a"));
+    {
+        auto log = dir.open();
+        ASSERT_TRUE(log.append(make("a")));
+        ASSERT_TRUE(log.append(make("bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb")));
+    }
+
+    // Corrupted body, e.g. the length was written but not all of the body.
+    dir.overwrite(second + dsp::spill::detail::RecordHeaderSize + 2, { std::byte{ 0xff } });
+    {
+        auto log = dir.open();
+        EXPECT_EQ(log.size(), 1);
+    }
+
+    // Body written, but not its length: a shorter record written at the same
+    // place leaves the end of the old body behind it.
+    dir.overwrite(second, std::vector<std::byte>(dsp::spill::detail::RecordHeaderSize));
+    {
+        auto log = dir.open();
+        EXPECT_EQ(log.size(), 1);
+        ASSERT_TRUE(log.append(make("c")));
+    }
+
+    auto log = dir.open();
+    EXPECT_THAT(pop_all(log), ElementsAre("a", "c"));
+}
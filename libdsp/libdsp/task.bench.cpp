@@ -0,0 +1,96 @@
+#include <libdsp/task.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int TasksPerIteration = 10'000;
+
+/**
+ * @brief   A few hundred nanoseconds of work.
+ */
+void work(std::atomic_int& done) {
+    auto x = std::uint64_t{ 0 };
+    for (int i = 0; i < 100; ++i) {
+        benchmark::DoNotOptimize(x += static_cast<std::uint64_t>(i));
+    }
+    done.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief   Baseline: workers sharing one `dsp::queue` of `std::function`.
+ */
+void BM_Queue(benchmark::State& state) {
+    auto tasks = dsp::queue<std::function<void()>>{ };
+    auto done = std::atomic_int{ 0 };
+
+    auto workers = std::vector<std::jthread>{ };
+    for (int i = 0; i < state.range(0); ++i) {
+        workers.emplace_back([&]() {
+            while (auto f = tasks.pop()) {
+                f();
+            }
+        });
+    }
+
+    for (auto _ : state) {
+        done.store(0);
+        for (int i = 0; i < TasksPerIteration; ++i) {
+            tasks.push([&done]() { work(done); });
+        }
+        while (done.load() < TasksPerIteration) {
+            std::this_thread::yield();
+        }
+    }
+
+    // An empty function stops a worker.
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+        tasks.push({ });
+    }
+    state.SetItemsProcessed(state.iterations() * TasksPerIteration);
+}
+
+void BM_ThreadPool(benchmark::State& state) {
+    auto pool = dsp::thread_pool{ static_cast<std::size_t>(state.range(0)) };
+    auto done = std::atomic_int{ 0 };
+
+    for (auto _ : state) {
+        done.store(0);
+        for (int i = 0; i < TasksPerIteration; ++i) {
+            pool.submit([&done]() { work(done); });
+        }
+        pool.wait();
+    }
+    state.SetItemsProcessed(state.iterations() * TasksPerIteration);
+}
+
+/**
+ * @brief   Tasks spread over 64 keys, ordered per key.
+ */
+void BM_ThreadPoolKeyed(benchmark::State& state) {
+    auto pool = dsp::thread_pool{ static_cast<std::size_t>(state.range(0)) };
+    auto done = std::atomic_int{ 0 };
+
+    for (auto _ : state) {
+        done.store(0);
+        for (int i = 0; i < TasksPerIteration; ++i) {
+            pool.submit(static_cast<std::uint64_t>(i % 64), [&done]() { work(done); });
+        }
+        pool.wait();
+    }
+    state.SetItemsProcessed(state.iterations() * TasksPerIteration);
+}
+
+} // namespace
+
+BENCHMARK(BM_Queue)->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK(BM_ThreadPool)->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK(BM_ThreadPoolKeyed)->Arg(1)->Arg(4)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -1,111 +1,449 @@
+/**
+ * Part of Data Stream Processing framework.
+ *
+ * DSP - Tasks and thread pool
+ */
+
 #pragma once
 
+#include <libdsp/ring.hpp>
+
+#include <libnova/log.hpp>
+
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
+#include <optional>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace dsp {
 
+/**
+ * @brief   Bounded blocking queue, for any number of producers and consumers.
+ *
+ * Values go through a lock-free ring (`mpmc_ring`); `push()` waits while the
+ * queue is full and `pop()` while it is empty, spinning briefly before
+ * sleeping (see `event_count`). Neither takes a lock nor enters the kernel
+ * while the other side keeps up.
+ */
 template <typename T>
 class queue {
 public:
+    static constexpr std::size_t DefaultCapacity = 4096;
+
+    explicit queue(std::size_t capacity = DefaultCapacity)
+        : m_ring(capacity)
+    {}
+
     void push(T value) {
-        {
-            std::lock_guard lock(m_mtx);
-            m_queue.push(std::move(value));
-        }
-        m_cv.notify_one();
+        m_not_full.wait([&]() { return m_ring.try_push(std::move(value)); });
+        m_not_empty.notify();
     }
 
     T pop() {
-        std::unique_lock lock(m_mtx);
-        m_cv.wait(lock, [&]{ return not m_queue.empty(); });
-        T value = std::move(m_queue.front());
-        m_queue.pop();
+        auto value = T{ };
+        m_not_empty.wait([&]() { return m_ring.try_pop(value); });
+        m_not_full.notify();
         return value;
     }
 
+    /**
+     * @returns false if the queue is full, the value is not moved from then.
+     */
+    [[nodiscard]] auto try_push(T&& value) -> bool {
+        if (not m_ring.try_push(std::move(value))) {
+            return false;
+        }
+        m_not_empty.notify();
+        return true;
+    }
+
+    /**
+     * @returns false if the queue is empty.
+     */
+    [[nodiscard]] auto try_pop(T& out) -> bool {
+        if (not m_ring.try_pop(out)) {
+            return false;
+        }
+        m_not_full.notify();
+        return true;
+    }
+
+    [[nodiscard]] auto size()     const -> std::size_t { return m_ring.size(); }
+    [[nodiscard]] auto capacity() const -> std::size_t { return m_ring.capacity(); }
+
 private:
-    std::queue<T> m_queue;
-    std::mutex m_mtx;
-    std::condition_variable m_cv;
+    mpmc_ring<T> m_ring;
+    event_count m_not_empty;
+    event_count m_not_full;
+
 };
 
+/**
+ * @brief   A move-only callable, stored inline when it is small enough.
+ *
+ * Unlike `std::function`, submitting a lambda capturing a few pointers (up to
+ * `InlineSize` bytes) does not allocate; larger callables are moved to the
+ * heap. A task is one cache line.
+ */
 class task {
 public:
-    task(std::function<void()> func)
-        : m_func(std::move(func))
-    {}
+    static constexpr std::size_t InlineSize = 48;
+
+    task() = default;
 
-    task(const task&) = delete;
-    task& operator=(const task&) = delete;
+    template <typename F>
+        requires (not std::is_same_v<std::decay_t<F>, task> and std::is_invocable_v<std::decay_t<F>&>)
+    task(F&& func) {
+        using T = std::decay_t<F>;
+
+        if constexpr (fits_inline<T>) {
+            ::new (static_cast<void*>(m_storage)) T(std::forward<F>(func));
+            m_ops = &inline_ops<T>;
+        } else {
+            ::new (static_cast<void*>(m_storage)) T*(new T(std::forward<F>(func)));
+            m_ops = &heap_ops<T>;
+        }
+    }
+
+    task(task&& other) noexcept
+        : m_ops(std::exchange(other.m_ops, nullptr))
+    {
+        if (m_ops != nullptr) {
+            m_ops->move(m_storage, other.m_storage);
+        }
+    }
+
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            m_ops = std::exchange(other.m_ops, nullptr);
+            if (m_ops != nullptr) {
+                m_ops->move(m_storage, other.m_storage);
+            }
+        }
+        return *this;
+    }
+
+    task(const task&)             = delete;
+    task& operator=(const task&)  = delete;
+
+    ~task() {
+        reset();
+    }
 
     void operator()() {
-        return std::invoke(m_func);
+        m_ops->invoke(m_storage);
     }
 
+    [[nodiscard]] explicit operator bool() const { return m_ops != nullptr; }
+
+    /**
+     * @returns true if the callable is stored without allocation.
+     */
+    [[nodiscard]] auto is_inline() const -> bool { return m_ops != nullptr and m_ops->is_inline; }
+
 private:
-    std::function<void()> m_func;
+    struct ops_t {
+        void (*invoke)(void*);
 
-};
+        /**
+         * @brief   Move-construct into `dst` and destroy `src`.
+         */
+        void (*move)(void* dst, void* src) noexcept;
+        void (*destroy)(void*) noexcept;
+        bool is_inline;
+    };
 
-template <typename InputT, typename OutputT>
-struct pipe {
-    queue<InputT> in;
-    queue<OutputT> out;
+    template <typename T>
+    static constexpr bool fits_inline = sizeof(T) <= InlineSize
+        and alignof(T) <= alignof(std::max_align_t)
+        and std::is_nothrow_move_constructible_v<T>;
 
-    // TODO: pop and push ?
-};
+    template <typename T>
+    static constexpr ops_t inline_ops {
+        .invoke = [](void* p) { std::invoke(*static_cast<T*>(p)); },
+        .move = [](void* dst, void* src) noexcept {
+            ::new (dst) T(std::move(*static_cast<T*>(src)));
+            static_cast<T*>(src)->~T();
+        },
+        .destroy = [](void* p) noexcept { static_cast<T*>(p)->~T(); },
+        .is_inline = true,
+    };
 
-template <typename InputT, typename OutputT>
-class worker {
-public:
-    worker(std::shared_ptr<pipe<InputT, OutputT>> pipe)
-        : m_thread(create())
-        , m_pipe(std::move(pipe))
-    {}
+    template <typename T>
+    static constexpr ops_t heap_ops {
+        .invoke = [](void* p) { std::invoke(**static_cast<T**>(p)); },
+        .move = [](void* dst, void* src) noexcept { ::new (dst) T*(*static_cast<T**>(src)); },
+        .destroy = [](void* p) noexcept { delete *static_cast<T**>(p); },
+        .is_inline = false,
+    };
 
-private:
-    std::jthread m_thread;
-    std::atomic_bool m_alive { true };
-    std::shared_ptr<pipe<InputT, OutputT>> m_pipe;
-
-    auto create() -> std::jthread {
-        return [this]() {
-            while (m_alive) {
-                auto message = m_pipe->in.pop();
-                m_pipe->out.push(m_process(message));
-            }
-        };
+    alignas(std::max_align_t) std::byte m_storage[InlineSize];
+    const ops_t* m_ops { nullptr };
+
+    void reset() {
+        if (m_ops != nullptr) {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
     }
+
 };
 
-// TODO(refact): Avoid type contamination.
-template <typename InputT, typename OutputT>
+/**
+ * @brief   Work-stealing thread pool.
+ *
+ * Every worker has its own deque: tasks submitted from a worker go to its
+ * deque, others are spread round-robin. A worker runs its tasks in order,
+ * and when it has none left it steals the newest task of another worker
+ * before going to sleep. Deques are guarded by their own mutex, so submitting
+ * threads and workers only contend when they touch the same deque.
+ *
+ * Idle workers sleep on a condition variable, submitting only takes its
+ * mutex to wake one when some are asleep.
+ *
+ * Keyed tasks run in submission order and one at a time per key, see
+ * `submit(key, task)`. Exceptions escaping a task are logged.
+ */
 class thread_pool {
 public:
-    thread_pool(int jobs, task<InputT, OutpuT>)
-        : n_jobs(jobs)
+    /**
+     * @brief   Keyed tasks are serialized per strand, there are `StrandsPerWorker` per worker.
+     */
+    static constexpr std::size_t StrandsPerWorker = 4;
+
+    /**
+     * @brief   Keyed tasks run by a strand before it yields the worker to other tasks.
+     */
+    static constexpr std::size_t StrandBatch = 64;
+
+    explicit thread_pool(std::size_t jobs = std::thread::hardware_concurrency())
+        : m_queues(std::max<std::size_t>(jobs, 1))
+        , m_strands(m_queues.size() * StrandsPerWorker)
     {
-        for (int i = 0; i < jobs; ++i) {
-            m_workers.emplace_back(m_pipe);
+        m_threads.reserve(m_queues.size());
+        for (std::size_t i = 0; i < m_queues.size(); ++i) {
+            m_threads.emplace_back([this, i]() { run(i); });
         }
     }
 
-    // TODO(feat): Runtime reconfiguration
-    // void jobs(int n) {
-        // n_jobs = n;
-    // }
+    thread_pool(const thread_pool&)             = delete;
+    thread_pool& operator=(const thread_pool&)  = delete;
+
+    /**
+     * @brief   Run the pending tasks, then stop the workers.
+     */
+    ~thread_pool() {
+        m_stop.store(true);
+        m_epoch.fetch_add(1);
+        {
+            const auto lock = std::lock_guard{ m_sleep_mutex };
+        }
+        m_sleep.notify_all();
+        m_threads.clear();
+    }
+
+    void submit(task t) {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+
+        auto i = current_worker();
+        if (not i.has_value()) {
+            i = m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+        }
+
+        {
+            auto& q = m_queues[*i];
+            const auto lock = std::lock_guard{ q.mutex };
+            q.tasks.push_back(std::move(t));
+        }
+
+        wake();
+    }
+
+    /**
+     * @brief   Submit a task ordered with the other tasks of the same key.
+     *
+     * Tasks of a key run one after the other, in submission order, possibly
+     * on different workers. Keys are hashed onto a fixed number of strands:
+     * keys sharing a strand are serialized too.
+     */
+    void submit(std::uint64_t key, task t) {
+        auto& s = m_strands[std::hash<std::uint64_t>{ }(key) % m_strands.size()];
+
+        {
+            const auto lock = std::lock_guard{ s.mutex };
+            s.tasks.push_back(std::move(t));
+            if (s.scheduled) {
+                return;
+            }
+            s.scheduled = true;
+        }
+
+        submit([this, &s]() { drain(s); });
+    }
+
+    /**
+     * @brief   Wait until all the submitted tasks (and the tasks they submitted) ran.
+     *
+     * It must not be called from a task.
+     */
+    void wait() {
+        for (auto n = m_pending.load(); n != 0; n = m_pending.load()) {
+            m_pending.wait(n);
+        }
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t { return m_queues.size(); }
 
 private:
-    int n_jobs;
-    std::shared_ptr<pipe<InputT, OutputT>> m_pipe = std::make_shared<pipe<InputT, OutputT>>();
-    std::vector<worker<InputT, OutputT>> m_workers;
+    struct alignas(CacheLineSize) worker_queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    struct alignas(CacheLineSize) strand {
+        std::mutex mutex;
+        std::deque<task> tasks;
+        bool scheduled { false };
+    };
+
+    struct worker_id {
+        const thread_pool* pool { nullptr };
+        std::size_t index { 0 };
+    };
+
+    std::vector<worker_queue> m_queues;
+    std::vector<strand> m_strands;
+
+    alignas(CacheLineSize) std::atomic_size_t m_next { 0 };
+    alignas(CacheLineSize) std::atomic_uint64_t m_pending { 0 };
+    alignas(CacheLineSize) std::atomic_uint32_t m_epoch { 0 };
+    std::atomic_uint32_t m_idle { 0 };
+    std::atomic_uint32_t m_notified { 0 };
+    std::atomic_bool m_stop { false };
+
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_sleep;
+
+    std::vector<std::jthread> m_threads;
+
+    [[nodiscard]] static auto local() -> worker_id& {
+        static thread_local auto instance = worker_id{ };
+        return instance;
+    }
+
+    [[nodiscard]] auto current_worker() const -> std::optional<std::size_t> {
+        const auto& id = local();
+        return id.pool == this ? std::optional{ id.index } : std::nullopt;
+    }
+
+    /**
+     * @brief   A new task is visible: wake a sleeping worker, if any.
+     *
+     * The epoch and idle counters are sequentially consistent: either the
+     * worker going to sleep sees the new epoch, or this sees it idle. A
+     * sleeping worker is notified once, until it wakes up further tasks are
+     * left to it.
+     */
+    void wake() {
+        m_epoch.fetch_add(1);
+        if (m_idle.load() > m_notified.load()) {
+            const auto lock = std::lock_guard{ m_sleep_mutex };
+            if (m_idle.load() > m_notified.load()) {
+                m_notified.fetch_add(1);
+                m_sleep.notify_one();
+            }
+        }
+    }
+
+    /**
+     * @brief   Own oldest task, or another worker's newest one.
+     */
+    auto next(std::size_t self) -> std::optional<task> {
+        for (std::size_t n = 0; n < m_queues.size(); ++n) {
+            auto& q = m_queues[(self + n) % m_queues.size()];
+            const auto lock = std::lock_guard{ q.mutex };
+            if (q.tasks.empty()) {
+                continue;
+            }
+
+            auto& t = n == 0 ? q.tasks.front() : q.tasks.back();
+            auto ret = std::optional{ std::move(t) };
+            n == 0 ? q.tasks.pop_front() : q.tasks.pop_back();
+            return ret;
+        }
+        return std::nullopt;
+    }
+
+    void run(std::size_t self) {
+        local() = { this, self };
+
+        while (true) {
+            const auto epoch = m_epoch.load();
+
+            if (auto t = next(self); t.has_value()) {
+                execute(*t);
+                if (m_pending.fetch_sub(1) == 1) {
+                    m_pending.notify_all();
+                }
+                continue;
+            }
+
+            if (m_stop.load()) {
+                return;
+            }
+
+            auto lock = std::unique_lock{ m_sleep_mutex };
+            m_idle.fetch_add(1);
+            m_sleep.wait(lock, [&]() { return m_epoch.load() != epoch; });
+            m_idle.fetch_sub(1);
+            if (m_notified.load() > 0) {
+                m_notified.fetch_sub(1);
+            }
+        }
+    }
+
+    static void execute(task& t) {
+        try {
+            t();
+        } catch (const std::exception& ex) {
+            nova::topic_log::error("dsp", "A task failed: {}", ex.what());
+        }
+    }
+
+    /**
+     * @brief   Run the tasks of a strand, rescheduling it after a batch for fairness.
+     */
+    void drain(strand& s) {
+        for (std::size_t n = 0; n < StrandBatch; ++n) {
+            auto t = task{ };
+            {
+                const auto lock = std::lock_guard{ s.mutex };
+                if (s.tasks.empty()) {
+                    s.scheduled = false;
+                    return;
+                }
+                t = std::move(s.tasks.front());
+                s.tasks.pop_front();
+            }
+            execute(t);
+        }
+
+        submit([this, &s]() { drain(s); });
+    }
 
 };
 
-}
+} // namespace dsp
@@ -0,0 +1,108 @@
+#include <libdsp/task.hpp>
+
+#include <gmock/gmock.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+using namespace testing;
+
+TEST(Dsp, Task_SmallBuffer) {
+    int n = 0;
+    auto small = dsp::task{ [&n]() { ++n; } };
+    EXPECT_TRUE(small.is_inline());
+
+    auto big = dsp::task{ [&n, padding = std::array<char, 64>{ }]() { n += 10 + padding[0]; } };
+    EXPECT_FALSE(big.is_inline());
+
+    auto owner = std::make_shared<int>(100);
+    auto shared = dsp::task{ [&n, owner]() { n += *owner; } };
+    EXPECT_TRUE(shared.is_inline());
+    EXPECT_EQ(owner.use_count(), 2);
+
+    auto moved = std::move(shared);
+    EXPECT_FALSE(static_cast<bool>(shared));
+    small();
+    big();
+    moved();
+    EXPECT_EQ(n, 111);
+
+    moved = std::move(big);
+    EXPECT_EQ(owner.use_count(), 1);
+    moved();
+    EXPECT_EQ(n, 121);
+}
+
+TEST(Dsp, ThreadPool_Submit) {
+    auto counter = std::atomic_int{ 0 };
+    auto pool = dsp::thread_pool{ 4 };
+
+    for (int i = 0; i < 1000; ++i) {
+        pool.submit([&]() {
+            counter.fetch_add(1);
+            pool.submit([&]() { counter.fetch_add(1); });
+        });
+    }
+    pool.submit([]() { throw std::runtime_error("failure"); });
+
+    pool.wait();
+    EXPECT_EQ(counter.load(), 2000);
+}
+
+TEST(Dsp, ThreadPool_Keyed) {
+    constexpr std::uint64_t Keys = 16;
+    constexpr int PerKey = 500;
+
+    struct state_t {
+        std::vector<int> values;
+        std::atomic_bool running { false };
+        std::atomic_int overlaps { 0 };
+    };
+    auto states = std::array<state_t, Keys>{ };
+
+    auto pool = dsp::thread_pool{ 4 };
+    for (int i = 0; i < PerKey; ++i) {
+        for (std::uint64_t key = 0; key < Keys; ++key) {
+            pool.submit(key, [&s = states[key], i]() {
+                if (s.running.exchange(true)) {
+                    s.overlaps.fetch_add(1);
+                }
+                s.values.push_back(i);
+                s.running.store(false);
+            });
+        }
+    }
+    pool.wait();
+
+    for (const auto& s : states) {
+        EXPECT_EQ(s.overlaps.load(), 0);
+        ASSERT_EQ(s.values.size(), PerKey);
+        EXPECT_TRUE(std::ranges::is_sorted(s.values));
+    }
+}
+
+TEST(Dsp, Queue_Blocking) {
+    constexpr int Count = 100000;
+
+    auto q = dsp::queue<int>{ 16 };
+    auto sum = std::int64_t{ 0 };
+    {
+        auto consumer = std::jthread{ [&]() {
+            for (int i = 0; i < Count; ++i) {
+                sum += q.pop();
+            }
+        } };
+        for (int i = 1; i <= Count; ++i) {
+            q.push(i);
+        }
+    }
+
+    EXPECT_EQ(sum, std::int64_t{ Count } * (Count + 1) / 2);
+    EXPECT_EQ(q.size(), 0);
+}
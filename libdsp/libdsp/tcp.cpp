@@ -5,6 +5,7 @@
  */
 
 #include <libdsp/tcp.hpp>
+#include <libdsp/arena.hpp>
 #include <libdsp/profiler.hpp>
 
 #include <libnova/data.hpp>         // TODO(refact): only an alias definition is needed from the header
@@ -126,6 +127,9 @@ private:
             m_metrics->buffer += n;
 
             try {
+                // Data of one read is processed synchronously, scratch memory is released after.
+                const dsp::arena::scope scratch{ dsp::arena::local() };
+
                 while (
                     auto processed = m_handler->process(
                         nova::data_view{
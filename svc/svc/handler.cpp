@@ -14,9 +14,13 @@
 
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <cstdint>
 #include <cstddef>
 #include <string>
+#include <string_view>
 
 namespace app {
 
@@ -119,8 +123,18 @@ auto handler::do_process(nova::data_view data) -> std::size_t {
     return msg.length();
 }
 
-[[nodiscard]] auto deserialize(dat::heartbeat data) {
-    return fmt::format(
+/**
+ * @brief   Longest textual heartbeat: labels and three 20-digit numbers.
+ */
+constexpr auto HeartbeatTextSize = std::size_t{ 96 };
+
+/**
+ * @brief   Format a heartbeat into the buffer, without allocation.
+ */
+[[nodiscard]] auto deserialize(dat::heartbeat data, std::array<char, HeartbeatTextSize>& buffer) -> std::string_view {
+    const auto result = fmt::format_to_n(
+        buffer.data(),
+        buffer.size(),
         "client_id={} "
         "sequence={} "
         "epoch={}",
@@ -128,18 +142,20 @@ auto handler::do_process(nova::data_view data) -> std::size_t {
         data.sequence(),
         data.timestamp()
     );
+    return { buffer.data(), std::min(result.size, buffer.size()) };
 }
 
 /**
  * @brief   Send a message based on routing configuration.
  *
- * Messages can be mirrored to multiple places.
+ * Messages can be mirrored to multiple places. The message is not copied per
+ * destination, only its subject is changed before each send.
  *
  * The following metrics are in use:
  * - processed messages and bytes (labels: subject)
  * - dropped messages and bytes (labels: drop_type[load_shed,not_needed])
  */
-void handler::send(const dsp::message& msg) {
+void handler::send(dsp::message& msg) {
     DSP_PROFILING_ZONE("send");
     static const auto LabelLoadShed  = std::map<std::string, std::string>{ { "drop_type", "load_shed" } };
     static const auto LabelNotNeeded = std::map<std::string, std::string>{ { "drop_type", "not_needed" } };
@@ -147,32 +163,41 @@ void handler::send(const dsp::message& msg) {
         return { { "subject", subject} };
     };
 
-    const auto messages = m_appctx->router.route(msg);
-    for (const auto& m : messages) {
-        if (m_ctx.cache->send(m)) {
+    m_router->route(msg, m_routes);
+    for (const auto& route : m_routes) {
+        msg.subject = route.subject;
+        if (m_ctx.cache->send(route.destination, msg)) {
             // FIXME(perf): Metrics functions receive `std::string`. Avoid unnecessary allocations in hot loop.
-            m_ctx.stats->increment("process_messages_total", 1, LabelSubject(m.subject));
-            m_ctx.stats->increment("process_bytes_total", m.payload.size(), LabelSubject(m.subject));
+            m_ctx.stats->increment("process_messages_total", 1, LabelSubject(route.subject.str()));
+            m_ctx.stats->increment("process_bytes_total", msg.payload.size(), LabelSubject(route.subject.str()));
         } else {
             m_ctx.stats->increment("drop_messages_total", 1, LabelLoadShed);
-            m_ctx.stats->increment("drop_bytes_total", m.payload.size(), LabelLoadShed);
+            m_ctx.stats->increment("drop_bytes_total", msg.payload.size(), LabelLoadShed);
         }
     }
 
-    if (messages.empty()) {
+    if (m_routes.empty()) {
         m_ctx.stats->increment("drop_messages_total", 1, LabelNotNeeded);
         m_ctx.stats->increment("drop_bytes_total", msg.payload.size(), LabelNotNeeded);
     }
 }
 
+/**
+ * @brief   Send a heartbeat; the message is built on the stack without allocation.
+ */
 void handler::do_process(dat::heartbeat data) {
-    const auto msg = dsp::message{
-        .key = { nova::data_view{ std::to_string(data.client_id()) }.to_vec() },
+    auto key = std::array<char, 20>{ };
+    const auto key_end = std::to_chars(key.data(), key.data() + key.size(), data.client_id()).ptr;
+
+    auto text = std::array<char, HeartbeatTextSize>{ };
+
+    auto msg = dsp::message{
+        .key = nova::data_view{ key.data(), static_cast<std::size_t>(key_end - key.data()) },
         .subject = { },
         .properties = {
             { "type", "heartbeat" }
         },
-        .payload = nova::data_view{ deserialize(data) }.to_vec()
+        .payload = dsp::payload_buffer::borrow(deserialize(data, text))
     };
 
     send(msg);
@@ -180,11 +205,11 @@ void handler::do_process(dat::heartbeat data) {
 
 void handler::do_process(dat::dyn_message data) {
     DSP_PROFILING_ZONE("process-msg");
-    const auto msg = dsp::message {
+    auto msg = dsp::message {
         .key = { },
         .subject = { },
         .properties = { },
-        .payload = data.view().to_vec()
+        .payload = dsp::payload_buffer::borrow(data.view())
     };
 
     send(msg);
@@ -224,10 +249,10 @@ auto passthrough_handler::do_process(dat::message data) -> std::size_t {
         .key = {},
         .subject = m_appctx->topic,
         .properties = {},
-        .payload = data.payload().to_vec()
+        .payload = dsp::payload_buffer::borrow(data.payload())
     };
 
-    if (not m_ctx.cache->send(msg)) {
+    if (not m_ctx.cache->send(m_appctx->destination, msg)) {
         m_ctx.stats->increment("drop_messages_total", 1, LabelLoadShed);
         m_ctx.stats->increment("drop_bytes_total", data.length(), LabelLoadShed);
     }
@@ -8,6 +8,7 @@
 
 #include <libdsp/cache.hpp>
 #include <libdsp/handler.hpp>
+#include <libdsp/rcu.hpp>
 #include <libdsp/router.hpp>
 #include <libdsp/tcp_handler.hpp>
 
@@ -34,8 +35,12 @@ enum class handler_type {
 };
 
 struct context {
-    dsp::router router;
-    std::string topic;
+    /**
+     * @brief   Routing rules, replaced at runtime when they are reloaded.
+     */
+    dsp::rcu<dsp::router> router;
+    dsp::subject_ref topic;
+    dsp::cache::destination destination { dsp::cache::Broadcast };
     std::string script;
 };
 
@@ -44,6 +49,7 @@ public:
     handler(const dsp::context& ctx)
         : m_ctx(ctx)
         , m_appctx(std::any_cast<std::shared_ptr<context>>(m_ctx.app))
+        , m_router(m_appctx->router)
     {}
 
     auto do_process(nova::data_view data) -> std::size_t;
@@ -54,8 +60,10 @@ public:
 private:
     dsp::context m_ctx;
     std::shared_ptr<context> m_appctx;
+    dsp::rcu<dsp::router>::reader m_router;
+    dsp::router::routes_t m_routes;
 
-    void send(const dsp::message& msg);
+    void send(dsp::message& msg);
 
 };
 
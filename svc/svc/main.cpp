@@ -33,6 +33,7 @@
 #include <cstdlib>
 #include <filesystem>
 #include <memory>
+#include <mutex>
 #include <optional>
 
 using AppContext = std::shared_ptr<app::context>;
@@ -117,7 +118,7 @@ struct statistics_handler : public dsp::kf::statistics_handler {
  */
 struct custom_northbound : public dsp::northbound_interface {
     bool send(const dsp::message& msg) override {
-        const auto str = nova::data_view{ msg.payload }.as_string();
+        const auto str = msg.payload.view().as_string();
         nova::topic_log::trace("app", "Message: {}", str);
         return true;
     }
@@ -137,7 +138,8 @@ public:
      * Starts a timer at the first non-error message.
      * Logs statistics at EOF.
      *
-     * TODO(feat): Measure each partition separately.
+     * Note: Per-partition throughput and lag are exported by the listener,
+     * these statistics cover all partitions of the handler.
      */
     void process(dsp::kf::message_view_owned& message) override {
         if (not message.ok()) {
@@ -182,17 +184,17 @@ private:
         nova::topic_log::trace("app", "Message received {:lkvh}", message);
 
         const auto msg = dsp::message{
-            .key = message.key().to_vec(),
+            .key = message.key(),
             .subject = m_appctx->topic,
             .properties = {},
-            .payload = message.payload().to_vec()
+            .payload = dsp::payload_buffer::borrow(message.payload())
         };
 
         m_ctx.stats->increment("process_messages_total", 1);
         m_ctx.stats->increment("process_bytes_total", msg.payload.size());
         m_stats->observe(msg.payload.size());
 
-        if (not m_ctx.cache->send(msg)) {
+        if (not m_ctx.cache->send(m_appctx->destination, msg)) {
             m_ctx.stats->increment("drop_messages_total", 1, LabelLoadShed);
             m_ctx.stats->increment("drop_bytes_total", msg.payload.size(), LabelLoadShed);
         }
@@ -200,6 +202,16 @@ private:
 
 };
 
+/**
+ * @brief   Creates a message handler for each Kafka partition worker.
+ */
+class kafka_handler_factory : public dsp::kf::handler_factory {
+public:
+    auto create() -> std::unique_ptr<dsp::kf::handler> override {
+        return std::make_unique<kafka_message_handler>();
+    }
+};
+
 class oam_handler {
 public:
     oam_handler(std::shared_ptr<app::context> ctx, const std::string& script)
@@ -240,6 +252,75 @@ private:
     }
 }
 
+/**
+ * @brief   Routing rules of `dsp.router`, no rules if it is not configured.
+ */
+[[nodiscard]] auto read_router_cfg(const nova::yaml& cfg) -> std::vector<dsp::router::rule_cfg> {
+    // FIXME: yaml.lookup with non-existent key
+    try {
+        static_cast<void>(cfg.lookup<YAML::Node>("dsp.router"));
+    } catch (const std::exception&) {
+        nova::topic_log::warn("app", "No routing rules are configured");
+        return { };
+    }
+
+    // Invalid rules are fatal.
+    return cfg.lookup<std::vector<dsp::router::rule_cfg>>("dsp.router");
+}
+
+/**
+ * @brief   Rebuild the router from the configuration file and publish it.
+ *
+ * The new rules are read, validated and compiled on the calling thread (the
+ * daemon, on SIGUSR1), message handlers switch to them at their next message.
+ * Invalid rules are reported and the current ones are kept.
+ */
+class router_loader {
+public:
+    router_loader(std::string path, std::shared_ptr<app::context> ctx, std::shared_ptr<dsp::cache> cache)
+        : m_path(std::move(path))
+        , m_ctx(std::move(ctx))
+        , m_cache(std::move(cache))
+    {}
+
+    /**
+     * @returns false if the new rules are invalid.
+     */
+    auto operator()() -> bool {
+        const auto lock = std::lock_guard{ m_mutex };
+
+        try {
+            auto router = dsp::router{ read_router_cfg(nova::yaml(std::filesystem::path(m_path))) };
+            router.resolve(*m_cache);
+            const auto size = router.size();
+            router.replace(m_ctx->router.load());
+            m_ctx->router.publish(std::move(router));
+            nova::topic_log::info("app", "Routing rules are reloaded: {} rules", size);
+            return true;
+        } catch (const std::exception& ex) {
+            nova::topic_log::error("app", "Cannot reload routing rules, keeping the current ones: {}", ex.what());
+            return false;
+        }
+    }
+
+private:
+    std::string m_path;
+    std::shared_ptr<app::context> m_ctx;
+    std::shared_ptr<dsp::cache> m_cache;
+    std::mutex m_mutex;
+
+};
+
+/**
+ * @brief   Destination of the messages not routed by rules: the main
+ *          northbound interface if it is attached, all interfaces otherwise.
+ */
+[[nodiscard]] auto resolve_destination(const nova::yaml& cfg, const dsp::cache& cache) -> dsp::cache::destination {
+    return cache
+        .find(cfg.lookup<std::string>("dsp.interfaces.northbound.name"))
+        .value_or(dsp::cache::Broadcast);
+}
+
 void log_init() {
     using namespace nova::units::literals;
 
@@ -283,17 +364,25 @@ auto entrypoint([[maybe_unused]] auto args) -> int {
         nova::topic_log::warn("app", "Cannot attach Kafka callbacks, northbound interface is either not enabled or not a Kafka producer");
     }
 
+    service.northbound("custom-nb", std::make_unique<custom_northbound>());
+
+    // All northbound interfaces are attached, destinations can be resolved.
     auto app_ctx = std::make_shared<app::context>();
-    app_ctx->router = dsp::router{ };
-    app_ctx->topic = cfg->lookup<std::string>("app.topic");
+    auto reload_router = std::make_shared<router_loader>(*nova::getenv("DSP_CONFIG"), app_ctx, service.get_cache());
+    if (not (*reload_router)()) {
+        throw nova::exception("Invalid routing rules");
+    }
+    service.on_reload([reload_router]() { (*reload_router)(); });
+    service.on_update([app_ctx](dsp::metrics_registry& metrics) { app_ctx->router.load()->update(metrics); });
+    app_ctx->topic = dsp::subject_ref{ cfg->lookup<std::string>("app.topic") };
+    app_ctx->destination = resolve_destination(*cfg, *service.get_cache());
 
     auto sb_builder = service.cfg_southbound();
 
     if (const auto sb = cfg->lookup<std::string>("dsp.interfaces.southbound.type"); sb == "tcp") {
         sb_builder.tcp_handler<app::factory>(read_handler_cfg(*cfg));
     } else if (sb == "kafka") {
-        std::unique_ptr<dsp::kf::handler> handler = std::make_unique<kafka_message_handler>();
-        sb_builder.kafka_handler(std::move(handler));
+        sb_builder.kafka_handler<kafka_handler_factory>();
         sb_builder.kafka_props().offset_earliest();
     } else {
         nova::topic_log::critical("app", "Invalid southbound configuration: {}", sb);
@@ -302,8 +391,6 @@ auto entrypoint([[maybe_unused]] auto args) -> int {
     sb_builder.bind(std::make_any<AppContext>(app_ctx));
     sb_builder.build();
 
-    service.northbound("custom-nb", std::make_unique<custom_northbound>());
-
     // TODO(feat): Proper HTTP shutdown without hanging the process.
     // auto oam = dsp::http_server{
         // "0.0.0.0",